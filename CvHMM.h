@@ -28,6 +28,360 @@
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "HMMKernels.h"
+
+/* Observation symbols are stored in the narrowest type that holds the codebook: CV_8U up to 256 symbols, CV_16U up to
+   65536 and CV_32S above. Sequence matrices given to CvHMM may have any of the three depths */
+inline int cvhmmSymbolDepth(const int &codebookSize)
+{
+	return codebookSize <= 256 ? CV_8U : codebookSize <= 65536 ? CV_16U : CV_32S;
+}
+inline size_t cvhmmSymbolSize(const int &depth)
+{
+	return depth == CV_8U ? 1 : depth == CV_16U ? 2 : 4;
+}
+/* Symbol t of row r of a sequence matrix */
+inline int cvhmmSymbol(const cv::Mat &seq, const int &r, const int &t)
+{
+	switch (seq.depth())
+	{
+	case CV_8U: return seq.ptr<unsigned char>(r)[t];
+	case CV_16U: return seq.ptr<unsigned short>(r)[t];
+	default: return seq.ptr<int>(r)[t];
+	}
+}
+inline void cvhmmSetSymbol(cv::Mat &seq, const int &r, const int &t, const int &symbol)
+{
+	switch (seq.depth())
+	{
+	case CV_8U: seq.ptr<unsigned char>(r)[t] = (unsigned char)symbol; break;
+	case CV_16U: seq.ptr<unsigned short>(r)[t] = (unsigned short)symbol; break;
+	default: seq.ptr<int>(r)[t] = symbol;
+	}
+}
+/* Narrows n symbols into a buffer of the given depth */
+inline void cvhmmStoreSymbols(const int *symbols, const int &n, void *out, const int &depth)
+{
+	if (depth == CV_8U)
+		std::copy(symbols,symbols+n,(unsigned char*)out);
+	else if (depth == CV_16U)
+		std::copy(symbols,symbols+n,(unsigned short*)out);
+	else
+		std::copy(symbols,symbols+n,(int*)out);
+}
+
+/* cv::Mat adapters for HMMKernels. The model matrices must be CV_64F and the sequences CV_8U, CV_16U or CV_32S */
+inline HMMModelSpan hmmModelSpan(const cv::Mat &TRANS,const cv::Mat &EMIS,const cv::Mat &INIT)
+{
+	HMMModelSpan model = {TRANS.rows,EMIS.cols,TRANS.ptr<double>(0),(int)TRANS.step1(),EMIS.ptr<double>(0),(int)EMIS.step1(),INIT.ptr<double>(0)};
+	return model;
+}
+/* Lattice stored as N x T (one row per state, the layout of the FORWARD/BACKWARD/PSTATES outputs) */
+inline HMMLatticeSpan hmmLatticeSpan(cv::Mat &LATTICE)
+{
+	HMMLatticeSpan lattice = {LATTICE.empty() ? NULL : LATTICE.ptr<double>(0),(int)LATTICE.step1(),1};
+	return lattice;
+}
+/* Lattice stored as T x N (one row per time step, contiguous states for the kernels' inner loops) */
+inline HMMLatticeSpan hmmTimeMajorSpan(cv::Mat &LATTICE)
+{
+	HMMLatticeSpan lattice = {LATTICE.empty() ? NULL : LATTICE.ptr<double>(0),1,(int)LATTICE.step1()};
+	return lattice;
+}
+/* HMMKernels on the first row of a sequence matrix, read in the symbol type of its depth */
+inline double hmmForward(const HMMModelSpan &m, const cv::Mat &seq, const int &T, const HMMLatticeSpan &alpha, double *c)
+{
+	switch (seq.depth())
+	{
+	case CV_8U: return HMMKernels::forward(m,seq.ptr<unsigned char>(0),T,alpha,c);
+	case CV_16U: return HMMKernels::forward(m,seq.ptr<unsigned short>(0),T,alpha,c);
+	default: return HMMKernels::forward(m,seq.ptr<int>(0),T,alpha,c);
+	}
+}
+inline double hmmForwardLikelihood(const HMMModelSpan &m, const cv::Mat &seq, const int &T, double *work)
+{
+	switch (seq.depth())
+	{
+	case CV_8U: return HMMKernels::forwardLikelihood(m,seq.ptr<unsigned char>(0),T,work);
+	case CV_16U: return HMMKernels::forwardLikelihood(m,seq.ptr<unsigned short>(0),T,work);
+	default: return HMMKernels::forwardLikelihood(m,seq.ptr<int>(0),T,work);
+	}
+}
+inline void hmmBackward(const HMMModelSpan &m, const cv::Mat &seq, const int &T, const double *c, const HMMLatticeSpan &beta)
+{
+	switch (seq.depth())
+	{
+	case CV_8U: HMMKernels::backward(m,seq.ptr<unsigned char>(0),T,c,beta); break;
+	case CV_16U: HMMKernels::backward(m,seq.ptr<unsigned short>(0),T,c,beta); break;
+	default: HMMKernels::backward(m,seq.ptr<int>(0),T,c,beta);
+	}
+}
+inline void hmmPosteriors(const HMMModelSpan &m, const cv::Mat &seq, const int &T, const HMMLatticeSpan &alpha, const HMMLatticeSpan &beta, const HMMLatticeSpan &gamma, const HMMLatticeSpan &xi)
+{
+	switch (seq.depth())
+	{
+	case CV_8U: HMMKernels::posteriors(m,seq.ptr<unsigned char>(0),T,alpha,beta,gamma,xi); break;
+	case CV_16U: HMMKernels::posteriors(m,seq.ptr<unsigned short>(0),T,alpha,beta,gamma,xi); break;
+	default: HMMKernels::posteriors(m,seq.ptr<int>(0),T,alpha,beta,gamma,xi);
+	}
+}
+inline void hmmViterbi(const HMMModelSpan &m, const cv::Mat &seq, const int &T, int *states, int *psi, double *work)
+{
+	switch (seq.depth())
+	{
+	case CV_8U: HMMKernels::viterbi(m,seq.ptr<unsigned char>(0),T,states,psi,work); break;
+	case CV_16U: HMMKernels::viterbi(m,seq.ptr<unsigned short>(0),T,states,psi,work); break;
+	default: HMMKernels::viterbi(m,seq.ptr<int>(0),T,states,psi,work);
+	}
+}
+
+/* Buffers used by CvHMM::train, allocated once for (N states, M symbols, T elements per sequence).
+   The lattices are stored time-major (T rows) so that the kernels walk contiguous states */
+class CvHMMWorkspace {
+public:
+	CvHMMWorkspace():productSymbols(0){};
+	CvHMMWorkspace(const int &N, const int &M, const int &T):productSymbols(0) { create(N,M,T); }
+	/* Allocates the buffers; cv::Mat::create is a no-op when the size does not change */
+	void create(const int &N, const int &M, const int &T)
+	{
+		a.create(T,N,CV_64F);
+		b.create(T,N,CV_64F);
+		c.create(1,T,CV_64F);
+		YN.create(T,N,CV_64F);
+		YNN.create(T,N*N,CV_64F);
+		FTRANS.create(N,N,CV_64F);
+		FEMIS.create(N,M,CV_64F);
+		FINIT.create(1,N,CV_64F);
+	}
+	cv::Mat a,b,c; // scaled forward / backward lattices and scale factors
+	cv::Mat YN,YNN; // state and pairwise transition posteriors
+	cv::Mat FTRANS,FEMIS,FINIT; // running average of the re-estimated model
+	std::vector<const void*> rows; // training sequences, which may have different lengths
+	std::vector<int> lengths;
+	/* 0 for a plain alphabet. Otherwise the symbols are pairs k = r*productSymbols+l (see ProductQuantizer) and
+	   training keeps every row of EMIS factored as P(r)*P(l) (see CvHMM::factorEmission) */
+	int productSymbols;
+};
+
+/* Training sequences for CvHMM::train, pulled one at a time so that the training set never has to be materialized.
+   Every pass visits the same sequences in the same order */
+class CvHMMSequenceSource {
+public:
+	virtual ~CvHMMSequenceSource(){};
+	/* Starts a new pass */
+	virtual void rewind() = 0;
+	/* Next sequence of the pass, or false at its end: T symbols of type depth(). seq stays valid until the next call */
+	virtual bool next(const void *&seq, int &T) = 0;
+	/* Length of the longest sequence, to size the workspace */
+	virtual int maxLength() = 0;
+	/* CV_8U, CV_16U or CV_32S, the same for every sequence (see cvhmmSymbolDepth) */
+	virtual int depth() = 0;
+};
+
+/* Sequences that are already in memory (rows[d] has lengths[d] symbols of type _depth) */
+class CvHMMArraySource : public CvHMMSequenceSource {
+public:
+	CvHMMArraySource(const std::vector<const void*> &_rows, const std::vector<int> &_lengths, const int &_depth):rows(_rows),lengths(_lengths),symbolDepth(_depth),index(0){};
+	void rewind() { index = 0; }
+	bool next(const void *&seq, int &T)
+	{
+		if (index >= rows.size())
+			return false;
+		seq = rows[index];
+		T = lengths[index];
+		index++;
+		return true;
+	}
+	int maxLength() { return lengths.empty() ? 0 : *std::max_element(lengths.begin(),lengths.end()); }
+	int depth() { return symbolDepth; }
+private:
+	const std::vector<const void*> &rows;
+	const std::vector<int> &lengths;
+	int symbolDepth;
+	size_t index;
+};
+
+/* Leave-one-out variants generated on the fly: each original of length T yields the T sequences of length T-1 that
+   skip one element, in the same order as KMeans::lootStrategy. Only one variant (T-1 symbols) exists at a time, so the
+   memory does not grow with the T-fold augmentation. Originals shorter than 2 are skipped */
+class CvHMMLootSource : public CvHMMSequenceSource {
+public:
+	/* One original per row of a sequence matrix */
+	CvHMMLootSource(const cv::Mat &originals):symbolDepth(originals.depth())
+	{
+		for (int r=0;r<originals.rows;r++)
+			add(originals.ptr(r),originals.cols);
+		rewind();
+	}
+	/* One 1xT_{d} sequence matrix per original, all with the same depth */
+	CvHMMLootSource(const std::vector<cv::Mat> &originals):symbolDepth(originals.empty() ? CV_32S : originals[0].depth())
+	{
+		for (size_t d=0;d<originals.size();d++)
+			add(originals[d].ptr(0),originals[d].cols);
+		rewind();
+	}
+	void rewind()
+	{
+		original = 0;
+		skip = 0;
+	}
+	bool next(const void *&seq, int &T)
+	{
+		if (original >= rows.size())
+			return false;
+		const unsigned char *row = rows[original];
+		int size = lengths[original];
+		size_t bytes = cvhmmSymbolSize(symbolDepth);
+		std::copy(row,row+skip*bytes,variant.begin());
+		std::copy(row+(skip+1)*bytes,row+size*bytes,variant.begin()+skip*bytes);
+		seq = &variant[0];
+		T = size-1;
+		if (++skip == size)
+		{
+			skip = 0;
+			original++;
+		}
+		return true;
+	}
+	int maxLength() { return lengths.empty() ? 0 : *std::max_element(lengths.begin(),lengths.end())-1; }
+	int depth() { return symbolDepth; }
+	/* Number of variants in a pass */
+	size_t size() const
+	{
+		size_t count = 0;
+		for (size_t d=0;d<lengths.size();d++)
+			count += lengths[d];
+		return count;
+	}
+private:
+	int symbolDepth;
+	std::vector<const unsigned char*> rows;
+	std::vector<int> lengths;
+	std::vector<unsigned char> variant; // T-1 symbols of type symbolDepth
+	size_t original;
+	int skip;
+	void add(const unsigned char *row, const int &T)
+	{
+		if (T < 2)
+			return;
+		rows.push_back(row);
+		lengths.push_back(T);
+		if (variant.size() < (T-1)*cvhmmSymbolSize(symbolDepth))
+			variant.resize((T-1)*cvhmmSymbolSize(symbolDepth));
+	}
+};
+
+/* Outputs of CvHMM::decode, combined with | in the flags argument. The log-likelihood is always computed */
+enum CvHMMDecodeFlags {
+	CVHMM_LIKELIHOOD = 0, // only log[P(O|y)]
+	CVHMM_FORWARD = 1, // scaled forward lattice a_{t}(i)
+	CVHMM_POSTERIORS = 2, // posterior state probabilities Y_{t}(i) (and the backward lattice)
+	CVHMM_PAIRWISE = 4 // pairwise transition posteriors Y_{t}(i,j)
+};
+
+/* Result of CvHMM::decode. Posteriors are computed on first access and only if they were requested */
+class CvHMMDecoding {
+public:
+	CvHMMDecoding():logpseq(0),flags(0),computed(false){};
+	double logpseq;
+	/* Scaled forward lattice, N x T (empty without CVHMM_FORWARD, CVHMM_POSTERIORS or CVHMM_PAIRWISE) */
+	const cv::Mat &forward() const { return FORWARD; }
+	/* Scaled backward lattice, N x T (empty without CVHMM_POSTERIORS or CVHMM_PAIRWISE) */
+	const cv::Mat &backward() { computePosteriors(); return BACKWARD; }
+	/* Posterior state probabilities, N x T (empty without CVHMM_POSTERIORS or CVHMM_PAIRWISE) */
+	const cv::Mat &posteriors() { computePosteriors(); return PSTATES; }
+	/* Pairwise transition posteriors, N*N x T, row i*N+j (empty without CVHMM_PAIRWISE) */
+	const cv::Mat &pairwise() { computePosteriors(); return YNN; }
+private:
+	friend class CvHMM;
+	int flags;
+	bool computed;
+	cv::Mat seq,TRANS,EMIS,c;
+	cv::Mat FORWARD,BACKWARD,PSTATES,YNN;
+	void reset(const int &_flags)
+	{
+		flags = _flags;
+		computed = false;
+		seq.release(); TRANS.release(); EMIS.release(); c.release();
+		FORWARD.release(); BACKWARD.release(); PSTATES.release(); YNN.release();
+	}
+	void computePosteriors()
+	{
+		if (computed || !(flags & (CVHMM_POSTERIORS|CVHMM_PAIRWISE)))
+			return;
+		computed = true;
+		int T = seq.cols;
+		int N = TRANS.rows;
+		cv::Mat INIT(1,N,CV_64F); // not used by the B-pass, only completes the span
+		HMMModelSpan model = hmmModelSpan(TRANS,EMIS,INIT);
+		// 3. The B-pass
+		BACKWARD = cv::Mat(N,T,CV_64F);
+		hmmBackward(model,seq,T,c.ptr<double>(0),hmmLatticeSpan(BACKWARD));
+		// 4. Compute Y_{t}(i,j) and Y_{t}(i)
+		PSTATES = cv::Mat(N,T,CV_64F);
+		if (flags & CVHMM_PAIRWISE)
+			YNN = cv::Mat(N*N,T,CV_64F);
+		hmmPosteriors(model,seq,T,hmmLatticeSpan(FORWARD),hmmLatticeSpan(BACKWARD),hmmLatticeSpan(PSTATES),hmmLatticeSpan(YNN));
+	}
+};
+
+/* Samples state and emission sequences from a Markov model. The cumulative tables are built once in the
+   constructor and the random generator is supplied by the caller, so one sampler can be shared by many threads */
+class CvHMMSampler {
+public:
+	CvHMMSampler(const cv::Mat &_TRANS,const cv::Mat &_EMIS, const cv::Mat &_INIT)
+	{
+		N = _TRANS.rows;
+		M = _EMIS.cols;
+		cumulative(_TRANS,cumulative_trans);
+		cumulative(_EMIS,cumulative_emis);
+		cumulative(_INIT,cumulative_init);
+	}
+	/* Writes T emissions to seq and, if not NULL, T states to states */
+	template<typename RNG> void generate(const int &T, RNG &rng, int *seq, int *states = NULL) const
+	{
+		std::uniform_real_distribution<double> uniform(0.0,1.0);
+		int state = draw(&cumulative_init[0],N,uniform(rng));
+		for (int t=0;t<T;t++)
+		{
+			if (t>0)
+				state = draw(&cumulative_trans[state*N],N,uniform(rng));
+			seq[t] = draw(&cumulative_emis[state*M],M,uniform(rng));
+			if (states)
+				states[t] = state;
+		}
+	}
+	int states() const { return N; }
+	int symbols() const { return M; }
+private:
+	int N,M;
+	std::vector<double> cumulative_trans,cumulative_emis,cumulative_init;
+	static void cumulative(const cv::Mat &P, std::vector<double> &table)
+	{
+		table.resize(P.rows*P.cols);
+		for (int r=0;r<P.rows;r++)
+		{
+			double sum = 0;
+			for (int c=0;c<P.cols;c++)
+			{
+				sum += P.at<double>(r,c);
+				table[r*P.cols+c] = sum;
+			}
+			// normalize so that the last entry is exactly 1 even with rounding
+			for (int c=0;c<P.cols;c++)
+				table[r*P.cols+c] /= sum;
+		}
+	}
+	/* First index whose cumulative probability is >= r */
+	static int draw(const double *table, const int &n, const double &r)
+	{
+		int i = std::lower_bound(table,table+n,r) - table;
+		return i < n ? i : n-1;
+	}
+};
 
 class CvHMM {
 public:
@@ -105,61 +459,30 @@ public:
 	/* Calculates the most probable state path for a hidden Markov model */
 	static void viterbi(const cv::Mat &seq, const cv::Mat &_TRANS, const cv::Mat &_EMIS, const cv::Mat &_INIT, cv::Mat &states)
 	{
-		/* Viterbi Algorithm, Wikipedia */
 		cv::Mat TRANS = _TRANS.clone();
 		cv::Mat EMIS = _EMIS.clone();
 		cv::Mat INIT = _INIT.clone();
 		correctModel(TRANS,EMIS,INIT);
 		int nseq = seq.cols;
-		int nstates = TRANS.cols;		
-		int nobs = EMIS.cols;		
-		cv::Mat v(nstates,nseq,CV_64F);
-        cv::Mat path(nstates,nseq,CV_32S); path = 0.0f;
-        cv::Mat newpath(nstates,nseq,CV_32S); newpath = 0.0f;
-		for (int y=0;y<nstates;y++)
-		{
-			v.at<double>(y,0) = log(INIT.at<double>(0,y)) + log(EMIS.at<double>(y,seq.at<int>(0,0)));
-			path.at<int>(y,0) = y;
-		}
-		double maxp,p;
-		int state;
-		for (int t=1;t<nseq;t++)
-		{			
-			for (int y=0;y<nstates;y++)
-			{
-				maxp = -DBL_MAX;
-				state = y;
-				for (int y0=0;y0<nstates;y0++)
-				{					
-					p = v.at<double>(y0,t-1) + log(TRANS.at<double>(y0,y)) + log(EMIS.at<double>(y,seq.at<int>(0,t)));			
-					if (maxp<p)
-					{						
-						maxp = p;
-						state = y0;
-					}
-				}			
-				v.at<double>(y,t) = maxp;				
-				for (int t1=0;t1<t;t1++)
-					newpath.at<int>(y,t1) = path.at<int>(state,t1);
-				newpath.at<int>(y,t) = y;
-			}
-			path.release();
-			path = newpath.clone();
-		}
-		maxp = -DBL_MAX;		
-		for (int y=0;y<nstates;y++)
-		{						
-			if (maxp < v.at<double>(y,nseq-1))
-			{
-				maxp = v.at<double>(y,nseq-1);
-				state = y;
-			}
-		}		
-		states = path.row(state).clone();
+		int nstates = TRANS.cols;
+		cv::Mat psi(nseq,nstates,CV_32S);
+		cv::Mat work(1,(int)HMMKernels::viterbiWorkSize(nstates),CV_64F);
+		states = cv::Mat(1,nseq,CV_32S);
+		hmmViterbi(hmmModelSpan(TRANS,EMIS,INIT),seq,nseq,states.ptr<int>(0),psi.ptr<int>(0),work.ptr<double>(0));
 	}
 
 	/*  Calculates the posterior state probabilities of a sequence of emissions */
     static void decode(const cv::Mat &seq,const cv::Mat &_TRANS,const cv::Mat &_EMIS, const cv::Mat &_INIT, double &logpseq, cv::Mat &PSTATES, cv::Mat &FORWARD, cv::Mat &BACKWARD)
+	{
+		CvHMMDecoding decoding;
+		decode(seq,_TRANS,_EMIS,_INIT,CVHMM_FORWARD|CVHMM_POSTERIORS,decoding);
+		logpseq = decoding.logpseq;
+		PSTATES = decoding.posteriors();
+		FORWARD = decoding.forward();
+		BACKWARD = decoding.backward();
+	}
+	/* Calculates only the outputs requested in flags (CVHMM_*); the log-likelihood is always computed */
+	static void decode(const cv::Mat &seq,const cv::Mat &_TRANS,const cv::Mat &_EMIS, const cv::Mat &_INIT, const int &flags, CvHMMDecoding &decoding)
 	{
 		/* A Revealing Introduction to Hidden Markov Models, Mark Stamp */
 		// 1. Initialization
@@ -168,85 +491,29 @@ public:
 		cv::Mat INIT = _INIT.clone();
 		correctModel(TRANS,EMIS,INIT);
 		int T = seq.cols; // number of element per sequence
-		int C = seq.rows; // number of sequences
 		int N = TRANS.rows; // number of states | also N = TRANS.cols | TRANS = A = {a_{i,j}} - NxN
-		int M = EMIS.cols; // number of observations | EMIS = B = {b_{j}(k)} - NxM				
-		// compute a_{0}	
-		FORWARD = cv::Mat(N,T,CV_64F);
-		cv::Mat c(1,T,CV_64F); c.at<double>(0,0) = 0;
-		for (int i=0;i<N;i++)
+		HMMModelSpan model = hmmModelSpan(TRANS,EMIS,INIT);
+		decoding.reset(flags);
+		// 2. The a-pass. The whole lattice is only kept when it is an output or the posteriors will need it,
+		// otherwise the a-pass runs on two alternating columns
+		if (flags & (CVHMM_FORWARD|CVHMM_POSTERIORS|CVHMM_PAIRWISE))
 		{
-			FORWARD.at<double>(i,0) = INIT.at<double>(0,i)*EMIS.at<double>(i,seq.at<int>(0,0));
-			c.at<double>(0,0) += FORWARD.at<double>(i,0); 
+			decoding.FORWARD = cv::Mat(N,T,CV_64F);
+			decoding.c = cv::Mat(1,T,CV_64F);
+			decoding.logpseq = hmmForward(model,seq,T,hmmLatticeSpan(decoding.FORWARD),decoding.c.ptr<double>(0));
 		}
-		// scale the a_{0}(i)
-		c.at<double>(0,0) = 1/c.at<double>(0,0);
-		for (int i=0;i<N;i++)
-			FORWARD.at<double>(i,0) *= c.at<double>(0,0);
-		// 2. The a-pass
-		// compute a_{t}(i)
-		for (int t=1;t<T;t++)
+		else
 		{
-			c.at<double>(0,t) = 0;
-			for (int i=0;i<N;i++)
-			{
-				FORWARD.at<double>(i,t) = 0;
-				for (int j=0;j<N;j++)				
-					FORWARD.at<double>(i,t) += FORWARD.at<double>(i,t-1)*TRANS.at<double>(j,i);
-				FORWARD.at<double>(i,t) = FORWARD.at<double>(i,t) * EMIS.at<double>(i,seq.at<int>(0,t));
-				c.at<double>(0,t)+=FORWARD.at<double>(i,t);
-			}
-			// scale a_{t}(i)
-			c.at<double>(0,t) = 1/c.at<double>(0,t);
-			for (int i=0;i<N;i++)
-				FORWARD.at<double>(i,t)=c.at<double>(0,t)*FORWARD.at<double>(i,t);
+			cv::Mat work(1,2*N,CV_64F);
+			decoding.logpseq = hmmForwardLikelihood(model,seq,T,work.ptr<double>(0));
 		}
-		// 3. The B-pass
-		BACKWARD = cv::Mat(N,T,CV_64F);
-		// Let B_{t-1}(i) = 1 scaled by C_{t-1}
-		for (int i=0;i<N;i++)
-			BACKWARD.at<double>(i,T-1) = c.at<double>(0,T-1);
-		// B-pass
-		for (int t=T-2;t>-1;t--)
-			for (int i=0;i<N;i++)
-			{
-				BACKWARD.at<double>(i,t) = 0;
-				for (int j=0;j<N;j++)
-					BACKWARD.at<double>(i,t) += TRANS.at<double>(i,j)*EMIS.at<double>(j,seq.at<int>(0,t+1))*BACKWARD.at<double>(j,t+1);
-				// scale B_{t}(i) with same scale factor as a_{t}(i)
-				BACKWARD.at<double>(i,t) *= c.at<double>(0,t);
-			}
-		// 4. 
-		// Compute Y_{t}(i,j) : The probability of being in state i at time t and transiting to state j at time t+1
-		// Compute Y_{t}(i) 
-		double denom;
-		int index;		
-		
-		PSTATES = cv::Mat(N,T,CV_64F);
-		cv::Mat YNN(N*N,T,CV_64F);
-		for (int t=0;t<T-1;t++)
+		// steps 3-5 (B-pass and posteriors) are deferred to CvHMMDecoding::posteriors()
+		if (flags & (CVHMM_POSTERIORS|CVHMM_PAIRWISE))
 		{
-			denom = 0;
-			for (int i=0;i<N;i++)
-				for (int j=0;j<N;j++)
-					denom += FORWARD.at<double>(i,t)*TRANS.at<double>(i,j)*EMIS.at<double>(j,seq.at<int>(0,t+1))*BACKWARD.at<double>(j,t+1);
-			index = 0;
-			for (int i=0;i<N;i++)
-			{
-				PSTATES.at<double>(i,t) = 0;
-				for (int j=0;j<N;j++)
-				{
-					YNN.at<double>(index,t) = (FORWARD.at<double>(i,t)*TRANS.at<double>(i,j)*EMIS.at<double>(j,seq.at<int>(0,t+1))*BACKWARD.at<double>(j,t+1))/denom;
-					PSTATES.at<double>(i,t)+=YNN.at<double>(index,t);
-					index++;
-				}
-			}
+			decoding.seq = seq;
+			decoding.TRANS = TRANS;
+			decoding.EMIS = EMIS;
 		}
-		// 6. Compute log[P(O|y)]
-		logpseq = 0;
-		for (int i=0;i<T;i++)
-			logpseq += log(c.at<double>(0,i));
-		logpseq *= -1;
 	}
 	
 	static void getUniformModel(const int &n_states,const int &n_observations, cv::Mat &TRANS,cv::Mat &EMIS,cv::Mat &INIT)
@@ -261,166 +528,204 @@ public:
 
 	/* Calculates maximum likelihood estimates of transition and emission probabilities from a sequence of emissions */
 	static void train(const cv::Mat &seq, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT,bool UseUniformPrior = false)
+	{
+		CvHMMWorkspace workspace(TRANS.rows,EMIS.cols,seq.cols);
+		train(seq,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior);
+	}
+	/* Same as above, but every buffer comes from a workspace that can be reused across calls */
+	static void train(const cv::Mat &seq, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT, CvHMMWorkspace &workspace, bool UseUniformPrior = false)
+	{
+		workspace.rows.resize(seq.rows);
+		workspace.lengths.assign(seq.rows,seq.cols);
+		for (int r=0;r<seq.rows;r++)
+			workspace.rows[r] = seq.ptr(r);
+		CvHMMArraySource source(workspace.rows,workspace.lengths,seq.depth());
+		trainSequences(source,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior);
+	}
+	/* Training on sequences of different lengths, one 1xT_{d} sequence matrix per sequence, all with the same depth */
+	static void train(const std::vector<cv::Mat> &seqs, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT, bool UseUniformPrior = false)
+	{
+		CvHMMWorkspace workspace;
+		train(seqs,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior);
+	}
+	static void train(const std::vector<cv::Mat> &seqs, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT, CvHMMWorkspace &workspace, bool UseUniformPrior = false)
+	{
+		workspace.rows.resize(seqs.size());
+		workspace.lengths.resize(seqs.size());
+		for (size_t d=0;d<seqs.size();d++)
+		{
+			workspace.rows[d] = seqs[d].ptr(0);
+			workspace.lengths[d] = seqs[d].cols;
+		}
+		CvHMMArraySource source(workspace.rows,workspace.lengths,seqs.empty() ? CV_32S : seqs[0].depth());
+		trainSequences(source,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior);
+	}
+	/* Training on sequences pulled from a source, e.g. generated on the fly by CvHMMLootSource */
+	static void train(CvHMMSequenceSource &source, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT, bool UseUniformPrior = false)
+	{
+		CvHMMWorkspace workspace;
+		trainSequences(source,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior);
+	}
+	static void train(CvHMMSequenceSource &source, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT, CvHMMWorkspace &workspace, bool UseUniformPrior = false)
+	{
+		trainSequences(source,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior);
+	}
+	/* Baum-Welch over the sequences of a source, one sequence per re-estimation, for at most max_iter passes and
+	   while the total log[P(O|y)] of a pass improves on the previous pass */
+	static void trainSequences(CvHMMSequenceSource &source, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT, CvHMMWorkspace &workspace, bool UseUniformPrior = false)
+	{
+		switch (source.depth())
+		{
+		case CV_8U: trainSymbols<unsigned char>(source,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior); break;
+		case CV_16U: trainSymbols<unsigned short>(source,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior); break;
+		default: trainSymbols<int>(source,max_iter,TRANS,EMIS,INIT,workspace,UseUniformPrior);
+		}
+	}
+	/* trainSequences with the symbols read as Symbol, the type of source.depth() */
+	template<typename Symbol> static void trainSymbols(CvHMMSequenceSource &source, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT, CvHMMWorkspace &workspace, bool UseUniformPrior)
 	{
 		/* A Revealing Introduction to Hidden Markov Models, Mark Stamp */
 		// 1. Initialization
-		int iters = 0;				
-		int T = seq.cols; // number of element per sequence
-		int C = seq.rows; // number of sequences
+		const void *next;
+		const Symbol *obs;
+		int T; // number of element of the current sequence
+		if (workspace.productSymbols>0 && !isProductAlphabet(EMIS.cols,workspace.productSymbols))
+			return; // the alphabet is not R*L: the model is left untouched
+		source.rewind();
+		if (!source.next(next,T))
+			return;
+		obs = (const Symbol*)next;
+		int iters = 0;
 		int N = TRANS.rows; // number of states | also N = TRANS.cols | TRANS = A = {aij} - NxN
-		int M = EMIS.cols; // number of observations | EMIS = B = {bj(k)} - NxM		
+		int M = EMIS.cols; // number of observations | EMIS = B = {bj(k)} - NxM
+		int maxT = source.maxLength(); // longest sequence
+		if (workspace.productSymbols>0)
+			factorEmission(EMIS,workspace.productSymbols);
 		correctModel(TRANS,EMIS,INIT);
-		cv::Mat FTRANS,FINIT,FEMIS;
+		workspace.create(N,M,maxT);
+		cv::Mat &FTRANS = workspace.FTRANS, &FEMIS = workspace.FEMIS, &FINIT = workspace.FINIT;
 		if (UseUniformPrior)
-			getUniformModel(N,M,FTRANS,FEMIS,FINIT);
-		else
 		{
-			FTRANS = TRANS.clone();
-			FEMIS = EMIS.clone();
-			FINIT = INIT.clone();
+			FTRANS = 1.0/N;
+			FEMIS = 1.0/M;
+			FINIT = 1.0/N;
 		}
-		// compute a0		
-		cv::Mat a(N,T,CV_64F);
-		cv::Mat c(1,T,CV_64F); c.at<double>(0,0) = 0;
-		for (int i=0;i<N;i++)
+		else
 		{
-			a.at<double>(i,0) = INIT.at<double>(0,i)*EMIS.at<double>(i,seq.at<int>(0,0));
-			c.at<double>(0,0) += a.at<double>(i,0); 
+			TRANS.copyTo(FTRANS);
+			EMIS.copyTo(FEMIS);
+			INIT.copyTo(FINIT);
 		}
-		// scale the a0(i)
-		c.at<double>(0,0) = 1/c.at<double>(0,0);
-		for (int i=0;i<N;i++)
-			a.at<double>(i,0) *= c.at<double>(0,0);
-		double logProb = -DBL_MAX;
-		double oldLogProb;
+		HMMModelSpan model = hmmModelSpan(TRANS,EMIS,INIT); // re-estimation writes in place, so the span stays valid
+		HMMLatticeSpan a = hmmTimeMajorSpan(workspace.a), b = hmmTimeMajorSpan(workspace.b);
+		HMMLatticeSpan YN = hmmTimeMajorSpan(workspace.YN), YNN = hmmTimeMajorSpan(workspace.YNN);
+		double *c = workspace.c.ptr<double>(0);
+		// log[P(O|y)] summed over the sequences of a pass, compared between whole passes
+		double logProb = 0;
+		double oldLogProb = -DBL_MAX;
+		bool improving = true;
 		int data = 0;
 		do {
-			oldLogProb = logProb;
-			// 2. The a-pass
-			// compute at(i)
+			// 2. The a-pass, from the a0 of the current sequence
+			c[0] = HMMKernels::forwardInit(model,obs[0],a.column(0),a.stateStride);
 			for (int t=1;t<T;t++)
-			{
-				c.at<double>(0,t) = 0;
-				for (int i=0;i<N;i++)
-				{
-					a.at<double>(i,t) = 0;
-					for (int j=0;j<N;j++)				
-						a.at<double>(i,t) += a.at<double>(i,t-1)*TRANS.at<double>(j,i);
-					a.at<double>(i,t) = a.at<double>(i,t) * EMIS.at<double>(i,seq.at<int>(data,t));
-					c.at<double>(0,t)+=a.at<double>(i,t);
-				}
-				// scale at(i)
-				c.at<double>(0,t) = 1/c.at<double>(0,t);
-				for (int i=0;i<N;i++)
-					a.at<double>(i,t)=c.at<double>(0,t)*a.at<double>(i,t);
-			}
+				c[t] = HMMKernels::forwardStep(model,obs[t],a.column(t-1),a.column(t),a.stateStride);
 			// 3. The B-pass
-			cv::Mat b(N,T,CV_64F);
-			// Let Bt-1(i) = 1 scaled by Ct-1
-			for (int i=0;i<N;i++)
-				b.at<double>(i,T-1) = c.at<double>(0,T-1);
-			// B-pass
-			for (int t=T-2;t>-1;t--)
-				for (int i=0;i<N;i++)
-				{
-					b.at<double>(i,t) = 0;
-					for (int j=0;j<N;j++)
-						b.at<double>(i,t) += TRANS.at<double>(i,j)*EMIS.at<double>(j,seq.at<int>(data,t+1))*b.at<double>(j,t+1);
-					// scale Bt(i) with same scale factor as at(i)
-					b.at<double>(i,t) *= c.at<double>(0,t);
-				}
+			HMMKernels::backward(model,obs,T,c,b);
 			// 4. Compute  Yt(i,j) and Yt(i)
-			double denom;
-			int index;
-			cv::Mat YN(N,T,CV_64F);
-			cv::Mat YNN(N*N,T,CV_64F);
-			for (int t=0;t<T-1;t++)
-			{
-				denom = 0;
-				for (int i=0;i<N;i++)
-					for (int j=0;j<N;j++)
-						denom += a.at<double>(i,t)*TRANS.at<double>(i,j)*EMIS.at<double>(j,seq.at<int>(data,t+1))*b.at<double>(j,t+1);
-				index = 0;
-				for (int i=0;i<N;i++)
-				{
-					YN.at<double>(i,t) = 0;
-					for (int j=0;j<N;j++)
-					{
-						YNN.at<double>(index,t) = (a.at<double>(i,t)*TRANS.at<double>(i,j)*EMIS.at<double>(j,seq.at<int>(data,t+1))*b.at<double>(j,t+1))/denom;
-						YN.at<double>(i,t)+=YNN.at<double>(index,t);
-						index++;
-					}
-				}
-			}
+			HMMKernels::posteriors(model,obs,T,a,b,YN,YNN);
 			// 5. Re-estimate A,B and pi
-			// re-estimate pi		
-			for (int i=0;i<N;i++)
-				INIT.at<double>(0,i) = YN.at<double>(i,0);
-			// re-estimate A
-			double numer;
-			index = 0;
-			for (int i=0;i<N;i++)
-				for (int j=0;j<N;j++)
-				{
-					numer = 0;
-					denom = 0;
-					for (int t=0;t<T-1;t++)
-					{
-						numer += YNN.at<double>(index,t);
-						denom += YN.at<double>(i,t);
-					}
-					TRANS.at<double>(i,j) = numer/denom;
-					index++;
-				}
-			// re-estimate B
-			for (int i=0;i<N;i++)
-				for (int j=0;j<M;j++)
-				{
-					numer = 0;
-					denom = 0; 
-					for (int t=0;t<T-1;t++)
-					{
-						if (seq.at<int>(data,t)==j) 
-							numer+=YN.at<double>(i,t);
-						denom += YN.at<double>(i,t);
-					}
-					EMIS.at<double>(i,j) = numer/denom;
-				}
+			HMMKernels::reestimate(obs,T,N,M,YN,YNN,TRANS.ptr<double>(0),(int)TRANS.step1(),EMIS.ptr<double>(0),(int)EMIS.step1(),INIT.ptr<double>(0));
+			if (workspace.productSymbols>0)
+				factorEmission(EMIS,workspace.productSymbols);
 			correctModel(TRANS,EMIS,INIT);
-			FTRANS = (FTRANS*(data+1)+TRANS)/(data+2);
-			FEMIS = (FEMIS*(data+1)+EMIS)/(data+2);
-			FINIT = (FINIT*(data+1)+INIT)/(data+2);
-			// 6. Compute log[P(O|y)]
-			logProb = 0;
-			for (int i=0;i<T;i++)
-				logProb += log(c.at<double>(0,i));
-			logProb *= -1;
-			// 7. To iterate or not
+			blend(FTRANS,TRANS,data+1);
+			blend(FEMIS,EMIS,data+1);
+			blend(FINIT,INIT,data+1);
+			// 6. Accumulate log[P(O|y)] of the pass
+			logProb += HMMKernels::logLikelihood(c,T);
+			// 7. To iterate or not: after each pass, while the pass total still improves
 			data++;
-			if (data >= C)
+			if (!source.next(next,T))
 			{
+				improving = logProb>oldLogProb;
+				oldLogProb = logProb;
+				logProb = 0;
 				data = 0;
 				iters++;
+				source.rewind();
+				source.next(next,T);
 			}
-		} while (iters<max_iter && logProb>oldLogProb);
+			obs = (const Symbol*)next;
+		} while (iters<max_iter && improving);
+		// the average of factored rows is not factored
+		if (workspace.productSymbols>0)
+			factorEmission(FEMIS,workspace.productSymbols);
 		correctModel(FTRANS,FEMIS,FINIT);
-		TRANS = FTRANS.clone();
-		EMIS = FEMIS.clone();
-		INIT = FINIT.clone();
+		FTRANS.copyTo(TRANS);
+		FEMIS.copyTo(EMIS);
+		FINIT.copyTo(INIT);
+	}
+	/* Emissions over a product alphabet, k = r*L+l with L = productSymbols: replaces every row by the product of its
+	   marginals, b_{i}(k) = P_{i}(r)*P_{i}(l), so each state has R+L free parameters instead of R*L and pairs never
+	   seen together still get the probability of their parts. Applied to the re-estimated B this is the re-estimation
+	   of the factored model, since the marginals of the expected counts are the expected counts of each hand.
+	   Returns false, leaving EMIS untouched, when the alphabet is not R*L */
+	static bool factorEmission(cv::Mat &EMIS, const int &productSymbols)
+	{
+		if (!isProductAlphabet(EMIS.cols,productSymbols))
+			return false;
+		int L = productSymbols, R = EMIS.cols/L;
+		std::vector<double> right(R), left(L);
+		for (int i=0;i<EMIS.rows;i++)
+		{
+			double *emis = EMIS.ptr<double>(i);
+			std::fill(right.begin(),right.end(),0.0);
+			std::fill(left.begin(),left.end(),0.0);
+			double sum = 0;
+			for (int r=0;r<R;r++)
+				for (int l=0;l<L;l++)
+				{
+					right[r] += emis[r*L+l];
+					left[l] += emis[r*L+l];
+					sum += emis[r*L+l];
+				}
+			if (sum<=0)
+				continue; // left to correctModel
+			for (int r=0;r<R;r++)
+				for (int l=0;l<L;l++)
+					emis[r*L+l] = right[r]*left[l]/sum;
+		}
+		return true;
+	}
+	/* True if M symbols can be read as pairs k = r*L+l with L = productSymbols */
+	static bool isProductAlphabet(const int &M, const int &productSymbols)
+	{
+		return productSymbols>0 && M%productSymbols==0;
+	}
+	/* In-place running average AVG = (AVG*count + X)/(count+1), without temporaries. OpenCV evaluates that
+	   expression as addWeighted(AVG, count*(1/(count+1)), X, 1/(count+1)), so the weights are scaled the same way
+	   here (results can still differ in the last bit where addWeighted uses FMA) */
+	static void blend(cv::Mat &AVG, const cv::Mat &X, const int &count)
+	{
+		double beta = 1.0/(count+1), alpha = count*beta;
+		for (int r=0;r<AVG.rows;r++)
+			for (int c=0;c<AVG.cols;c++)
+				AVG.at<double>(r,c) = AVG.at<double>(r,c)*alpha+X.at<double>(r,c)*beta;
 	}
 	static void correctModel(cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT)
 	{
 		double eps = 1e-30;
 		for (int i=0;i<EMIS.rows;i++)
 			for (int j=0;j<EMIS.cols;j++)
-				if (EMIS.at<double>(i,j)==0)
+				if (EMIS.at<double>(i,j)<eps)
 					EMIS.at<double>(i,j)=eps;
 		for (int i=0;i<TRANS.rows;i++)
 			for (int j=0;j<TRANS.cols;j++)
-				if (TRANS.at<double>(i,j)==0)
+				if (TRANS.at<double>(i,j)<eps)
 					TRANS.at<double>(i,j)=eps;
 		for (int i=0;i<INIT.cols;i++)
-			if (INIT.at<double>(0,i)==0)
+			if (INIT.at<double>(0,i)<eps)
 				INIT.at<double>(0,i)=eps;
 		double sum;
 		for (int i=0;i<TRANS.rows;i++)
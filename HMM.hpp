@@ -1,7 +1,15 @@
-#include "Kinect.hpp"
+#ifndef HMM_HPP
+#define HMM_HPP
+
+#include "kmeans.hpp"
 #include "CvHMM.h"
 #include <sstream>
 
+//Peso da distribuição uniforme misturada à emissão estacionária usada pelo pré-filtro
+#ifndef HMM_STATIONARY_SMOOTHING
+#define HMM_STATIONARY_SMOOTHING 0.01
+#endif
+
 enum HMM_Name{
     HMM_Error = -2,
     HMM_NoGesture = -1,
@@ -61,12 +69,102 @@ string HMM_ToString(HMM_Name hmm){
     return retVal;
 }
 
+/**
+ * HMM_ToFileName
+ * Função: Converte um enum do tipo HMM_Name para o prefixo usado nos arquivos .hmm e na base de dados
+ * 
+ * In: HMM_Name hmm (Enumerador do gesto)
+ * Out: string retVal (Prefixo do gesto. Ex: "advance" para ./Data/advance.hmm e ./Dataset/advanceDataTrain.txt)
+ */
+string HMM_ToFileName(HMM_Name hmm){
+    string retVal = "";
+    switch(hmm){
+        case 0:
+            retVal = "advance";
+            break;
+        case 1:
+            retVal = "return";
+            break;
+        case 2:
+            retVal = "zoomIn";
+            break;
+        case 3:
+            retVal = "zoomOut";
+            break;
+        default:
+            retVal = "undefined";
+            break;
+    }
+    return retVal;
+}
+
 
 class HMM{
 private:
     Mat TRANS, EMIS, INIT; //Model
     string modelType;
     bool alreadyModeled;
+    int productSymbols; //Símbolos da mão esquerda quando o alfabeto é o produto de dois codebooks (ProductQuantizer), 0 se não
+    vector<double> stationaryLogEmission; //log da distribuição de símbolos no regime estacionário (usado no pré-filtro)
+    Mat scoringTRANS, scoringEMIS, scoringINIT; //Cópias corrigidas (correctModel) usadas por validate, como em CvHMM::decode
+    vector<double> scoringWork; //Duas colunas do a-pass de validate
+
+    /**
+     * updateStationaryEmission
+     * Função: Calcula a distribuição estacionária dos estados (pi = pi * TRANS, por iteração de potência)
+     *         e a distribuição de símbolos emitida nesse regime: e(k) = soma_i pi(i) * EMIS(i,k), misturada com a
+     *         uniforme, (1 - HMM_STATIONARY_SMOOTHING) * e(k) + HMM_STATIONARY_SMOOTHING / M, para que um símbolo que
+     *         o modelo quase nunca emite custe no máximo log(M / HMM_STATIONARY_SMOOTHING) e não domine o score.
+     *         Chamada por modelChanged.
+     */
+    void updateStationaryEmission(){
+        int N = TRANS.rows;
+        int M = EMIS.cols;
+        vector<double> pi(N, 1.0/N), next(N);
+
+        for(int iter = 0; iter < 1000; iter++){
+            double sum = 0;
+            for(int j = 0; j < N; j++){
+                next[j] = 0;
+                for(int i = 0; i < N; i++)
+                    next[j] += pi[i] * TRANS.at<double>(i,j);
+                sum += next[j];
+            }
+            double change = 0;
+            for(int j = 0; j < N; j++){
+                next[j] /= sum;
+                change += fabs(next[j] - pi[j]);
+            }
+            pi.swap(next);
+            if(change < 1e-12)
+                break;
+        }
+
+        stationaryLogEmission.assign(M, 0);
+        double sum = 0;
+        for(int k = 0; k < M; k++){
+            for(int i = 0; i < N; i++)
+                stationaryLogEmission[k] += pi[i] * EMIS.at<double>(i,k);
+            sum += stationaryLogEmission[k];
+        }
+        for(int k = 0; k < M; k++)
+            stationaryLogEmission[k] = log((1 - HMM_STATIONARY_SMOOTHING) * stationaryLogEmission[k] / sum + HMM_STATIONARY_SMOOTHING / M);
+    }
+
+    /**
+     * modelChanged
+     * Função: Atualiza o que é derivado do modelo: as cópias corrigidas e o buffer usados por validate (a memória é
+     *         reaproveitada enquanto o tamanho não muda) e a emissão estacionária. Deve ser chamada sempre que o
+     *         modelo muda.
+     */
+    void modelChanged(){
+        TRANS.copyTo(scoringTRANS);
+        EMIS.copyTo(scoringEMIS);
+        INIT.copyTo(scoringINIT);
+        CvHMM::correctModel(scoringTRANS, scoringEMIS, scoringINIT);
+        scoringWork.resize(2 * TRANS.rows);
+        updateStationaryEmission();
+    }
 
     /**
      * CreateRandomHMM
@@ -74,9 +172,10 @@ private:
      * 
      * In: int codebookSize (O tamanho do codebook)
      * In: int stateNumber (O numero de estados)
+     * In: unsigned int seed (Semente do gerador; o mesmo seed gera o mesmo modelo)
      */
-    void CreateRandomHMM(int codebookSize, int stateNumber){
-        srand(time(NULL));
+    void CreateRandomHMM(int codebookSize, int stateNumber, unsigned int seed){
+        mt19937 rng(seed);
 
         int dimension = stateNumber * stateNumber;
         double *TRANSdata = new double[dimension];
@@ -87,13 +186,13 @@ private:
 
         double randomValue;
         for(int i = 0; i < dimension; i++){
-            randomValue = ((double) rand() / (RAND_MAX));
+            randomValue = ((double) rng() / (mt19937::max()));
             TRANSdata[i] = randomValue;
         }
 
         int a;
         for(int i = 0; i < (stateNumber * codebookSize); i++){
-            a = rand()%2;
+            a = rng()%2;
             if(a == 0)
                 EMISdata[i] = 0.0;
             else
@@ -108,7 +207,7 @@ private:
             }
             else{
                 do{
-                    randomValue = ((double) rand() / (RAND_MAX));
+                    randomValue = ((double) rng() / (mt19937::max()));
                 }while(randomValue > max);
                 max -= randomValue;
                 INITdata[i] = randomValue;
@@ -118,6 +217,7 @@ private:
         TRANS = cv::Mat(stateNumber, stateNumber, CV_64F, TRANSdata).clone();
         EMIS = cv::Mat(stateNumber, codebookSize, CV_64F, EMISdata).clone();
         INIT = cv::Mat(1, stateNumber, CV_64F, INITdata).clone();
+        modelChanged();
     }
 
 public:
@@ -128,17 +228,35 @@ public:
      * 
      * In: string type (O tipo do modelo HMM)
      * In: int codebookSize (O tamanho do codebook)
+     * In: int stateNumber (O numero de estados)
+     * In: bool loadFromFile (Se falso, ignora o arquivo .hmm existente e sempre cria um modelo aleatório)
      * 
      * Out: HMM *hmm (Um objeto HMM criado)
      */
-    HMM(string type, int codebookSize, int stateNumber) : alreadyModeled(false){
+    HMM(string type, int codebookSize, int stateNumber, bool loadFromFile = true) : alreadyModeled(false), productSymbols(0){
         modelType = type;
-        if(!load())
-            CreateRandomHMM(codebookSize, stateNumber);
+        if(!loadFromFile || !load())
+            CreateRandomHMM(codebookSize, stateNumber, time(NULL));
         else
             alreadyModeled = true;
     }
 
+    /**
+     * HMM
+     * Função: Cria um modelo aleatório reprodutível, sem ler o arquivo .hmm (treinos em paralelo, sweeps)
+     * 
+     * In: string type (O tipo do modelo HMM)
+     * In: int codebookSize (O tamanho do codebook)
+     * In: int stateNumber (O numero de estados)
+     * In: unsigned int seed (Semente do modelo aleatório)
+     * 
+     * Out: HMM *hmm (Um objeto HMM criado)
+     */
+    HMM(string type, int codebookSize, int stateNumber, unsigned int seed) : alreadyModeled(false), productSymbols(0){
+        modelType = type;
+        CreateRandomHMM(codebookSize, stateNumber, seed);
+    }
+
     /**
      * getTransitionMatrix | getEmissionMatrix | getInitialMatrix
      * Função: Retorna a matriz de TRANSITION, EMISSION e INITIAL
@@ -150,12 +268,50 @@ public:
     void getEmissionMatrix(Mat& data){data = EMIS;}
     void getInitialMatrix(Mat& data){data = INIT;}
 
+    int getStateNumber(){return TRANS.rows;}
+    int getCodebookSize(){return EMIS.cols;}
+
+    /**
+     * setModelType
+     * Função: Altera o nome do arquivo usado por load e save (relativo a ./Data/)
+     * 
+     * In: string type (Novo nome do modelo. Ex: "HMM Configuration | Codebook 16/advance_9.hmm")
+     */
+    void setModelType(string type){modelType = type;}
+
+    /**
+     * setProductAlphabet
+     * Função: Indica que os símbolos são pares de um ProductQuantizer (símbolo = direita * leftSymbols + esquerda):
+     *         a emissão de cada estado passa a ser o produto das distribuições de cada mão, já no modelo atual e
+     *         em todos os treinamentos seguintes (CvHMM::factorEmission). A avaliação não muda.
+     *
+     * In: int leftSymbols (Tamanho do codebook da mão esquerda; 0 volta ao alfabeto comum)
+     *
+     * Out: bool sucesso (Falso, sem alterar o modelo, se o codebook não é da forma direita * leftSymbols)
+     */
+    bool setProductAlphabet(int leftSymbols){
+        if(leftSymbols <= 0){
+            productSymbols = 0;
+            return true;
+        }
+        if(!CvHMM::factorEmission(EMIS, leftSymbols))
+            return false;
+        productSymbols = leftSymbols;
+        CvHMM::correctModel(TRANS, EMIS, INIT);
+        modelChanged();
+        return true;
+    }
+
+    int getProductSymbols(){return productSymbols;}
+
 
     /**
      * load
      * Função: Carrega o arquivo .hmm para um novo objeto
      * 
      * Out: bool sucesso (Retorna verdadeiro se foi possível carregar o arquivo, e falso se o arquivo não existe ou foi corrompido)
+     *
+     * Obs: Uma linha final "product\tL" opcional restaura o alfabeto produto (setProductAlphabet)
      */
     bool load(){
         string filename = "./Data/" + modelType;
@@ -192,6 +348,16 @@ public:
             }
         }
 
+        productSymbols = 0;
+        string tag;
+        if(file >> tag && tag == "product"){
+            int leftSymbols;
+            if(!(file >> leftSymbols) || !CvHMM::isProductAlphabet(EMIS.cols, leftSymbols))
+                return false;
+            productSymbols = leftSymbols;
+        }
+
+        modelChanged();
         return true;
     }
 
@@ -237,6 +403,9 @@ public:
                 file << INIT.at<double>(r,c) << "\t";
         file << endl;
 
+        if(productSymbols > 0)
+            file << "product\t" << productSymbols << endl;
+
         return true;
     }
 
@@ -248,8 +417,10 @@ public:
      * In: int max_iter (Número de iterações para o treinamento)
      */
     void train(Mat &seq, int max_iter){
-        CvHMM cvhmm;
-        cvhmm.train(seq, max_iter, TRANS, EMIS, INIT);
+        CvHMMWorkspace workspace(TRANS.rows, EMIS.cols, seq.cols);
+        workspace.productSymbols = productSymbols;
+        CvHMM::train(seq, max_iter, TRANS, EMIS, INIT, workspace);
+        modelChanged();
 
         //cout << "TRANS: " << endl;
         //printMat(TRANS); cout << endl << endl;
@@ -259,6 +430,36 @@ public:
         //printMat(INIT); cout << endl << endl;
     }
 
+    /**
+     * train
+     * Função: Treina o modelo com sequências de tamanhos diferentes
+     *
+     * In: vector<Mat> &seqs (Uma matriz 1 x T por sequência)
+     * In: int max_iter (Número máximo de passadas pelas sequências)
+     */
+    void train(vector<Mat> &seqs, int max_iter){
+        if(seqs.empty())
+            return;
+        CvHMMWorkspace workspace;
+        workspace.productSymbols = productSymbols;
+        CvHMM::train(seqs, max_iter, TRANS, EMIS, INIT, workspace);
+        modelChanged();
+    }
+
+    /**
+     * train
+     * Função: Treina o modelo com sequências geradas sob demanda (por exemplo, as variantes LOOT de CvHMMLootSource)
+     *
+     * In: CvHMMSequenceSource &source (Fonte das sequências de treino)
+     * In: int max_iter (Número máximo de passadas pelas sequências)
+     */
+    void train(CvHMMSequenceSource &source, int max_iter){
+        CvHMMWorkspace workspace;
+        workspace.productSymbols = productSymbols;
+        CvHMM::train(source, max_iter, TRANS, EMIS, INIT, workspace);
+        modelChanged();
+    }
+
     /**
      * validate
      * Função: Executa o modelo HMM usando uma sequência de observações
@@ -266,16 +467,36 @@ public:
      * In: Mat &seq (A matriz de observações)
      * 
      * Out: double logpseq (A probabilidade em log que esse HMM gera a sequência passada)
+     *
+     * Obs: Mesmo resultado de CvHMM::decode com CVHMM_LIKELIHOOD, mas sem alocar: usa as cópias corrigidas mantidas
+     *      por modelChanged. Não pode ser chamada por duas threads ao mesmo tempo para o mesmo modelo.
      */
     double validate(const Mat &seq){
-        CvHMM cvhmm;
-        cv::Mat STATES,FORWARD,BACKWARD;
-        double logpseq;
-        cvhmm.decode(seq, TRANS, EMIS, INIT, logpseq, STATES, FORWARD, BACKWARD);
+        return hmmForwardLikelihood(hmmModelSpan(scoringTRANS, scoringEMIS, scoringINIT), seq, seq.cols, &scoringWork[0]);
+    }
 
-        return logpseq;
+    /**
+     * decode
+     * Função: Executa o modelo HMM calculando apenas as saídas pedidas (para diagnóstico)
+     * 
+     * In: Mat &seq (A matriz de observações)
+     * In: int flags (Combinação de CVHMM_FORWARD, CVHMM_POSTERIORS e CVHMM_PAIRWISE)
+     * In: CvHMMDecoding &decoding (Resultado; as posteriores só são calculadas quando acessadas)
+     * 
+     * Out: CvHMMDecoding &decoding
+     */
+    void decode(const Mat &seq, int flags, CvHMMDecoding &decoding){
+        CvHMM::decode(seq, TRANS, EMIS, INIT, flags, decoding);
     }
 
+    /**
+     * getStationaryLogEmission
+     * Função: Retorna log e(k), a probabilidade de cada símbolo no regime estacionário do modelo
+     * 
+     * Out: vector<double> &logEmission (Um valor por símbolo do codebook)
+     */
+    const vector<double>& getStationaryLogEmission(){return stationaryLogEmission;}
+
     void print(){
         CvHMM cvhmm;
         cvhmm.printModel(TRANS,EMIS,INIT);
@@ -285,6 +506,48 @@ public:
         return alreadyModeled;
     }
 
+    /**
+     * createSampler
+     * Função: Cria um amostrador de sequências para este modelo (as tabelas acumuladas são calculadas uma vez)
+     * 
+     * Out: CvHMMSampler sampler
+     */
+    CvHMMSampler createSampler(){
+        return CvHMMSampler(TRANS, EMIS, INIT);
+    }
+
 
     
-};
\ No newline at end of file
+};
+
+
+/**
+ * loadGestureModels
+ * Função: Carrega os modelos treinados de todos os gestos. Com codebook 16 e 9 estados usa ./Data/<gesto>.hmm,
+ *         senão ./Data/HMM Configuration | Codebook N/<gesto>_<estados>.hmm (o formato que o sweep salva em
+ *         ./Data/sweep/)
+ * 
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados)
+ * In: vector<HMM*> &models (Modelos carregados, na ordem do enum HMM_Name)
+ * 
+ * Out: bool sucesso (Falso se algum arquivo .hmm não existe)
+ */
+bool loadGestureModels(int codebookSize, int stateNumber, vector<HMM*> &models){
+    for(int g = HMM_Advance; g <= HMM_ZoomOut; g++){
+        stringstream name;
+        if(codebookSize == 16 && stateNumber == 9)
+            name << HMM_ToFileName(intToHMM(g)) << ".hmm";
+        else
+            name << "HMM Configuration | Codebook " << codebookSize << "/" << HMM_ToFileName(intToHMM(g)) << "_" << stateNumber << ".hmm";
+        HMM *model = new HMM(name.str(), codebookSize, stateNumber);
+        if(!model->isAlreadyModeled()){
+            cerr << "Error loading ./Data/" << name.str() << endl;
+            return false;
+        }
+        models.push_back(model);
+    }
+    return true;
+}
+
+#endif //HMM_HPP
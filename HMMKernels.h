@@ -0,0 +1,287 @@
+/*
+ *      Hidden Markov Model kernels on raw buffers (no OpenCV dependency).
+ *
+ * Every function works on contiguous rows with explicit strides, so the same code runs on cv::Mat data
+ * (see the adapters in CvHMM.h), on std::vector buffers or on memory mapped datasets. CvHMM is built on
+ * these kernels, so both produce the same results.
+ */
+
+#ifndef HMMKERNELS_H
+#define HMMKERNELS_H
+
+#include <cmath>
+#include <cfloat>
+#include <cstddef>
+
+/* Read-only view of a model: TRANS(i,j) = TRANS[i*transStride+j], EMIS(i,k) = EMIS[i*emisStride+k], INIT(i) = INIT[i] */
+struct HMMModelSpan {
+	int N,M;
+	const double *TRANS; int transStride;
+	const double *EMIS; int emisStride;
+	const double *INIT;
+};
+
+/* N x T lattice: element (i,t) = data[i*stateStride+t*timeStride]. A cv::Mat N x T has stateStride = step1(), timeStride = 1 */
+struct HMMLatticeSpan {
+	double *data;
+	int stateStride,timeStride;
+	double &at(const int &i,const int &t) const { return data[(ptrdiff_t)i*stateStride+(ptrdiff_t)t*timeStride]; }
+	double *column(const int &t) const { return data+(ptrdiff_t)t*timeStride; }
+};
+
+class HMMKernels {
+public:
+	/* First column of the scaled a-pass: a_{0}(i) = INIT(i)*b_{i}(o_{0}), scaled to sum 1. alpha has stride
+	   'stride' between states. Returns the scale factor c_{0} */
+	static double forwardInit(const HMMModelSpan &m, const int &symbol, double *alpha, const int &stride = 1)
+	{
+		return forwardInitWith(m,SymbolEmission(m,symbol),alpha,stride);
+	}
+	/* One step of the scaled a-pass, a_{t}(i) = sum_j a_{t-1}(j) * TRANS(j,i) * b_{i}(o_{t}). The j loop is
+	   outermost so the i loop runs over contiguous rows of TRANS, while each a_{t}(i) still accumulates in
+	   ascending j. Returns c_{t} */
+	static double forwardStep(const HMMModelSpan &m, const int &symbol, const double *prev, double *cur, const int &stride = 1)
+	{
+		return forwardStepWith(m,SymbolEmission(m,symbol),prev,cur,stride);
+	}
+	/* forwardInit and forwardStep with the emission of each state for the current symbol given in emission[i]
+	   instead of read from m.EMIS (tied or precomputed emissions). Same arithmetic, so the same results when
+	   emission[i] = EMIS(i,symbol) */
+	static double forwardInitEmission(const HMMModelSpan &m, const double *emission, double *alpha)
+	{
+		return forwardInitWith(m,ArrayEmission(emission),alpha,1);
+	}
+	static double forwardStepEmission(const HMMModelSpan &m, const double *emission, const double *prev, double *cur)
+	{
+		return forwardStepWith(m,ArrayEmission(emission),prev,cur,1);
+	}
+	/* Scaled a-pass over a whole sequence. Fills alpha and c[0..T-1] and returns log[P(O|y)] */
+	template<typename Symbol> static double forward(const HMMModelSpan &m, const Symbol *seq, const int &T, const HMMLatticeSpan &alpha, double *c)
+	{
+		c[0] = forwardInit(m,seq[0],alpha.column(0),alpha.stateStride);
+		for (int t=1;t<T;t++)
+			c[t] = forwardStep(m,seq[t],alpha.column(t-1),alpha.column(t),alpha.stateStride);
+		return logLikelihood(c,T);
+	}
+	/* Scaled a-pass keeping only two columns (work must hold 2*N doubles). Returns log[P(O|y)] */
+	template<typename Symbol> static double forwardLikelihood(const HMMModelSpan &m, const Symbol *seq, const int &T, double *work)
+	{
+		double *prev = work, *cur = work+m.N, *swap;
+		double logpseq = log(forwardInit(m,seq[0],prev));
+		for (int t=1;t<T;t++)
+		{
+			logpseq += log(forwardStep(m,seq[t],prev,cur));
+			swap = prev; prev = cur; cur = swap;
+		}
+		return -logpseq;
+	}
+	/* log[P(O|y)] = -sum_t log(c_{t}) */
+	static double logLikelihood(const double *c, const int &T)
+	{
+		double logpseq = 0;
+		for (int t=0;t<T;t++)
+			logpseq += log(c[t]);
+		return -logpseq;
+	}
+	/* Scaled B-pass, using the scale factors of the a-pass */
+	template<typename Symbol> static void backward(const HMMModelSpan &m, const Symbol *seq, const int &T, const double *c, const HMMLatticeSpan &beta)
+	{
+		int N = m.N;
+		// Let B_{T-1}(i) = 1 scaled by c_{T-1}
+		for (int i=0;i<N;i++)
+			beta.at(i,T-1) = c[T-1];
+		for (int t=T-2;t>-1;t--)
+		{
+			const double *next = beta.column(t+1);
+			double *cur = beta.column(t);
+			int symbol = seq[t+1];
+			for (int i=0;i<N;i++)
+			{
+				const double *trans = m.TRANS+i*m.transStride;
+				double sum = 0;
+				for (int j=0;j<N;j++)
+					sum += trans[j]*m.EMIS[j*m.emisStride+symbol]*next[j*beta.stateStride];
+				// scale B_{t}(i) with same scale factor as a_{t}(i)
+				cur[i*beta.stateStride] = sum*c[t];
+			}
+		}
+	}
+	/* Y_{t}(i,j) (xi, N*N x T, row i*N+j, optional: pass data = NULL) and Y_{t}(i) (gamma, N x T).
+	   The last column of gamma, which has no successor, is the normalized a_{T-1}(i) */
+	template<typename Symbol> static void posteriors(const HMMModelSpan &m, const Symbol *seq, const int &T, const HMMLatticeSpan &alpha, const HMMLatticeSpan &beta, const HMMLatticeSpan &gamma, const HMMLatticeSpan &xi)
+	{
+		int N = m.N;
+		double denom,y;
+		for (int t=0;t<T-1;t++)
+		{
+			int symbol = seq[t+1];
+			denom = 0;
+			for (int i=0;i<N;i++)
+			{
+				const double *trans = m.TRANS+i*m.transStride;
+				for (int j=0;j<N;j++)
+					denom += alpha.at(i,t)*trans[j]*m.EMIS[j*m.emisStride+symbol]*beta.at(j,t+1);
+			}
+			int index = 0;
+			for (int i=0;i<N;i++)
+			{
+				const double *trans = m.TRANS+i*m.transStride;
+				double sum = 0;
+				for (int j=0;j<N;j++)
+				{
+					y = (alpha.at(i,t)*trans[j]*m.EMIS[j*m.emisStride+symbol]*beta.at(j,t+1))/denom;
+					if (xi.data)
+						xi.at(index,t) = y;
+					sum += y;
+					index++;
+				}
+				gamma.at(i,t) = sum;
+			}
+		}
+		for (int i=0;i<N;i++)
+			gamma.at(i,T-1) = alpha.at(i,T-1);
+	}
+	/* Re-estimates pi, A and B from the posteriors of one sequence (Mark Stamp, section 5) */
+	template<typename Symbol> static void reestimate(const Symbol *seq, const int &T, const int &N, const int &M, const HMMLatticeSpan &gamma, const HMMLatticeSpan &xi,
+		double *TRANS, const int &transStride, double *EMIS, const int &emisStride, double *INIT)
+	{
+		// re-estimate pi
+		for (int i=0;i<N;i++)
+			INIT[i] = gamma.at(i,0);
+		int index = 0;
+		for (int i=0;i<N;i++)
+		{
+			double denom = 0;
+			for (int t=0;t<T-1;t++)
+				denom += gamma.at(i,t);
+			if (!(denom>0))
+			{
+				// state never occupied in this sequence: nothing to re-estimate from, its rows are kept
+				index += N;
+				continue;
+			}
+			// re-estimate A
+			for (int j=0;j<N;j++)
+			{
+				double numer = 0;
+				for (int t=0;t<T-1;t++)
+					numer += xi.at(index,t);
+				TRANS[i*transStride+j] = numer/denom;
+				index++;
+			}
+			// re-estimate B
+			double *emis = EMIS+i*emisStride;
+			for (int k=0;k<M;k++)
+				emis[k] = 0;
+			for (int t=0;t<T-1;t++)
+			{
+				int k = seq[t];
+				if (k>=0 && k<M) // symbols outside the alphabet are not counted, as in the original per-symbol loop
+					emis[k] += gamma.at(i,t);
+			}
+			for (int k=0;k<M;k++)
+				emis[k] = emis[k]/denom;
+		}
+	}
+	/* Doubles of scratch memory needed by viterbi */
+	static size_t viterbiWorkSize(const int &N) { return (size_t)N*N+3*N; }
+	/* Most probable state path. psi must hold N*T ints (back pointers), work viterbiWorkSize(N) doubles */
+	template<typename Symbol> static void viterbi(const HMMModelSpan &m, const Symbol *seq, const int &T, int *states, int *psi, double *work)
+	{
+		/* Viterbi Algorithm, Wikipedia */
+		int N = m.N;
+		double *logTrans = work, *logEmis = work+N*N, *prev = logEmis+N, *cur = prev+N, *swap;
+		for (int y0=0;y0<N;y0++)
+			for (int y=0;y<N;y++)
+				logTrans[y0*N+y] = log(m.TRANS[y0*m.transStride+y]);
+		for (int y=0;y<N;y++)
+			prev[y] = log(m.INIT[y]) + log(m.EMIS[y*m.emisStride+seq[0]]);
+		double maxp,p;
+		int state = 0;
+		for (int t=1;t<T;t++)
+		{
+			for (int y=0;y<N;y++)
+				logEmis[y] = log(m.EMIS[y*m.emisStride+seq[t]]);
+			for (int y=0;y<N;y++)
+			{
+				maxp = -DBL_MAX;
+				state = y;
+				for (int y0=0;y0<N;y0++)
+				{
+					p = prev[y0] + logTrans[y0*N+y] + logEmis[y];
+					if (maxp<p)
+					{
+						maxp = p;
+						state = y0;
+					}
+				}
+				cur[y] = maxp;
+				psi[t*N+y] = state;
+			}
+			swap = prev; prev = cur; cur = swap;
+		}
+		maxp = -DBL_MAX;
+		for (int y=0;y<N;y++)
+		{
+			if (maxp < prev[y])
+			{
+				maxp = prev[y];
+				state = y;
+			}
+		}
+		states[T-1] = state;
+		for (int t=T-1;t>0;t--)
+			states[t-1] = psi[t*N+states[t]];
+	}
+private:
+	/* b_{i}(o_{t}) read from the model, or from a buffer with one emission per state */
+	struct SymbolEmission {
+		const double *EMIS; int emisStride,symbol;
+		SymbolEmission(const HMMModelSpan &m,const int &symbol):EMIS(m.EMIS),emisStride(m.emisStride),symbol(symbol) {}
+		double operator()(const int &i) const { return EMIS[i*emisStride+symbol]; }
+	};
+	struct ArrayEmission {
+		const double *emission;
+		ArrayEmission(const double *emission):emission(emission) {}
+		double operator()(const int &i) const { return emission[i]; }
+	};
+	/* The forward recursion itself, shared by forwardInit/forwardStep and their Emission variants */
+	template<typename Emission> static double forwardInitWith(const HMMModelSpan &m, const Emission b, double *alpha, const int stride)
+	{
+		double c = 0;
+		for (int i=0;i<m.N;i++)
+		{
+			alpha[i*stride] = m.INIT[i]*b(i);
+			c += alpha[i*stride];
+		}
+		c = 1/c;
+		for (int i=0;i<m.N;i++)
+			alpha[i*stride] *= c;
+		return c;
+	}
+	template<typename Emission> static double forwardStepWith(const HMMModelSpan &m, const Emission b, const double *prev, double *cur, const int stride)
+	{
+		int N = m.N;
+		for (int i=0;i<N;i++)
+			cur[i*stride] = 0;
+		for (int j=0;j<N;j++)
+		{
+			const double *trans = m.TRANS+j*m.transStride;
+			const double a = prev[j*stride];
+			for (int i=0;i<N;i++)
+				cur[i*stride] += a*trans[i];
+		}
+		double c = 0;
+		for (int i=0;i<N;i++)
+		{
+			cur[i*stride] = cur[i*stride] * b(i);
+			c += cur[i*stride];
+		}
+		c = 1/c;
+		for (int i=0;i<N;i++)
+			cur[i*stride] = c*cur[i*stride];
+		return c;
+	}
+};
+
+#endif //HMMKERNELS_H
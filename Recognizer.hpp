@@ -0,0 +1,475 @@
+#ifndef RECOGNIZER_HPP
+#define RECOGNIZER_HPP
+
+//-----------------------------------------------------------------------
+//  Includes
+//-----------------------------------------------------------------------
+#include "HMM.hpp"
+#include <algorithm>
+
+//-----------------------------------------------------------------------
+//  Code
+//-----------------------------------------------------------------------
+
+struct GestureHypothesis{
+    int model;              //Índice do modelo no vetor passado para recognize
+    double logp;            //log[P(O|modelo)]
+    double normalizedLogp;  //logp dividido pelo tamanho da sequência
+};
+
+struct RecognitionResult{
+    vector<GestureHypothesis> hypotheses;   //As k melhores hipóteses, da mais provável para a menos provável
+    int length;                             //Tamanho da sequência reconhecida
+    double margin;                          //logp da melhor hipótese menos logp da segunda (DBL_MAX se houver só um modelo)
+    int modelsScored;                       //Quantos modelos passaram pelo forward completo
+    vector<int> candidates;                 //Modelos escolhidos pelo pré-filtro (vazio sem pré-filtro)
+
+    RecognitionResult() : length(0), margin(0), modelsScored(0){}
+
+    /**
+     * best
+     * Função: Retorna o índice do modelo mais provável, ou -1 se nenhum modelo foi avaliado
+     */
+    int best() const{
+        return hypotheses.empty() ? -1 : hypotheses[0].model;
+    }
+
+    /**
+     * gesture
+     * Função: Converte a melhor hipótese em HMM_Name (para vetores de modelos na ordem do enum)
+     */
+    HMM_Name gesture() const{
+        return intToHMM(best());
+    }
+
+    /**
+     * accept
+     * Função: Decide se a melhor hipótese é confiável o suficiente para disparar uma ação
+     *
+     * In: double minNormalizedLogp (Menor logp por observação aceito)
+     * In: double minMargin (Menor diferença de logp para a segunda hipótese aceita)
+     *
+     * Out: bool aceito
+     */
+    bool accept(double minNormalizedLogp, double minMargin) const{
+        if(hypotheses.empty())
+            return false;
+        return hypotheses[0].normalizedLogp >= minNormalizedLogp && margin >= minMargin;
+    }
+};
+
+
+/**
+ * HistogramPrefilter
+ * Primeiro estágio do reconhecimento para vocabulários grandes: ordena os modelos pelo histograma de símbolos
+ * da janela ponderado pela distribuição estacionária de emissão de cada modelo, em O(T) + O(símbolos distintos)
+ * por modelo, e só os melhores vão para o forward completo.
+ */
+class HistogramPrefilter{
+    private:
+        vector<int> histogram;      //Contagem de cada símbolo na janela atual
+        vector<int> symbols;        //Símbolos com contagem > 0 (para não percorrer o codebook inteiro)
+        vector<pair<double,int> > scores;
+
+    public:
+        /**
+         * shortlist
+         * Função: Seleciona os size modelos com maior score aproximado: soma_k h(k) * log e_modelo(k)
+         *
+         * In: vector<HMM*> &models (Modelos dos gestos)
+         * In: Mat &observation (Sequência de observações, 1 x T)
+         * In: int size (Tamanho da lista de candidatos)
+         * In: vector<int> &candidates (Índices dos modelos escolhidos, do melhor para o pior)
+         *
+         * Out: vector<int> &candidates
+         */
+        void shortlist(vector<HMM*> &models, const Mat &observation, int size, vector<int> &candidates){
+            candidates.clear();
+            if(models.empty())
+                return;
+            int M = models[0]->getCodebookSize();
+            if((int)histogram.size() != M)
+                histogram.assign(M, 0);
+
+            symbols.clear();
+            for(int t = 0; t < observation.cols; t++){
+                int symbol = cvhmmSymbol(observation, 0, t);
+                if(symbol < 0 || symbol >= M)
+                    continue; //Fora do codebook dos modelos: não entra no histograma
+                if(histogram[symbol]++ == 0)
+                    symbols.push_back(symbol);
+            }
+
+            scores.resize(models.size());
+            for(size_t m = 0; m < models.size(); m++){
+                const vector<double> &logEmission = models[m]->getStationaryLogEmission();
+                double score = 0;
+                for(vector<int>::iterator it = symbols.begin(); it != symbols.end(); ++it)
+                    score += histogram[*it] * logEmission[*it];
+                scores[m] = make_pair(-score, (int)m);
+            }
+
+            for(vector<int>::iterator it = symbols.begin(); it != symbols.end(); ++it)
+                histogram[*it] = 0;
+
+            if(size > (int)scores.size())
+                size = scores.size();
+            partial_sort(scores.begin(), scores.begin() + size, scores.end());
+            for(int i = 0; i < size; i++)
+                candidates.push_back(scores[i].second);
+        }
+};
+
+
+/**
+ * recognize
+ * Função: Avalia a sequência em todos os modelos e guarda as k melhores hipóteses na mesma passada
+ *
+ * In: vector<HMM*> &models (Modelos dos gestos)
+ * In: Mat &observation (Sequência de observações, 1 x T)
+ * In: int k (Número de hipóteses a retornar)
+ * In: RecognitionResult &result (Resultado)
+ * In: HistogramPrefilter *prefilter (Se não for NULL, só os shortlist melhores modelos do pré-filtro são avaliados)
+ * In: int shortlist (Tamanho da lista de candidatos do pré-filtro)
+ *
+ * Out: RecognitionResult &result
+ */
+void recognize(vector<HMM*> &models, const Mat &observation, int k, RecognitionResult &result,
+               HistogramPrefilter *prefilter = NULL, int shortlist = 0){
+    //A margem precisa da segunda hipótese mesmo quando só a melhor é pedida
+    int keep = k < 2 ? 2 : k;
+    result.hypotheses.clear();
+    result.length = observation.cols;
+
+    bool filtered = prefilter != NULL && shortlist > 0 && shortlist < (int)models.size();
+    if(filtered)
+        prefilter->shortlist(models, observation, shortlist, result.candidates);
+    else
+        result.candidates.clear();
+    int count = filtered ? result.candidates.size() : models.size();
+    result.modelsScored = count;
+
+    GestureHypothesis h;
+    for(int i = 0; i < count; i++){
+        h.model = filtered ? result.candidates[i] : i;
+        h.logp = models[h.model]->validate(observation);
+        h.normalizedLogp = result.length > 0 ? h.logp / result.length : h.logp;
+
+        //Inserção ordenada em uma lista de no máximo keep elementos
+        int pos = result.hypotheses.size();
+        while(pos > 0 && (result.hypotheses[pos-1].logp < h.logp ||
+                          (result.hypotheses[pos-1].logp == h.logp && result.hypotheses[pos-1].model > h.model)))
+            pos--;
+        if(pos >= keep)
+            continue;
+        if((int)result.hypotheses.size() == keep)
+            result.hypotheses.pop_back();
+        result.hypotheses.insert(result.hypotheses.begin() + pos, h);
+    }
+
+    result.margin = result.hypotheses.size() > 1 ? result.hypotheses[0].logp - result.hypotheses[1].logp : DBL_MAX;
+    if((int)result.hypotheses.size() > k)
+        result.hypotheses.resize(k);
+}
+
+
+/**
+ * rankHypotheses
+ * Função: Monta um RecognitionResult a partir do logp de cada modelo, com a mesma ordem e desempate de recognize
+ *
+ * In: vector<double> &logps (logp de cada modelo)
+ * In: int length (Tamanho da sequência avaliada)
+ * In: int k (Número de hipóteses a retornar)
+ * In: RecognitionResult &result (Resultado)
+ *
+ * Out: RecognitionResult &result
+ */
+void rankHypotheses(const vector<double> &logps, int length, int k, RecognitionResult &result){
+    result.hypotheses.clear();
+    result.candidates.clear();
+    result.length = length;
+    result.modelsScored = logps.size();
+    vector<pair<double,int> > order;
+    for(size_t m = 0; m < logps.size(); m++)
+        order.push_back(make_pair(-logps[m], (int)m));
+    sort(order.begin(), order.end());
+    for(size_t i = 0; i < order.size() && (int)i < k; i++){
+        GestureHypothesis h = {order[i].second, -order[i].first, length > 0 ? -order[i].first / length : -order[i].first};
+        result.hypotheses.push_back(h);
+    }
+    result.margin = order.size() > 1 ? order[1].first - order[0].first : DBL_MAX;
+}
+
+
+/**
+ * SequentialRecognizer
+ * Reconhecimento quadro a quadro: cada símbolo novo avança um passo do forward de todos os modelos (O(N²) por modelo),
+ * e o gesto é decidido assim que a razão de log-verossimilhança entre o líder e o segundo colocado passa de um limite,
+ * como no teste sequencial de Wald (SPRT), sem esperar a janela inteira.
+ */
+class SequentialRecognizer{
+    private:
+        struct ModelState{
+            Mat TRANS, EMIS, INIT;  //Cópias corrigidas (correctModel), como em CvHMM::decode
+            HMMModelSpan span;
+            vector<double> alpha, next;
+            double logp;
+        };
+        vector<ModelState> states;
+        double bound;       //log da razão de verossimilhança necessária para decidir
+        int minFrames;      //Nenhuma decisão antes desse número de frames
+        int frames;
+        int leader, runnerUp;
+        int decision;
+
+    public:
+        /**
+         * SequentialRecognizer
+         * Função: Prepara o estado incremental de cada modelo
+         *
+         * In: vector<HMM*> &models (Modelos dos gestos)
+         * In: double bound (Limite da razão de log-verossimilhança, ver sprtBound)
+         * In: int minFrames (Menor número de frames para decidir)
+         */
+        SequentialRecognizer(vector<HMM*> &models, double bound, int minFrames) : bound(bound), minFrames(minFrames){
+            states.resize(models.size());
+            for(size_t m = 0; m < models.size(); m++){
+                ModelState &s = states[m];
+                Mat TRANS, EMIS, INIT;
+                models[m]->getTransitionMatrix(TRANS);
+                models[m]->getEmissionMatrix(EMIS);
+                models[m]->getInitialMatrix(INIT);
+                s.TRANS = TRANS.clone();
+                s.EMIS = EMIS.clone();
+                s.INIT = INIT.clone();
+                CvHMM::correctModel(s.TRANS, s.EMIS, s.INIT);
+                s.span = hmmModelSpan(s.TRANS, s.EMIS, s.INIT);
+                s.alpha.resize(s.span.N);
+                s.next.resize(s.span.N);
+            }
+            reset();
+        }
+
+        /**
+         * sprtBound
+         * Função: Limite de Wald para a hipótese do líder com taxa de erro errorRate: log((1 - erro) / erro)
+         */
+        static double sprtBound(double errorRate){
+            return log((1 - errorRate) / errorRate);
+        }
+
+        /**
+         * reset
+         * Função: Começa uma nova gravação
+         */
+        void reset(){
+            frames = 0;
+            leader = runnerUp = -1;
+            decision = -1;
+            for(vector<ModelState>::iterator it = states.begin(); it != states.end(); ++it)
+                (*it).logp = 0;
+        }
+
+        /**
+         * push
+         * Função: Adiciona o símbolo do frame atual e testa a razão de verossimilhança
+         *
+         * In: int symbol (Símbolo do frame atual)
+         *
+         * Out: int decision (Índice do modelo decidido, ou -1 se ainda não há confiança suficiente)
+         */
+        int push(int symbol){
+            leader = runnerUp = -1;
+            for(size_t m = 0; m < states.size(); m++){
+                ModelState &s = states[m];
+                if(frames == 0)
+                    s.logp = -log(HMMKernels::forwardInit(s.span, symbol, &s.alpha[0]));
+                else{
+                    s.logp -= log(HMMKernels::forwardStep(s.span, symbol, &s.alpha[0], &s.next[0]));
+                    s.alpha.swap(s.next);
+                }
+                if(leader < 0 || s.logp > states[leader].logp){
+                    runnerUp = leader;
+                    leader = m;
+                }else if(runnerUp < 0 || s.logp > states[runnerUp].logp)
+                    runnerUp = m;
+            }
+            frames++;
+            if(decision < 0 && frames >= minFrames && ratio() >= bound)
+                decision = leader;
+            return decision;
+        }
+
+        int getFrames() const{ return frames; }
+        int getLeader() const{ return leader; }
+        int getDecision() const{ return decision; }
+        double logp(int model) const{ return states[model].logp; }
+
+        /**
+         * ratio
+         * Função: log da razão de verossimilhança entre o líder e o segundo colocado (DBL_MAX com um só modelo)
+         */
+        double ratio() const{
+            if(leader < 0)
+                return 0;
+            return runnerUp < 0 ? DBL_MAX : states[leader].logp - states[runnerUp].logp;
+        }
+
+        /**
+         * result
+         * Função: Converte os scores acumulados em um RecognitionResult, como recognize faria sobre os frames vistos até agora
+         *
+         * In: int k (Número de hipóteses a retornar)
+         * In: RecognitionResult &result (Resultado)
+         *
+         * Out: RecognitionResult &result
+         */
+        void result(int k, RecognitionResult &result) const{
+            vector<double> logps;
+            for(vector<ModelState>::const_iterator it = states.begin(); it != states.end(); ++it)
+                logps.push_back((*it).logp);
+            rankHypotheses(logps, frames, k, result);
+        }
+};
+
+
+
+/**
+ * SlidingWindowScorer
+ * Avalia janelas de tamanho fixo que começam a cada stride frames do fluxo, sobrepostas. Cada janela ativa guarda o
+ * vetor alpha de cada modelo, começado no seu frame inicial, e avança um passo do forward por frame. O custo por
+ * frame é (janelas ativas) x O(N²) por modelo, com janelas ativas = ceil(length / stride), distribuído igualmente
+ * entre os frames, e nenhum frame do fluxo precisa ser guardado. O resultado de cada janela é o mesmo de recognize
+ * sobre ela.
+ */
+class SlidingWindowScorer{
+    private:
+        struct ModelSpan{
+            Mat TRANS, EMIS, INIT;  //Cópias corrigidas (correctModel), como em CvHMM::decode
+            HMMModelSpan span;
+            int offset;             //Posição do alpha deste modelo no vetor da janela
+        };
+        struct Window{
+            int start, frames;
+            vector<double> alpha, next;     //Alphas de todos os modelos, concatenados
+            vector<double> logp;            //Soma de log(c) de cada modelo até agora
+        };
+        vector<ModelSpan> models;
+        vector<Window> windows;     //Anel: a janela que começa no frame f usa a posição (f / stride) % windows.size()
+        int length, stride;
+        int frame;
+        int lastStart;
+
+    public:
+        /**
+         * SlidingWindowScorer
+         * Função: Prepara os modelos e o anel de janelas
+         *
+         * In: vector<HMM*> &gestureModels (Modelos dos gestos)
+         * In: int length (Tamanho de cada janela, em frames)
+         * In: int stride (Uma janela nova começa a cada stride frames)
+         */
+        SlidingWindowScorer(vector<HMM*> &gestureModels, int length, int stride) : length(length), stride(stride){
+            int total = 0;
+            models.resize(gestureModels.size());
+            for(size_t m = 0; m < gestureModels.size(); m++){
+                ModelSpan &s = models[m];
+                Mat TRANS, EMIS, INIT;
+                gestureModels[m]->getTransitionMatrix(TRANS);
+                gestureModels[m]->getEmissionMatrix(EMIS);
+                gestureModels[m]->getInitialMatrix(INIT);
+                s.TRANS = TRANS.clone();
+                s.EMIS = EMIS.clone();
+                s.INIT = INIT.clone();
+                CvHMM::correctModel(s.TRANS, s.EMIS, s.INIT);
+                s.span = hmmModelSpan(s.TRANS, s.EMIS, s.INIT);
+                s.offset = total;
+                total += s.span.N;
+            }
+            windows.resize((length + stride - 1) / stride);
+            for(vector<Window>::iterator it = windows.begin(); it != windows.end(); ++it){
+                (*it).alpha.resize(total);
+                (*it).next.resize(total);
+                (*it).logp.resize(models.size());
+            }
+            reset();
+        }
+
+        /**
+         * reset
+         * Função: Começa um novo fluxo
+         */
+        void reset(){
+            frame = 0;
+            lastStart = -1;
+            for(vector<Window>::iterator it = windows.begin(); it != windows.end(); ++it){
+                (*it).start = -1;
+                (*it).frames = 0;
+            }
+        }
+
+        /**
+         * push
+         * Função: Adiciona o símbolo do frame atual a todas as janelas ativas
+         *
+         * In: int symbol (Símbolo do frame atual)
+         * In: int k (Número de hipóteses a retornar)
+         * In: RecognitionResult &result (Resultado da janela que terminou neste frame, se houver)
+         *
+         * Out: bool completed (Verdadeiro se uma janela terminou neste frame)
+         * Out: RecognitionResult &result
+         */
+        bool push(int symbol, int k, RecognitionResult &result){
+            if(frame % stride == 0){
+                Window &w = windows[(frame / stride) % windows.size()];
+                w.start = frame;
+                w.frames = 0;
+            }
+
+            bool completed = false;
+            for(vector<Window>::iterator it = windows.begin(); it != windows.end(); ++it){
+                Window &w = *it;
+                if(w.frames == 0 && w.start != frame)
+                    continue;
+                for(size_t m = 0; m < models.size(); m++){
+                    double *alpha = &w.alpha[models[m].offset];
+                    if(w.frames == 0)
+                        w.logp[m] = log(HMMKernels::forwardInit(models[m].span, symbol, alpha));
+                    else
+                        w.logp[m] += log(HMMKernels::forwardStep(models[m].span, symbol, alpha, &w.next[models[m].offset]));
+                }
+                if(w.frames > 0)
+                    w.alpha.swap(w.next);
+                w.frames++;
+
+                if(w.frames == length){
+                    //log[P(O|y)] = -soma log(c), na mesma ordem de HMMKernels::forwardLikelihood
+                    for(size_t m = 0; m < models.size(); m++)
+                        w.logp[m] = -w.logp[m];
+                    rankHypotheses(w.logp, length, k, result);
+                    lastStart = w.start;
+                    w.frames = 0;
+                    completed = true;
+                }
+            }
+            frame++;
+            return completed;
+        }
+
+        int getFrame() const{ return frame; }
+        int getLastStart() const{ return lastStart; }   //Primeiro frame da última janela completa
+
+        /**
+         * getActiveWindows
+         * Função: Número de janelas em andamento
+         */
+        int getActiveWindows() const{
+            int active = 0;
+            for(vector<Window>::const_iterator it = windows.begin(); it != windows.end(); ++it)
+                if((*it).frames > 0)
+                    active++;
+            return active;
+        }
+};
+
+#endif //RECOGNIZER_HPP
@@ -0,0 +1,257 @@
+#ifndef SPOTTER_HPP
+#define SPOTTER_HPP
+
+//-----------------------------------------------------------------------
+//  Includes
+//-----------------------------------------------------------------------
+#include "HMM.hpp"
+
+//-----------------------------------------------------------------------
+//  Code
+//-----------------------------------------------------------------------
+
+struct GestureEvent{
+    int model;      //Índice do modelo no vetor passado para o GestureSpotter
+    int start, end; //Primeiro e último frame do gesto no fluxo (inclusive)
+    double score;   //log[P(segmento|gesto)] - log[P(segmento|filler)] no pico
+};
+
+
+/**
+ * GestureSpotter
+ * Localiza gestos no fluxo contínuo de símbolos, sem segmentação prévia (Lee & Kim, "An HMM-Based Threshold Model
+ * Approach for Gesture Recognition", 1999).
+ *
+ * O modelo filler é ergódico e tem todos os estados de todos os gestos, com a mesma auto-transição e as demais
+ * transições uniformes. As emissões de cada estado são suavizadas em direção à emissão média de todos os estados:
+ * como os gestos da base são longas sequências do mesmo símbolo, só a auto-transição não bastaria para separar o
+ * gesto do filler. Assim o filler explica qualquer movimento, mas pior do que o modelo do gesto certo.
+ *
+ * Cada gesto roda um Viterbi que pode começar em qualquer frame a partir do melhor caminho do filler; a diferença
+ * entre o melhor caminho do gesto e o do filler é a razão de verossimilhança do segmento. Um evento é emitido no
+ * pico dessa razão, quando ela passa do limite.
+ *
+ * O custo por frame é constante: O(N²) por gesto e O(estados do filler). Os scores são normalizados pelo filler
+ * a cada frame, então não divergem em fluxos longos.
+ */
+class GestureSpotter{
+    private:
+        struct SpotModel{
+            int N;
+            vector<double> logTrans, logEmis, logInit;  //N x N, N x M, N
+            vector<double> delta, next;                 //Melhor caminho terminando em cada estado, relativo ao filler
+            vector<int> start, nextStart;               //Frame em que esse caminho saiu do filler
+        };
+        vector<SpotModel> models;
+        int M;                                          //Tamanho do codebook
+        vector<double> fillerSelf, fillerOther;         //log da auto-transição e log de cada outra transição
+        vector<double> fillerEmis;                      //NF x M, suavizadas
+        vector<double> filler, fillerNext;
+
+        double threshold;   //Menor razão de log-verossimilhança para emitir um evento
+        int minLength;      //Menor duração de um gesto, em frames
+        int hangover;       //Frames sem melhora no pico antes de emitir o evento
+        int frame;
+        bool pending;
+        GestureEvent candidate;
+
+        /**
+         * restartGestures
+         * Função: Descarta os caminhos dos gestos, para que o próximo evento comece depois do último emitido
+         */
+        void restartGestures(){
+            for(vector<SpotModel>::iterator it = models.begin(); it != models.end(); ++it)
+                fill((*it).delta.begin(), (*it).delta.end(), -DBL_MAX);
+        }
+
+    public:
+        /**
+         * GestureSpotter
+         * Função: Monta os modelos em log e o modelo filler a partir dos estados dos modelos dos gestos
+         *
+         * In: vector<HMM*> &gestureModels (Modelos dos gestos, com o mesmo codebook)
+         * In: double threshold (Menor razão de log-verossimilhança gesto/filler para emitir um evento)
+         * In: int minLength (Menor duração de um gesto, em frames)
+         * In: int hangover (Frames sem melhora no pico antes de emitir o evento)
+         * In: double smoothing (Peso da emissão média nas emissões do filler, entre 0 e 1)
+         */
+        GestureSpotter(vector<HMM*> &gestureModels, double threshold, int minLength, int hangover, double smoothing = 0.9)
+            : threshold(threshold), minLength(minLength), hangover(hangover){
+            M = gestureModels.empty() ? 0 : gestureModels[0]->getCodebookSize();
+            models.resize(gestureModels.size());
+            for(size_t g = 0; g < gestureModels.size(); g++){
+                Mat TRANS, EMIS, INIT;
+                gestureModels[g]->getTransitionMatrix(TRANS);
+                gestureModels[g]->getEmissionMatrix(EMIS);
+                gestureModels[g]->getInitialMatrix(INIT);
+                TRANS = TRANS.clone();
+                EMIS = EMIS.clone();
+                INIT = INIT.clone();
+                CvHMM::correctModel(TRANS, EMIS, INIT);
+
+                SpotModel &m = models[g];
+                m.N = TRANS.rows;
+                for(int i = 0; i < m.N; i++){
+                    m.logInit.push_back(log(INIT.at<double>(0,i)));
+                    for(int j = 0; j < m.N; j++)
+                        m.logTrans.push_back(log(TRANS.at<double>(i,j)));
+                    for(int k = 0; k < M; k++)
+                        m.logEmis.push_back(log(EMIS.at<double>(i,k)));
+                    fillerSelf.push_back(TRANS.at<double>(i,i));
+                }
+                m.delta.resize(m.N);
+                m.next.resize(m.N);
+                m.start.resize(m.N);
+                m.nextStart.resize(m.N);
+                for(int i = 0; i < m.N; i++)
+                    for(int k = 0; k < M; k++)
+                        fillerEmis.push_back(EMIS.at<double>(i,k));
+            }
+
+            int NF = fillerSelf.size();
+            vector<double> mean(M, 0);
+            for(int s = 0; s < NF; s++)
+                for(int k = 0; k < M; k++)
+                    mean[k] += fillerEmis[s*M+k] / NF;
+            for(int s = 0; s < NF; s++)
+                for(int k = 0; k < M; k++)
+                    fillerEmis[s*M+k] = log((1 - smoothing) * fillerEmis[s*M+k] + smoothing * mean[k]);
+            for(int s = 0; s < NF; s++){
+                double self = fillerSelf[s];
+                fillerOther.push_back(NF > 1 ? log((1 - self) / (NF - 1)) : -DBL_MAX);
+                fillerSelf[s] = log(self);
+            }
+            filler.resize(NF);
+            fillerNext.resize(NF);
+            reset();
+        }
+
+        /**
+         * reset
+         * Função: Começa um novo fluxo
+         */
+        void reset(){
+            frame = 0;
+            pending = false;
+            restartGestures();
+        }
+
+        /**
+         * push
+         * Função: Adiciona o símbolo do frame atual ao fluxo
+         *
+         * In: int symbol (Símbolo do frame atual)
+         * In: GestureEvent &event (Evento emitido neste frame, se houver)
+         *
+         * Out: bool emitted (Verdadeiro se um gesto terminou e foi emitido em event)
+         * Out: GestureEvent &event
+         */
+        bool push(int symbol, GestureEvent &event){
+            int NF = filler.size();
+
+            //Filler: a melhor transição vinda de outro estado é o maior dos dois melhores v(s') = filler(s') + other(s')
+            double fillerBest = -DBL_MAX;
+            if(frame == 0){
+                for(int s = 0; s < NF; s++)
+                    fillerNext[s] = -log((double)NF) + fillerEmis[s*M+symbol];
+            }else{
+                double top1 = -DBL_MAX, top2 = -DBL_MAX;
+                int top1State = -1;
+                for(int s = 0; s < NF; s++){
+                    double v = filler[s] + fillerOther[s];
+                    if(v > top1){
+                        top2 = top1;
+                        top1 = v;
+                        top1State = s;
+                    }else if(v > top2)
+                        top2 = v;
+                }
+                for(int s = 0; s < NF; s++){
+                    double stay = filler[s] + fillerSelf[s];
+                    double enter = top1State == s ? top2 : top1;
+                    fillerNext[s] = (stay > enter ? stay : enter) + fillerEmis[s*M+symbol];
+                }
+            }
+            for(int s = 0; s < NF; s++)
+                if(fillerNext[s] > fillerBest)
+                    fillerBest = fillerNext[s];
+            for(int s = 0; s < NF; s++)
+                filler[s] = fillerNext[s] - fillerBest;
+
+            //Gestos: entram a partir do melhor caminho do filler até o frame anterior, que vale 0 após a normalização
+            int best = -1;
+            double bestScore = -DBL_MAX;
+            int bestStart = 0;
+            for(size_t g = 0; g < models.size(); g++){
+                SpotModel &m = models[g];
+                double score = -DBL_MAX;
+                int scoreStart = frame;
+                for(int i = 0; i < m.N; i++){
+                    double value = m.logInit[i];
+                    int from = frame;
+                    for(int j = 0; j < m.N; j++){
+                        if(m.delta[j] == -DBL_MAX)
+                            continue;
+                        double p = m.delta[j] + m.logTrans[j*m.N+i];
+                        if(p > value){
+                            value = p;
+                            from = m.start[j];
+                        }
+                    }
+                    m.next[i] = value + m.logEmis[i*M+symbol] - fillerBest;
+                    m.nextStart[i] = from;
+                    if(m.next[i] > score){
+                        score = m.next[i];
+                        scoreStart = from;
+                    }
+                }
+                m.delta.swap(m.next);
+                m.start.swap(m.nextStart);
+
+                if(score > threshold && frame - scoreStart + 1 >= minLength && score > bestScore){
+                    best = g;
+                    bestScore = score;
+                    bestStart = scoreStart;
+                }
+            }
+
+            //Pico da razão de verossimilhança: o evento só é emitido quando ela para de crescer
+            bool emitted = false;
+            if(best >= 0 && (!pending || bestScore > candidate.score)){
+                candidate.model = best;
+                candidate.start = bestStart;
+                candidate.end = frame;
+                candidate.score = bestScore;
+                pending = true;
+            }else if(pending && (best < 0 || frame - candidate.end >= hangover)){
+                event = candidate;
+                emitted = true;
+                pending = false;
+                restartGestures();
+            }
+            frame++;
+            return emitted;
+        }
+
+        /**
+         * flush
+         * Função: Emite o evento pendente no fim do fluxo
+         *
+         * In: GestureEvent &event (Evento pendente, se houver)
+         *
+         * Out: bool emitted
+         */
+        bool flush(GestureEvent &event){
+            if(!pending)
+                return false;
+            event = candidate;
+            pending = false;
+            restartGestures();
+            return true;
+        }
+
+        int getFrame() const{ return frame; }
+        int getFillerStates() const{ return filler.size(); }
+};
+
+#endif //SPOTTER_HPP
@@ -0,0 +1,61 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+//-----------------------------------------------------------------------
+//  Includes
+//-----------------------------------------------------------------------
+#include <thread>
+#include <atomic>
+#include <vector>
+
+//-----------------------------------------------------------------------
+//  Code
+//-----------------------------------------------------------------------
+
+/**
+ * defaultThreadCount
+ * Função: Retorna o número de threads a ser usado quando o usuário não especifica
+ *
+ * Out: int threads (Número de núcleos da máquina, ou 1 se não for possível detectar)
+ */
+int defaultThreadCount(){
+    int threads = (int)std::thread::hardware_concurrency();
+    return threads > 0 ? threads : 1;
+}
+
+/**
+ * parallelFor
+ * Função: Executa job(i) para todo i em [0, n), distribuindo as tarefas entre um grupo de threads.
+ *         Cada thread busca a próxima tarefa livre, então tarefas de duração diferente se balanceiam sozinhas.
+ *
+ * In: int n (Número de tarefas)
+ * In: int threads (Número de threads, se <= 0 usa defaultThreadCount())
+ * In: Job job (Função ou lambda chamada como job(int i))
+ */
+template<typename Job>
+void parallelFor(int n, int threads, Job job){
+    if(threads <= 0)
+        threads = defaultThreadCount();
+    if(threads > n)
+        threads = n;
+
+    if(threads <= 1){
+        for(int i = 0; i < n; i++)
+            job(i);
+        return;
+    }
+
+    std::atomic<int> next(0);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++){
+        workers.push_back(std::thread([&](){
+            int i;
+            while((i = next++) < n)
+                job(i);
+        }));
+    }
+    for(std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+        (*it).join();
+}
+
+#endif //THREADPOOL_HPP
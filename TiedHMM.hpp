@@ -0,0 +1,309 @@
+#ifndef TIEDHMM_HPP
+#define TIEDHMM_HPP
+
+//-----------------------------------------------------------------------
+//  Includes
+//-----------------------------------------------------------------------
+#include "Recognizer.hpp"
+
+//-----------------------------------------------------------------------
+//  Code
+//-----------------------------------------------------------------------
+
+/**
+ * TiedModelSet
+ * Família de modelos com emissões compartilhadas (tied states): todos os gestos usam o mesmo pool de distribuições
+ * de emissão sobre o codebook e cada estado de cada gesto só guarda o índice da sua entrada no pool. Cada modelo
+ * ocupa N² + N doubles e N ints, em vez de N² + N·M + N doubles, e o pool (P x M) é guardado por símbolo, então a
+ * emissão de todas as entradas para o símbolo do frame é uma única linha contígua, lida uma vez por frame para o
+ * vocabulário inteiro.
+ *
+ * Com uma entrada do pool por estado (P = soma dos N) os scores são idênticos aos dos modelos originais.
+ */
+class TiedModelSet{
+    private:
+        struct TiedModel{
+            int N;
+            vector<double> TRANS, INIT;     //N x N e N, já corrigidas (correctModel)
+            vector<int> states;             //Entrada do pool de cada estado
+            int offset;                     //Posição do alpha deste modelo no vetor de alphas
+        };
+        vector<TiedModel> models;
+        int M;                              //Tamanho do codebook
+        int P;                              //Número de entradas do pool
+        vector<double> bySymbol;            //M x P: bySymbol[k*P+p] = P(símbolo k | entrada p)
+        vector<double> alpha, next;         //Alphas de todos os modelos, concatenados
+        vector<double> emission;            //Emissão de cada estado do modelo atual para o símbolo do frame
+        vector<double> logps;
+        int maxStates;
+
+        /**
+         * tieStates
+         * Função: Agrupa as linhas de emissão em size entradas (k-means euclidiano, começando pelas linhas mais
+         *         distantes entre si) e devolve a entrada de cada linha
+         *
+         * In: vector<double> &rows (S x M, uma distribuição por linha)
+         * In: int size (Número de entradas)
+         * In: vector<double> &entries (Médias das linhas de cada entrada, size x M)
+         * In: vector<int> &assignment (Entrada de cada linha)
+         *
+         * Out: vector<double> &entries
+         * Out: vector<int> &assignment
+         */
+        void tieStates(const vector<double> &rows, int size, vector<double> &entries, vector<int> &assignment){
+            int S = rows.size() / M;
+            assignment.assign(S, 0);
+            entries.assign(rows.begin(), rows.begin() + M);
+            vector<double> nearest(S, DBL_MAX);
+            for(int p = 1; p < size; p++){
+                int farthest = 0;
+                for(int s = 0; s < S; s++){
+                    nearest[s] = min(nearest[s], squaredDistance(&rows[s*M], &entries[(p-1)*M]));
+                    if(nearest[s] > nearest[farthest])
+                        farthest = s;
+                }
+                entries.insert(entries.end(), rows.begin() + farthest*M, rows.begin() + (farthest+1)*M);
+            }
+
+            bool changed = true;
+            for(int iter = 0; iter < 100 && changed; iter++){
+                changed = false;
+                for(int s = 0; s < S; s++){
+                    int best = 0;
+                    double bestDistance = DBL_MAX;
+                    for(int p = 0; p < size; p++){
+                        double d = squaredDistance(&rows[s*M], &entries[p*M]);
+                        if(d < bestDistance){
+                            bestDistance = d;
+                            best = p;
+                        }
+                    }
+                    if(best != assignment[s]){
+                        assignment[s] = best;
+                        changed = true;
+                    }
+                }
+                //Entradas sem linhas mantêm a média anterior
+                vector<int> count(size, 0);
+                vector<double> sum(size*M, 0);
+                for(int s = 0; s < S; s++){
+                    count[assignment[s]]++;
+                    for(int k = 0; k < M; k++)
+                        sum[assignment[s]*M+k] += rows[s*M+k];
+                }
+                for(int p = 0; p < size; p++)
+                    if(count[p] > 0)
+                        for(int k = 0; k < M; k++)
+                            entries[p*M+k] = sum[p*M+k] / count[p];
+            }
+        }
+
+        double squaredDistance(const double *a, const double *b) const{
+            double d = 0;
+            for(int k = 0; k < M; k++)
+                d += (a[k] - b[k]) * (a[k] - b[k]);
+            return d;
+        }
+
+    public:
+        /**
+         * TiedModelSet
+         * Função: Cria um conjunto vazio; o pool e os modelos são adicionados com addPoolEntry e addModel
+         *
+         * In: int codebookSize (Tamanho do codebook)
+         */
+        TiedModelSet(int codebookSize) : M(codebookSize), P(0), maxStates(0){}
+
+        /**
+         * TiedModelSet
+         * Função: Compartilha as emissões dos modelos treinados: as linhas de EMIS de todos os estados são agrupadas
+         *         em poolSize entradas e cada estado passa a usar a média do seu grupo
+         *
+         * In: vector<HMM*> &gestureModels (Modelos dos gestos, com o mesmo codebook)
+         * In: int poolSize (Número de entradas do pool; 0 ou maior que o total de estados usa uma entrada por estado)
+         */
+        TiedModelSet(vector<HMM*> &gestureModels, int poolSize) : P(0), maxStates(0){
+            M = gestureModels.empty() ? 0 : gestureModels[0]->getCodebookSize();
+            vector<double> rows;
+            vector<Mat> transitions, initials;
+            for(size_t g = 0; g < gestureModels.size(); g++){
+                Mat TRANS, EMIS, INIT;
+                gestureModels[g]->getTransitionMatrix(TRANS);
+                gestureModels[g]->getEmissionMatrix(EMIS);
+                gestureModels[g]->getInitialMatrix(INIT);
+                TRANS = TRANS.clone();
+                EMIS = EMIS.clone();
+                INIT = INIT.clone();
+                CvHMM::correctModel(TRANS, EMIS, INIT);
+                transitions.push_back(TRANS);
+                initials.push_back(INIT);
+                for(int i = 0; i < EMIS.rows; i++)
+                    for(int k = 0; k < M; k++)
+                        rows.push_back(EMIS.at<double>(i,k));
+            }
+
+            int S = M > 0 ? rows.size() / M : 0;
+            if(poolSize <= 0 || poolSize > S)
+                poolSize = S;
+            vector<double> entries;
+            vector<int> assignment;
+            if(poolSize == S){
+                entries = rows;
+                for(int s = 0; s < S; s++)
+                    assignment.push_back(s);
+            }else if(S > 0)
+                tieStates(rows, poolSize, entries, assignment);
+
+            for(int p = 0; p < poolSize; p++)
+                addPoolEntry(&entries[p*M]);
+            int first = 0;
+            for(size_t g = 0; g < gestureModels.size(); g++){
+                int N = transitions[g].rows;
+                addModel(transitions[g], initials[g], vector<int>(assignment.begin() + first, assignment.begin() + first + N));
+                first += N;
+            }
+        }
+
+        /**
+         * addPoolEntry
+         * Função: Adiciona uma distribuição de emissão ao pool
+         *
+         * In: double *distribution (M probabilidades, sem zeros)
+         *
+         * Out: int entry (Índice da entrada no pool)
+         */
+        int addPoolEntry(const double *distribution){
+            vector<double> layout(M * (P + 1));
+            for(int k = 0; k < M; k++){
+                for(int p = 0; p < P; p++)
+                    layout[k*(P+1)+p] = bySymbol[k*P+p];
+                layout[k*(P+1)+P] = distribution[k];
+            }
+            bySymbol.swap(layout);
+            return P++;
+        }
+
+        /**
+         * addModel
+         * Função: Adiciona um gesto que usa as entradas do pool nas emissões
+         *
+         * In: Mat &TRANS (Matriz de transição N x N, sem zeros)
+         * In: Mat &INIT (Vetor inicial 1 x N, sem zeros)
+         * In: vector<int> &states (Entrada do pool de cada um dos N estados)
+         *
+         * Out: int model (Índice do modelo no conjunto)
+         */
+        int addModel(const Mat &TRANS, const Mat &INIT, const vector<int> &states){
+            TiedModel m;
+            m.N = TRANS.rows;
+            for(int i = 0; i < m.N; i++){
+                m.INIT.push_back(INIT.at<double>(0,i));
+                for(int j = 0; j < m.N; j++)
+                    m.TRANS.push_back(TRANS.at<double>(i,j));
+            }
+            m.states = states;
+            m.offset = alpha.size();
+            models.push_back(m);
+            alpha.resize(alpha.size() + m.N);
+            next.resize(alpha.size());
+            logps.resize(models.size());
+            maxStates = max(maxStates, m.N);
+            emission.resize(maxStates);
+            return models.size() - 1;
+        }
+
+        /**
+         * score
+         * Função: Avalia a sequência em todos os modelos, um frame por vez para o vocabulário inteiro
+         *
+         * In: Mat &observation (Sequência de observações, 1 x T)
+         *
+         * Out: vector<double> &logps (log[P(O|modelo)] de cada modelo, válido até a próxima chamada)
+         */
+        const vector<double>& score(const Mat &observation){
+            switch(observation.depth()){
+                case CV_8U:
+                    return score(observation.ptr<unsigned char>(0), observation.cols);
+                case CV_16U:
+                    return score(observation.ptr<unsigned short>(0), observation.cols);
+                default:
+                    return score(observation.ptr<int>(0), observation.cols);
+            }
+        }
+
+        /**
+         * score
+         * Função: Como acima, sobre T símbolos de qualquer tipo inteiro (cvhmmSymbolDepth)
+         */
+        template<typename Symbol> const vector<double>& score(const Symbol *seq, int T){
+            fill(logps.begin(), logps.end(), 0.0);
+            for(int t = 0; t < T; t++){
+                const double *column = &bySymbol[seq[t]*P];
+                for(size_t m = 0; m < models.size(); m++){
+                    TiedModel &tm = models[m];
+                    HMMModelSpan span = {tm.N, M, &tm.TRANS[0], tm.N, NULL, 0, &tm.INIT[0]};
+                    for(int i = 0; i < tm.N; i++)
+                        emission[i] = column[tm.states[i]];
+                    if(t == 0)
+                        logps[m] += log(HMMKernels::forwardInitEmission(span, &emission[0], &alpha[tm.offset]));
+                    else
+                        logps[m] += log(HMMKernels::forwardStepEmission(span, &emission[0], &alpha[tm.offset], &next[tm.offset]));
+                }
+                if(t > 0)
+                    alpha.swap(next);
+            }
+            //log[P(O|y)] = -soma log(c), na mesma ordem de HMMKernels::forwardLikelihood
+            for(size_t m = 0; m < logps.size(); m++)
+                logps[m] = -logps[m];
+            return logps;
+        }
+
+        /**
+         * getPoolEntry
+         * Função: Copia a distribuição de uma entrada do pool
+         *
+         * In: int entry (Índice da entrada)
+         * In: double *distribution (M probabilidades)
+         *
+         * Out: double *distribution
+         */
+        void getPoolEntry(int entry, double *distribution) const{
+            for(int k = 0; k < M; k++)
+                distribution[k] = bySymbol[k*P+entry];
+        }
+
+        /**
+         * getParameterBytes
+         * Função: Memória ocupada pelos parâmetros (pool, transições, vetores iniciais e índices dos estados)
+         */
+        size_t getParameterBytes() const{
+            size_t bytes = bySymbol.size() * sizeof(double);
+            for(vector<TiedModel>::const_iterator it = models.begin(); it != models.end(); ++it)
+                bytes += ((*it).TRANS.size() + (*it).INIT.size()) * sizeof(double) + (*it).states.size() * sizeof(int);
+            return bytes;
+        }
+
+        int size() const{ return models.size(); }
+        int getPoolSize() const{ return P; }
+        int getCodebookSize() const{ return M; }
+        const vector<int>& getStates(int model) const{ return models[model].states; }
+};
+
+
+/**
+ * recognize
+ * Função: Avalia a sequência em todos os modelos de um TiedModelSet e guarda as k melhores hipóteses,
+ *         com a mesma ordem e desempate do recognize sobre vector<HMM*>
+ *
+ * In: TiedModelSet &models (Modelos dos gestos)
+ * In: Mat &observation (Sequência de observações, 1 x T)
+ * In: int k (Número de hipóteses a retornar)
+ * In: RecognitionResult &result (Resultado)
+ *
+ * Out: RecognitionResult &result
+ */
+void recognize(TiedModelSet &models, const Mat &observation, int k, RecognitionResult &result){
+    rankHypotheses(models.score(observation), observation.cols, k, result);
+}
+
+#endif //TIEDHMM_HPP
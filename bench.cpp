@@ -0,0 +1,1883 @@
+/**
+ * C++ Bench - Medidas de desempenho do treinamento e reconhecimento
+ *
+ * Copyright (c) 2017 Murilo K. Rivabem
+ * All rights reserved.
+ *
+ * Uso: ./bench <modo> [opções]
+ *      ./bench train [codebook] [states] [repeat]
+ *      ./bench legacy [codebook] [states] [repeat]
+ *      ./bench streaming [codebook] [states] [repeat]
+ *      ./bench prefilter [codebook] [states]
+ *      ./bench kernels [codebook] [states] [repeat]
+ *      ./bench sequential [codebook] [states] [minFrames]
+ *      ./bench spot [codebook] [states] [seed]
+ *      ./bench sliding [codebook] [states] [length]
+ *      ./bench vocabulary [codebook] [states] [poolSize]
+ *      ./bench kmeans [clusters] [frames] [threads]
+ *      ./bench minibatch [clusters] [batchSize] [batches]
+ *      ./bench nearest [repeat]
+ *      ./bench quantize [frames] [threads]
+ *      ./bench tree [frames] [repeat]
+ *      ./bench kdtree [frames] [repeat]
+ *      ./bench coherent [repeat]
+ *      ./bench lookup [cells] [repeat]
+ *      ./bench product [states] [iterations]
+ *      ./bench live [gestures]
+ *      ./bench symbols [codebook] [states] [repeat]
+ *
+*/
+
+//-----------------------------------------------------------------------
+//  Includes
+//-----------------------------------------------------------------------
+#include "Recognizer.hpp"
+#include "Spotter.hpp"
+#include "TiedHMM.hpp"
+#include <chrono>
+#include <atomic>
+
+//-----------------------------------------------------------------------
+//  Defines
+//-----------------------------------------------------------------------
+#define GESTURE_COUNT 4
+#define GESTURE_SIZE 40
+#define MAX_ITER 5000
+#define LIVE_N_BEST 3 //N_BEST de main.cpp
+
+
+//-----------------------------------------------------------------------
+//  Allocation counter
+//-----------------------------------------------------------------------
+// Conta as alocações e liberações de heap do processo inteiro (inclusive as do OpenCV, que usa
+// posix_memalign/malloc e não o operator new). Específico da glibc.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static std::atomic<long> g_allocations(0);
+static std::atomic<long> g_frees(0);
+
+extern "C" void* malloc(size_t size){
+    g_allocations++;
+    return __libc_malloc(size);
+}
+extern "C" void* calloc(size_t n, size_t size){
+    g_allocations++;
+    return __libc_calloc(n, size);
+}
+extern "C" void* realloc(void* ptr, size_t size){
+    g_allocations++;
+    return __libc_realloc(ptr, size);
+}
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size){
+    g_allocations++;
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr == NULL ? 12 /*ENOMEM*/ : 0;
+}
+extern "C" void free(void* ptr){
+    if(ptr != NULL)
+        g_frees++;
+    __libc_free(ptr);
+}
+
+
+//-----------------------------------------------------------------------
+//  Code
+//-----------------------------------------------------------------------
+
+typedef chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start){
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * loadBenchCodebook
+ * Função: Carrega ./Dataset/codebook<N>.txt (ou ./Dataset/codebook.txt para N = 64)
+ *
+ * In: int codebookSize (Número de clusters)
+ *
+ * Out: KMeans *codebook (NULL se o arquivo não existe)
+ */
+KMeans* loadBenchCodebook(int codebookSize){
+    stringstream ss;
+    ss << "./Dataset/codebook";
+    if(codebookSize != 64)
+        ss << codebookSize;
+    ss << ".txt";
+    fstream file(ss.str().c_str(), ios::in);
+    if(!file.is_open()){
+        cerr << "Error loading " << ss.str() << endl;
+        return NULL;
+    }
+    KMeans *codebook = new KMeans(file);
+    file.close();
+    return codebook;
+}
+
+
+/**
+ * benchTrain
+ * Função: Mede o tempo e o número de alocações de CvHMM::train nas bases de dados (LOOT) de cada gesto.
+ *         O mesmo CvHMMWorkspace é reutilizado em todos os treinamentos, como em um processo de treino longo.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int repeat (Quantas vezes cada modelo é treinado a partir do mesmo modelo inicial)
+ */
+int benchTrain(int codebookSize, int stateNumber, int repeat){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    if(codebook == NULL)
+        return -1;
+
+    double totalSeconds = 0;
+    long totalAllocations = 0;
+    CvHMMWorkspace workspace;
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        Mat seq, subSeq;
+        string filename = "./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt";
+        codebook->getGestureObservationsFromTrainingData(filename, GESTURE_SIZE, seq, subSeq);
+
+        HMM initial(HMM_ToFileName(intToHMM(g)) + ".hmm", codebook->getClusterNumber(), stateNumber, false);
+        Mat TRANS0, EMIS0, INIT0;
+        initial.getTransitionMatrix(TRANS0);
+        initial.getEmissionMatrix(EMIS0);
+        initial.getInitialMatrix(INIT0);
+
+        double seconds = 0;
+        long allocations = 0;
+        for(int r = 0; r < repeat; r++){
+            Mat TRANS = TRANS0.clone(), EMIS = EMIS0.clone(), INIT = INIT0.clone();
+
+            long allocations0 = g_allocations;
+            Clock::time_point start = Clock::now();
+            CvHMM::train(subSeq, MAX_ITER, TRANS, EMIS, INIT, workspace);
+            seconds += secondsSince(start);
+            allocations += g_allocations - allocations0;
+        }
+
+        cout << HMM_ToString(intToHMM(g)) << ": " << subSeq.rows << "x" << subSeq.cols << " LOOT, "
+             << seconds*1000/repeat << " ms/train, " << (double)allocations/repeat << " allocations/train" << endl;
+        totalSeconds += seconds;
+        totalAllocations += allocations;
+    }
+    cout << "Total: " << totalSeconds*1000/repeat << " ms, " << (double)totalAllocations/repeat << " allocations per training run" << endl;
+    return 0;
+}
+
+
+/**
+ * legacyTrain
+ * Função: CvHMM::train como era antes do CvHMMWorkspace: aloca a, c, b, YN e YNN e os temporários das médias
+ *         (expressões de cv::Mat) a cada sequência. Referência do modo "legacy"; os símbolos são lidos com
+ *         cvhmmSymbol e, como em CvHMM::train, o a-pass soma sobre o estado anterior j, a0 vem de cada sequência
+ *         e a parada compara passadas inteiras; o resto é o código original.
+ */
+void legacyTrain(const cv::Mat &seq, const int max_iter, cv::Mat &TRANS, cv::Mat &EMIS, cv::Mat &INIT){
+    int iters = 0;
+    int T = seq.cols;
+    int C = seq.rows;
+    int N = TRANS.rows;
+    int M = EMIS.cols;
+    CvHMM::correctModel(TRANS, EMIS, INIT);
+    cv::Mat FTRANS = TRANS.clone(), FEMIS = EMIS.clone(), FINIT = INIT.clone();
+    double logProb = 0;
+    double oldLogProb = -DBL_MAX;
+    bool improving = true;
+    int data = 0;
+    do{
+        cv::Mat a(N, T, CV_64F);
+        cv::Mat c(1, T, CV_64F); c.at<double>(0,0) = 0;
+        for(int i = 0; i < N; i++){
+            a.at<double>(i,0) = INIT.at<double>(0,i) * EMIS.at<double>(i, cvhmmSymbol(seq, data, 0));
+            c.at<double>(0,0) += a.at<double>(i,0);
+        }
+        c.at<double>(0,0) = 1/c.at<double>(0,0);
+        for(int i = 0; i < N; i++)
+            a.at<double>(i,0) *= c.at<double>(0,0);
+        for(int t = 1; t < T; t++){
+            c.at<double>(0,t) = 0;
+            for(int i = 0; i < N; i++){
+                a.at<double>(i,t) = 0;
+                for(int j = 0; j < N; j++)
+                    a.at<double>(i,t) += a.at<double>(j,t-1) * TRANS.at<double>(j,i);
+                a.at<double>(i,t) = a.at<double>(i,t) * EMIS.at<double>(i, cvhmmSymbol(seq, data, t));
+                c.at<double>(0,t) += a.at<double>(i,t);
+            }
+            c.at<double>(0,t) = 1/c.at<double>(0,t);
+            for(int i = 0; i < N; i++)
+                a.at<double>(i,t) = c.at<double>(0,t) * a.at<double>(i,t);
+        }
+        cv::Mat b(N, T, CV_64F);
+        for(int i = 0; i < N; i++)
+            b.at<double>(i,T-1) = c.at<double>(0,T-1);
+        for(int t = T-2; t > -1; t--)
+            for(int i = 0; i < N; i++){
+                b.at<double>(i,t) = 0;
+                for(int j = 0; j < N; j++)
+                    b.at<double>(i,t) += TRANS.at<double>(i,j) * EMIS.at<double>(j, cvhmmSymbol(seq, data, t+1)) * b.at<double>(j,t+1);
+                b.at<double>(i,t) *= c.at<double>(0,t);
+            }
+        double denom;
+        int index;
+        cv::Mat YN(N, T, CV_64F);
+        cv::Mat YNN(N*N, T, CV_64F);
+        for(int t = 0; t < T-1; t++){
+            denom = 0;
+            for(int i = 0; i < N; i++)
+                for(int j = 0; j < N; j++)
+                    denom += a.at<double>(i,t) * TRANS.at<double>(i,j) * EMIS.at<double>(j, cvhmmSymbol(seq, data, t+1)) * b.at<double>(j,t+1);
+            index = 0;
+            for(int i = 0; i < N; i++){
+                YN.at<double>(i,t) = 0;
+                for(int j = 0; j < N; j++){
+                    YNN.at<double>(index,t) = (a.at<double>(i,t) * TRANS.at<double>(i,j) * EMIS.at<double>(j, cvhmmSymbol(seq, data, t+1)) * b.at<double>(j,t+1)) / denom;
+                    YN.at<double>(i,t) += YNN.at<double>(index,t);
+                    index++;
+                }
+            }
+        }
+        for(int i = 0; i < N; i++)
+            INIT.at<double>(0,i) = YN.at<double>(i,0);
+        double numer;
+        index = 0;
+        for(int i = 0; i < N; i++)
+            for(int j = 0; j < N; j++){
+                numer = 0;
+                denom = 0;
+                for(int t = 0; t < T-1; t++){
+                    numer += YNN.at<double>(index,t);
+                    denom += YN.at<double>(i,t);
+                }
+                TRANS.at<double>(i,j) = numer/denom;
+                index++;
+            }
+        for(int i = 0; i < N; i++)
+            for(int j = 0; j < M; j++){
+                numer = 0;
+                denom = 0;
+                for(int t = 0; t < T-1; t++){
+                    if(cvhmmSymbol(seq, data, t) == j)
+                        numer += YN.at<double>(i,t);
+                    denom += YN.at<double>(i,t);
+                }
+                EMIS.at<double>(i,j) = numer/denom;
+            }
+        CvHMM::correctModel(TRANS, EMIS, INIT);
+        FTRANS = (FTRANS*(data+1)+TRANS)/(data+2);
+        FEMIS = (FEMIS*(data+1)+EMIS)/(data+2);
+        FINIT = (FINIT*(data+1)+INIT)/(data+2);
+        for(int i = 0; i < T; i++)
+            logProb -= log(c.at<double>(0,i));
+        data++;
+        if(data >= C){
+            improving = logProb > oldLogProb;
+            oldLogProb = logProb;
+            logProb = 0;
+            data = 0;
+            iters++;
+        }
+    }while(iters < max_iter && improving);
+    CvHMM::correctModel(FTRANS, FEMIS, FINIT);
+    TRANS = FTRANS.clone();
+    EMIS = FEMIS.clone();
+    INIT = FINIT.clone();
+}
+
+
+/**
+ * benchLegacyTrain
+ * Função: Mede o tempo e o número de alocações do treinamento antigo (legacyTrain, uma alocação por sequência) nas
+ *         mesmas bases e modelos iniciais do modo train, que mede o treinamento atual. Mostra também a maior
+ *         diferença entre os modelos treinados pelos dois caminhos.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int repeat (Quantas vezes cada modelo é treinado a partir do mesmo modelo inicial)
+ */
+int benchLegacyTrain(int codebookSize, int stateNumber, int repeat){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    if(codebook == NULL)
+        return -1;
+
+    double totalSeconds = 0, maxDiff = 0;
+    long totalAllocations = 0;
+    CvHMMWorkspace workspace;
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        Mat seq, subSeq;
+        string filename = "./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt";
+        codebook->getGestureObservationsFromTrainingData(filename, GESTURE_SIZE, seq, subSeq);
+
+        HMM initial(HMM_ToFileName(intToHMM(g)) + ".hmm", codebook->getClusterNumber(), stateNumber, false);
+        Mat TRANS0, EMIS0, INIT0;
+        initial.getTransitionMatrix(TRANS0);
+        initial.getEmissionMatrix(EMIS0);
+        initial.getInitialMatrix(INIT0);
+
+        double seconds = 0;
+        long allocations = 0;
+        Mat TRANS, EMIS, INIT;
+        for(int r = 0; r < repeat; r++){
+            TRANS = TRANS0.clone();
+            EMIS = EMIS0.clone();
+            INIT = INIT0.clone();
+
+            long allocations0 = g_allocations;
+            Clock::time_point start = Clock::now();
+            legacyTrain(subSeq, MAX_ITER, TRANS, EMIS, INIT);
+            seconds += secondsSince(start);
+            allocations += g_allocations - allocations0;
+        }
+
+        Mat CTRANS = TRANS0.clone(), CEMIS = EMIS0.clone(), CINIT = INIT0.clone();
+        CvHMM::train(subSeq, MAX_ITER, CTRANS, CEMIS, CINIT, workspace);
+        maxDiff = max(maxDiff, norm(TRANS, CTRANS, NORM_INF));
+        maxDiff = max(maxDiff, norm(EMIS, CEMIS, NORM_INF));
+        maxDiff = max(maxDiff, norm(INIT, CINIT, NORM_INF));
+
+        cout << HMM_ToString(intToHMM(g)) << ": " << subSeq.rows << "x" << subSeq.cols << " LOOT, "
+             << seconds*1000/repeat << " ms/train, " << (double)allocations/repeat << " allocations/train" << endl;
+        totalSeconds += seconds;
+        totalAllocations += allocations;
+    }
+    cout << "Total: " << totalSeconds*1000/repeat << " ms, " << (double)totalAllocations/repeat << " allocations per training run" << endl;
+    cout << "Max difference to CvHMM::train: " << maxDiff << endl;
+    delete codebook;
+    return 0;
+}
+
+
+/**
+ * benchStreaming
+ * Função: Compara o treinamento sobre a matriz LOOT materializada (KMeans::lootStrategy) com o treinamento sobre as
+ *         variantes geradas sob demanda (CvHMMLootSource): tempo, memória das sequências de treino e a maior
+ *         diferença entre os modelos treinados, que deve ser zero.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int repeat (Quantas vezes cada modelo é treinado a partir do mesmo modelo inicial)
+ */
+int benchStreaming(int codebookSize, int stateNumber, int repeat){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    if(codebook == NULL)
+        return -1;
+
+    CvHMMWorkspace workspace;
+    cout << "Gesture\t\tLOOT KB\tStream KB\tLOOT ms/train\tStream ms/train\tMaxDiff" << endl;
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        Mat seq, subSeq;
+        string filename = "./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt";
+        codebook->getGestureObservationsFromTrainingData(filename, GESTURE_SIZE, seq, subSeq);
+        CvHMMLootSource loot(seq);
+
+        HMM initial(HMM_ToFileName(intToHMM(g)) + ".hmm", codebook->getClusterNumber(), stateNumber, false);
+        Mat TRANS0, EMIS0, INIT0;
+        initial.getTransitionMatrix(TRANS0);
+        initial.getEmissionMatrix(EMIS0);
+        initial.getInitialMatrix(INIT0);
+
+        double seconds[2] = {0, 0}, maxDiff = 0;
+        for(int r = 0; r < repeat; r++){
+            Mat TRANS[2], EMIS[2], INIT[2];
+            for(int k = 0; k < 2; k++){
+                TRANS[k] = TRANS0.clone();
+                EMIS[k] = EMIS0.clone();
+                INIT[k] = INIT0.clone();
+            }
+            Clock::time_point start = Clock::now();
+            CvHMM::train(subSeq, MAX_ITER, TRANS[0], EMIS[0], INIT[0], workspace);
+            seconds[0] += secondsSince(start);
+
+            start = Clock::now();
+            CvHMM::train(loot, MAX_ITER, TRANS[1], EMIS[1], INIT[1], workspace);
+            seconds[1] += secondsSince(start);
+
+            maxDiff = max(maxDiff, norm(TRANS[0], TRANS[1], NORM_INF));
+            maxDiff = max(maxDiff, norm(EMIS[0], EMIS[1], NORM_INF));
+            maxDiff = max(maxDiff, norm(INIT[0], INIT[1], NORM_INF));
+        }
+
+        //A fonte só guarda ponteiros para as sequências originais e uma variante
+        double lootKB = subSeq.total() * subSeq.elemSize() / 1024.0;
+        double streamKB = (seq.rows * (sizeof(void*) + sizeof(int)) + (seq.cols - 1) * seq.elemSize()) / 1024.0;
+        cout << HMM_ToString(intToHMM(g)) << "\t\t" << lootKB << "\t" << streamKB << "\t\t" << seconds[0]*1000/repeat << "\t\t"
+             << seconds[1]*1000/repeat << "\t\t" << maxDiff << endl;
+    }
+    return 0;
+}
+
+
+/**
+ * loadBenchSequences
+ * Função: Quantiza as bases de dados de todos os gestos
+ *
+ * In: KMeans *codebook (Codebook usado na quantização)
+ * In: vector<Mat> &sequences (Uma matriz de sequências por gesto, na ordem do enum HMM_Name)
+ *
+ * Out: vector<Mat> &sequences
+ */
+void loadBenchSequences(KMeans *codebook, vector<Mat> &sequences){
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        Mat seq, subSeq;
+        string filename = "./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt";
+        codebook->getGestureObservationsFromTrainingData(filename, GESTURE_SIZE, seq, subSeq);
+        sequences.push_back(seq);
+    }
+}
+
+
+/**
+ * benchPrefilter
+ * Função: Mede o recall e o custo do pré-filtro de histograma para cada tamanho de lista de candidatos.
+ *         Recall do rótulo: o gesto correto está na lista. Recall do forward: o vencedor do forward completo está na lista.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ */
+int benchPrefilter(int codebookSize, int stateNumber){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    vector<HMM*> models;
+    if(codebook == NULL || !loadGestureModels(codebookSize, stateNumber, models))
+        return -1;
+    vector<Mat> sequences;
+    loadBenchSequences(codebook, sequences);
+
+    HistogramPrefilter prefilter;
+    RecognitionResult full, filtered;
+    cout << "Shortlist	LabelRecall	ForwardRecall	Accuracy	us/window" << endl;
+    for(int shortlist = 1; shortlist <= (int)models.size(); shortlist++){
+        int total = 0, labelHits = 0, forwardHits = 0, correct = 0;
+        double seconds = 0;
+        for(int g = 0; g < GESTURE_COUNT; g++){
+            for(int r = 0; r < sequences[g].rows; r++){
+                Mat window = sequences[g].row(r);
+                recognize(models, window, 1, full);
+
+                Clock::time_point start = Clock::now();
+                recognize(models, window, 1, filtered, &prefilter, shortlist);
+                seconds += secondsSince(start);
+
+                //Sem candidatos o pré-filtro não foi usado e todos os modelos foram avaliados
+                vector<int> &candidates = filtered.candidates;
+                bool all = candidates.empty();
+                if(all || find(candidates.begin(), candidates.end(), g) != candidates.end())
+                    labelHits++;
+                if(all || find(candidates.begin(), candidates.end(), full.best()) != candidates.end())
+                    forwardHits++;
+                if(filtered.best() == g)
+                    correct++;
+                total++;
+            }
+        }
+        cout << shortlist << "		" << (double)labelHits*100/total << "%		" << (double)forwardHits*100/total << "%		"
+             << (double)correct*100/total << "%		" << seconds*1e6/total << endl;
+    }
+    return 0;
+}
+
+
+/**
+ * benchKernels
+ * Função: Mede o custo por chamada dos kernels de HMMKernels.h sobre buffers crus (sem cv::Mat),
+ *         comparado com as mesmas operações pela interface CvHMM.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int repeat (Quantas vezes cada sequência é processada)
+ */
+int benchKernels(int codebookSize, int stateNumber, int repeat){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    vector<HMM*> models;
+    if(codebook == NULL || !loadGestureModels(codebookSize, stateNumber, models))
+        return -1;
+    vector<Mat> sequences;
+    loadBenchSequences(codebook, sequences);
+
+    //Buffers crus, alocados uma vez para o maior caso
+    int N = stateNumber, T = GESTURE_SIZE;
+    vector<double> alpha(N*T), beta(N*T), gamma(N*T), c(T), work(max((size_t)2*N, HMMKernels::viterbiWorkSize(N)));
+    vector<int> states(T), psi(N*T);
+    HMMLatticeSpan alphaSpan = {&alpha[0], T, 1}, betaSpan = {&beta[0], T, 1}, gammaSpan = {&gamma[0], T, 1};
+    HMMLatticeSpan noXi = {NULL, 0, 0};
+
+    double seconds[6] = {0, 0, 0, 0, 0, 0};
+    long calls = 0;
+    double checksum = 0;
+    CvHMMDecoding decoding;
+    for(size_t m = 0; m < models.size(); m++){
+        Mat TRANS, EMIS, INIT;
+        models[m]->getTransitionMatrix(TRANS);
+        models[m]->getEmissionMatrix(EMIS);
+        models[m]->getInitialMatrix(INIT);
+        CvHMM::correctModel(TRANS, EMIS, INIT);
+        HMMModelSpan model = hmmModelSpan(TRANS, EMIS, INIT);
+        for(int g = 0; g < GESTURE_COUNT; g++){
+            for(int r = 0; r < sequences[g].rows; r++){
+                Mat window = sequences[g].row(r);
+                for(int i = 0; i < repeat; i++){
+                    Clock::time_point start = Clock::now();
+                    checksum += hmmForwardLikelihood(model, window, T, &work[0]);
+                    seconds[0] += secondsSince(start);
+
+                    start = Clock::now();
+                    checksum += hmmForward(model, window, T, alphaSpan, &c[0]);
+                    seconds[1] += secondsSince(start);
+
+                    start = Clock::now();
+                    hmmBackward(model, window, T, &c[0], betaSpan);
+                    hmmPosteriors(model, window, T, alphaSpan, betaSpan, gammaSpan, noXi);
+                    seconds[2] += secondsSince(start);
+
+                    start = Clock::now();
+                    hmmViterbi(model, window, T, &states[0], &psi[0], &work[0]);
+                    seconds[3] += secondsSince(start);
+
+                    start = Clock::now();
+                    CvHMM::decode(window, TRANS, EMIS, INIT, CVHMM_LIKELIHOOD, decoding);
+                    seconds[4] += secondsSince(start);
+
+                    start = Clock::now();
+                    CvHMM::decode(window, TRANS, EMIS, INIT, CVHMM_POSTERIORS, decoding);
+                    decoding.posteriors();
+                    seconds[5] += secondsSince(start);
+                    calls++;
+                }
+            }
+        }
+    }
+
+    const char *names[6] = {"kernel forwardLikelihood", "kernel forward", "kernel backward+posteriors", "kernel viterbi",
+                            "CvHMM decode (likelihood)", "CvHMM decode (posteriors)"};
+    for(int k = 0; k < 6; k++)
+        cout << names[k] << ": " << seconds[k]*1e6/calls << " us/call" << endl;
+    cout << calls << " calls, T = " << T << ", N = " << N << " (checksum " << checksum << ")" << endl;
+    return 0;
+}
+
+
+/**
+ * benchSequential
+ * Função: Simula o reconhecimento quadro a quadro (SequentialRecognizer) sobre as sequências da base de dados e
+ *         mostra, por gesto e para cada taxa de erro do SPRT, a acurácia e o número médio de frames até a decisão.
+ *         Sequências sem decisão até o fim da janela usam o líder final, como o modo sem decisão antecipada.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int minFrames (Menor número de frames para decidir)
+ */
+int benchSequential(int codebookSize, int stateNumber, int minFrames){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    vector<HMM*> models;
+    if(codebook == NULL || !loadGestureModels(codebookSize, stateNumber, models))
+        return -1;
+    vector<Mat> sequences;
+    loadBenchSequences(codebook, sequences);
+
+    //Taxa 0 = limite infinito: nunca decide antes do fim da janela (referência)
+    double errorRates[] = {0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-6, 1e-9, 1e-12};
+    cout << "ErrorRate\tBound\tGesture\t\tAccuracy\tEarly\tFrames" << endl;
+    for(int e = 0; e < (int)(sizeof(errorRates)/sizeof(errorRates[0])); e++){
+        double bound = SequentialRecognizer::sprtBound(errorRates[e]);
+        SequentialRecognizer sequential(models, bound, minFrames);
+        int allCorrect = 0, allEarly = 0, allTotal = 0;
+        long allFrames = 0;
+        for(int g = 0; g < GESTURE_COUNT; g++){
+            int correct = 0, early = 0;
+            long frames = 0;
+            for(int r = 0; r < sequences[g].rows; r++){
+                sequential.reset();
+                int decision = -1;
+                for(int t = 0; t < sequences[g].cols && decision < 0; t++)
+                    decision = sequential.push(cvhmmSymbol(sequences[g], r, t));
+                if(decision >= 0)
+                    early++;
+                else
+                    decision = sequential.getLeader();
+                if(decision == g)
+                    correct++;
+                frames += sequential.getFrames();
+            }
+            int total = sequences[g].rows;
+            cout << errorRates[e] << "\t" << bound << "\t" << HMM_ToFileName(intToHMM(g)) << "\t\t"
+                 << (double)correct*100/total << "%\t\t" << (double)early*100/total << "%\t" << (double)frames/total << endl;
+            allCorrect += correct;
+            allEarly += early;
+            allFrames += frames;
+            allTotal += total;
+        }
+        cout << errorRates[e] << "\t" << bound << "\tall\t\t" << (double)allCorrect*100/allTotal << "%\t\t"
+             << (double)allEarly*100/allTotal << "%\t" << (double)allFrames/allTotal << endl;
+    }
+    return 0;
+}
+
+
+/**
+ * buildBenchStream
+ * Função: Monta um fluxo contínuo com as sequências da base de dados em ordem aleatória, separadas por trechos
+ *         ociosos de símbolos aleatórios (10 a 30 frames), e a segmentação de referência
+ *
+ * In: vector<Mat> &sequences (Sequências de cada gesto)
+ * In: int codebookSize (Número de símbolos)
+ * In: unsigned int seed (Semente do fluxo)
+ * In: vector<int> &stream (Símbolos do fluxo)
+ * In: vector<GestureEvent> &truth (Gesto, primeiro e último frame de cada sequência no fluxo)
+ *
+ * Out: vector<int> &stream
+ * Out: vector<GestureEvent> &truth
+ */
+void buildBenchStream(vector<Mat> &sequences, int codebookSize, unsigned int seed, vector<int> &stream, vector<GestureEvent> &truth){
+    mt19937 rng(seed);
+    vector<pair<int,int> > order;
+    for(int g = 0; g < GESTURE_COUNT; g++)
+        for(int r = 0; r < sequences[g].rows; r++)
+            order.push_back(make_pair(g, r));
+    shuffle(order.begin(), order.end(), rng);
+    uniform_int_distribution<int> idleLength(10, 30), idleSymbol(0, codebookSize - 1);
+    for(size_t i = 0; i < order.size(); i++){
+        for(int t = idleLength(rng); t > 0; t--)
+            stream.push_back(idleSymbol(rng));
+        GestureEvent e = {order[i].first, (int)stream.size(), (int)stream.size() + GESTURE_SIZE - 1, 0};
+        for(int t = 0; t < GESTURE_SIZE; t++)
+            stream.push_back(cvhmmSymbol(sequences[e.model], order[i].second, t));
+        truth.push_back(e);
+    }
+}
+
+
+/**
+ * benchSpot
+ * Função: Mede o GestureSpotter em um fluxo contínuo: as sequências da base de dados, em ordem aleatória,
+ *         separadas por trechos ociosos de símbolos aleatórios (10 a 30 frames). Um gesto é detectado quando um
+ *         evento cobre pelo menos metade dele; eventos que não cobrem nenhum gesto são falsos alarmes.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: unsigned int seed (Semente do fluxo)
+ */
+int benchSpot(int codebookSize, int stateNumber, unsigned int seed){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    vector<HMM*> models;
+    if(codebook == NULL || !loadGestureModels(codebookSize, stateNumber, models))
+        return -1;
+    vector<Mat> sequences;
+    loadBenchSequences(codebook, sequences);
+
+    vector<int> stream;
+    vector<GestureEvent> truth;
+    buildBenchStream(sequences, codebook->getClusterNumber(), seed, stream, truth);
+
+    double thresholds[] = {10, 15, 20, 25, 30};
+    cout << stream.size() << " frames, " << truth.size() << " gestures" << endl;
+    cout << "Threshold\tDetected\tCorrect\tFalseAlarms\tStartErr\tEndErr\tus/frame" << endl;
+    for(int th = 0; th < (int)(sizeof(thresholds)/sizeof(thresholds[0])); th++){
+        GestureSpotter spotter(models, thresholds[th], GESTURE_SIZE / 4, 5);
+        vector<GestureEvent> events;
+        GestureEvent event;
+        Clock::time_point start = Clock::now();
+        for(size_t t = 0; t < stream.size(); t++)
+            if(spotter.push(stream[t], event))
+                events.push_back(event);
+        if(spotter.flush(event))
+            events.push_back(event);
+        double seconds = secondsSince(start);
+
+        int detected = 0, correct = 0, falseAlarms = 0;
+        double startErr = 0, endErr = 0;
+        vector<bool> used(events.size(), false);
+        for(size_t i = 0; i < truth.size(); i++){
+            int match = -1, bestOverlap = 0;
+            for(size_t e = 0; e < events.size(); e++){
+                int overlap = min(truth[i].end, events[e].end) - max(truth[i].start, events[e].start) + 1;
+                if(overlap > bestOverlap){
+                    bestOverlap = overlap;
+                    match = e;
+                }
+            }
+            if(match < 0 || bestOverlap * 2 < GESTURE_SIZE)
+                continue;
+            used[match] = true;
+            detected++;
+            if(events[match].model == truth[i].model)
+                correct++;
+            startErr += abs(events[match].start - truth[i].start);
+            endErr += abs(events[match].end - truth[i].end);
+        }
+        for(size_t e = 0; e < events.size(); e++)
+            if(!used[e])
+                falseAlarms++;
+        cout << thresholds[th] << "\t\t" << (double)detected*100/truth.size() << "%\t\t" << (double)correct*100/truth.size() << "%\t"
+             << falseAlarms << "\t\t" << (detected ? startErr/detected : 0) << "\t\t" << (detected ? endErr/detected : 0) << "\t"
+             << seconds*1e6/stream.size() << endl;
+    }
+    return 0;
+}
+
+
+/**
+ * benchSliding
+ * Função: Compara o SlidingWindowScorer com avaliar cada janela do zero (recognize) no fluxo contínuo de benchSpot,
+ *         para vários espaçamentos entre janelas. Mostra o custo por frame e a maior diferença entre os scores.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int length (Tamanho das janelas)
+ */
+int benchSliding(int codebookSize, int stateNumber, int length){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    vector<HMM*> models;
+    if(codebook == NULL || !loadGestureModels(codebookSize, stateNumber, models))
+        return -1;
+    vector<Mat> sequences;
+    loadBenchSequences(codebook, sequences);
+    vector<int> stream;
+    vector<GestureEvent> truth;
+    buildBenchStream(sequences, codebook->getClusterNumber(), 42, stream, truth);
+    Mat streamMat(1, stream.size(), CV_32SC1, &stream[0]);
+
+    int strides[] = {1, 2, 5, 10, 20, 40};
+    cout << stream.size() << " frames, windows of " << length << " frames" << endl;
+    cout << "Stride\tWindows\tIncremental us/frame\tFromScratch us/frame\tMaxDiff" << endl;
+    for(int s = 0; s < (int)(sizeof(strides)/sizeof(strides[0])); s++){
+        int stride = strides[s];
+        SlidingWindowScorer scorer(models, length, stride);
+        RecognitionResult incremental, scratch;
+        vector<RecognitionResult> results;
+        vector<int> starts;
+
+        Clock::time_point start = Clock::now();
+        for(size_t t = 0; t < stream.size(); t++)
+            if(scorer.push(stream[t], GESTURE_COUNT, incremental)){
+                results.push_back(incremental);
+                starts.push_back(scorer.getLastStart());
+            }
+        double incrementalSeconds = secondsSince(start);
+
+        double maxDiff = 0;
+        start = Clock::now();
+        for(size_t w = 0; w < starts.size(); w++){
+            recognize(models, streamMat.colRange(starts[w], starts[w] + length), GESTURE_COUNT, scratch);
+            for(size_t h = 0; h < scratch.hypotheses.size(); h++)
+                maxDiff = max(maxDiff, fabs(scratch.hypotheses[h].logp - results[w].hypotheses[h].logp));
+        }
+        double scratchSeconds = secondsSince(start);
+
+        cout << stride << "\t" << starts.size() << "\t" << incrementalSeconds*1e6/stream.size() << "\t\t\t"
+             << scratchSeconds*1e6/stream.size() << "\t\t\t" << maxDiff << endl;
+    }
+    return 0;
+}
+
+
+/**
+ * benchVocabulary
+ * Função: Mede a latência do reconhecimento de uma janela e a memória dos parâmetros quando o vocabulário cresce
+ *         de 4 a 500 gestos, com modelos independentes e com emissões compartilhadas (TiedModelSet). Antes mostra a
+ *         acurácia dos 4 gestos reais para vários tamanhos de pool. Os vocabulários maiores são sintéticos: cada
+ *         gesto novo perturba as transições de um gesto real e sorteia a entrada do pool de cada estado; os modelos
+ *         independentes recebem cópias dessas entradas no EMIS, então os scores das duas famílias devem ser iguais.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int poolSize (Entradas do pool nos vocabulários sintéticos; 0 usa uma por estado dos gestos reais)
+ */
+int benchVocabulary(int codebookSize, int stateNumber, int poolSize){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    vector<HMM*> models;
+    if(codebook == NULL || !loadGestureModels(codebookSize, stateNumber, models))
+        return -1;
+    vector<Mat> sequences;
+    loadBenchSequences(codebook, sequences);
+    vector<Mat> windows;
+    for(int g = 0; g < GESTURE_COUNT; g++)
+        for(int r = 0; r < sequences[g].rows; r++)
+            windows.push_back(sequences[g].row(r));
+    int M = models[0]->getCodebookSize();
+
+    //Gestos reais: acurácia com emissões compartilhadas
+    RecognitionResult result;
+    int pools[] = {0, 24, 16, 12, 8, 4};
+    cout << "Pool\tAccuracy\tParameterKB" << endl;
+    for(int p = 0; p < (int)(sizeof(pools)/sizeof(pools[0])); p++){
+        TiedModelSet tied(models, pools[p]);
+        int correct = 0;
+        for(size_t w = 0; w < windows.size(); w++){
+            recognize(tied, windows[w], 1, result);
+            if(result.best() == (int)(w / sequences[0].rows))
+                correct++;
+        }
+        cout << tied.getPoolSize() << "\t" << (double)correct*100/windows.size() << "%\t\t"
+             << tied.getParameterBytes()/1024.0 << endl;
+    }
+
+    //Vocabulários sintéticos
+    vector<Mat> realTRANS, realINIT;
+    for(size_t g = 0; g < models.size(); g++){
+        Mat TRANS, EMIS, INIT;
+        models[g]->getTransitionMatrix(TRANS);
+        models[g]->getEmissionMatrix(EMIS);
+        models[g]->getInitialMatrix(INIT);
+        TRANS = TRANS.clone();
+        EMIS = EMIS.clone();
+        INIT = INIT.clone();
+        CvHMM::correctModel(TRANS, EMIS, INIT);
+        realTRANS.push_back(TRANS);
+        realINIT.push_back(INIT);
+    }
+    TiedModelSet base(models, poolSize);
+    int P = base.getPoolSize();
+    vector<double> entries(P*M);
+    for(int p = 0; p < P; p++)
+        base.getPoolEntry(p, &entries[p*M]);
+
+    int vocabularies[] = {4, 10, 25, 50, 100, 250, 500};
+    cout << endl << "Pool of " << P << " entries, " << windows.size() << " windows of " << GESTURE_SIZE << " frames" << endl;
+    cout << "Gestures\tIndependentKB\tTiedKB\tDecode us/window\tKernel us/window\tTied us/window\tMaxDiff" << endl;
+    for(int v = 0; v < (int)(sizeof(vocabularies)/sizeof(vocabularies[0])); v++){
+        int V = vocabularies[v];
+        mt19937 rng(42);
+        uniform_real_distribution<double> noise(0.5, 1.5);
+        uniform_int_distribution<int> pickEntry(0, P - 1);
+
+        TiedModelSet tied(M);
+        for(int p = 0; p < P; p++)
+            tied.addPoolEntry(&entries[p*M]);
+        vector<Mat> TRANS(V), EMIS(V), INIT(V);
+        vector<HMMModelSpan> spans(V);
+        size_t independentBytes = 0;
+        for(int g = 0; g < V; g++){
+            int real = g % models.size();
+            TRANS[g] = realTRANS[real].clone();
+            INIT[g] = realINIT[real].clone();
+            int N = TRANS[g].rows;
+            vector<int> states = base.getStates(real);
+            if(g >= (int)models.size()){
+                for(int i = 0; i < N; i++){
+                    double sum = 0;
+                    for(int j = 0; j < N; j++)
+                        sum += TRANS[g].at<double>(i,j) *= noise(rng);
+                    for(int j = 0; j < N; j++)
+                        TRANS[g].at<double>(i,j) /= sum;
+                    states[i] = pickEntry(rng);
+                }
+            }
+            EMIS[g] = Mat(N, M, CV_64F);
+            for(int i = 0; i < N; i++)
+                base.getPoolEntry(states[i], EMIS[g].ptr<double>(i));
+            tied.addModel(TRANS[g], INIT[g], states);
+            spans[g] = hmmModelSpan(TRANS[g], EMIS[g], INIT[g]);
+            independentBytes += (TRANS[g].total() + EMIS[g].total() + INIT[g].total()) * sizeof(double);
+        }
+
+        vector<double> work(2 * stateNumber), kernelLogps(V);
+        CvHMMDecoding decoding;
+        double seconds[3] = {0, 0, 0}, maxDiff = 0;
+        for(size_t w = 0; w < windows.size(); w++){
+            Clock::time_point start = Clock::now();
+            for(int g = 0; g < V; g++)
+                CvHMM::decode(windows[w], TRANS[g], EMIS[g], INIT[g], CVHMM_LIKELIHOOD, decoding);
+            seconds[0] += secondsSince(start);
+
+            start = Clock::now();
+            for(int g = 0; g < V; g++)
+                kernelLogps[g] = hmmForwardLikelihood(spans[g], windows[w], windows[w].cols, &work[0]);
+            seconds[1] += secondsSince(start);
+
+            start = Clock::now();
+            const vector<double> &tiedLogps = tied.score(windows[w]);
+            seconds[2] += secondsSince(start);
+            for(int g = 0; g < V; g++)
+                maxDiff = max(maxDiff, fabs(tiedLogps[g] - kernelLogps[g]));
+        }
+        cout << V << "\t\t" << independentBytes/1024.0 << "\t\t" << tied.getParameterBytes()/1024.0 << "\t"
+             << seconds[0]*1e6/windows.size() << "\t\t\t" << seconds[1]*1e6/windows.size() << "\t\t\t"
+             << seconds[2]*1e6/windows.size() << "\t\t" << maxDiff << endl;
+    }
+    return 0;
+}
+
+
+/**
+ * loadBenchFrames
+ * Função: Lê os frames das bases de treino de todos os gestos
+ *
+ * In: vector<Centroids> &points (Frames, na ordem dos gestos)
+ *
+ * Out: vector<Centroids> &points
+ */
+void loadBenchFrames(vector<Centroids> &points){
+    KMeans reader;
+    for(int g = 0; g < GESTURE_COUNT; g++)
+        reader.readTrainingFrames("./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt", points);
+}
+
+
+/**
+ * buildBenchFrames
+ * Função: Gera count frames sorteando frames da base de dados com ruído gaussiano (1% do desvio de cada
+ *         característica), para medir o treinamento do codebook em bases muito maiores que a gravada
+ *
+ * In: vector<Centroids> &points (Frames da base de dados)
+ * In: int count (Número de frames gerados)
+ * In: unsigned int seed (Semente do sorteio)
+ * In: vector<Centroids> &frames (Frames gerados)
+ *
+ * Out: vector<Centroids> &frames
+ */
+void buildBenchFrames(const vector<Centroids> &points, int count, unsigned int seed, vector<Centroids> &frames){
+    mt19937 rng(seed);
+    uniform_int_distribution<int> pick(0, points.size() - 1);
+    normal_distribution<float> noise(0, 0.01f);
+    float deviation[8] = {0, 0, 0, 0, 0, 0, 0, 0}, average[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for(size_t i = 0; i < points.size(); i++){
+        const float *v = &points[i].rightVectorX;
+        for(int d = 0; d < 8; d++){
+            average[d] += v[d] / points.size();
+            deviation[d] += v[d] * v[d] / points.size();
+        }
+    }
+    for(int d = 0; d < 8; d++)
+        deviation[d] = sqrt(max(0.0f, deviation[d] - average[d] * average[d]));
+
+    frames.resize(count);
+    for(int i = 0; i < count; i++){
+        frames[i] = points[pick(rng)];
+        float *v = &frames[i].rightVectorX;
+        for(int d = 0; d < 8; d++)
+            v[d] += noise(rng) * deviation[d];
+    }
+}
+
+
+/**
+ * benchKMeans
+ * Função: Mede o treinamento do codebook (KMeans::train) na base de dados e em uma base sintética de frames
+ *         frames: Lloyd e Hamerly com 1 thread e Hamerly com threads threads, a fração das distâncias evitadas e se
+ *         o codebook é o mesmo do Lloyd. Mostra também a inércia do codebook distribuído na base de dados, como
+ *         referência.
+ *
+ * In: int clusters (Tamanho do codebook)
+ * In: int frames (Frames da base sintética)
+ * In: int threads (Número de threads)
+ */
+int benchKMeans(int clusters, int frames, int threads){
+    vector<Centroids> points, synthetic;
+    loadBenchFrames(points);
+    buildBenchFrames(points, frames, 42, synthetic);
+
+    KMeans *shipped = loadBenchCodebook(clusters);
+    if(shipped != NULL){
+        double inertia = 0;
+        vector<Centroids> &centers = *shipped->returnCentroids();
+        for(size_t i = 0; i < points.size(); i++)
+            inertia += KMeans::squaredDistance(points[i], centers[shipped->GetNearestCluster(points[i])]);
+        cout << "Shipped codebook: inertia " << inertia << " on " << points.size() << " frames" << endl;
+    }
+
+    //Lloyd e Hamerly com 1 thread, Hamerly com threads threads; todos devem dar o mesmo codebook
+    KMeansAlgorithm algorithms[3] = {KMEANS_LLOYD, KMEANS_HAMERLY, KMEANS_HAMERLY};
+    const char *names[3] = {"Lloyd", "Hamerly", "Hamerly"};
+    int counts[3] = {1, 1, threads};
+    cout << "Frames\t\tAlgorithm\tThreads\tIterations\tInertia\t\tSeconds\tAvoided\tSameCodebook" << endl;
+    vector<Centroids> *sets[2] = {&points, &synthetic};
+    for(int s = 0; s < 2; s++){
+        vector<Centroids> reference;
+        for(int r = 0; r < 3; r++){
+            KMeans codebook;
+            KMeansStats stats;
+            Clock::time_point start = Clock::now();
+            double inertia = codebook.train(*sets[s], clusters, counts[r], 42, 300, 1e-4, algorithms[r], &stats);
+            double seconds = secondsSince(start);
+
+            vector<Centroids> &centers = *codebook.returnCentroids();
+            bool same = true;
+            if(r == 0)
+                reference = centers;
+            else
+                for(size_t k = 0; k < centers.size(); k++)
+                    same = same && KMeans::squaredDistance(centers[k], reference[k]) == 0;
+            cout << sets[s]->size() << "\t\t" << names[r] << "\t\t" << counts[r] << "\t" << stats.iterations << "\t\t"
+                 << inertia << "\t" << seconds << "\t" << stats.avoided()*100 << "%\t" << (r == 0 ? "-" : (same ? "yes" : "no")) << endl;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * meanSquaredError
+ * Função: Erro de quantização médio (distância quadrática até o centroide mais próximo) dos frames
+ */
+double meanSquaredError(const vector<Centroids> &points, KMeans &codebook){
+    double error = 0;
+    vector<Centroids> &centers = *codebook.returnCentroids();
+    for(size_t i = 0; i < points.size(); i++){
+        double best = DBL_MAX;
+        for(size_t c = 0; c < centers.size(); c++)
+            best = min(best, KMeans::squaredDistance(points[i], centers[c]));
+        error += best;
+    }
+    return error / points.size();
+}
+
+
+/**
+ * benchMiniBatch
+ * Função: Compara o k-means em mini-lotes (KMeans::trainMiniBatch, frames sorteados direto dos arquivos) com o
+ *         k-means completo (KMeans::train) na base de dados: erro de quantização médio em todos os frames, tempo
+ *         e memória dos frames de cada um. Depois interrompe o treino na metade, retoma do checkpoint e verifica
+ *         se o codebook é o mesmo do treino sem interrupção.
+ *
+ * In: int clusters (Tamanho do codebook)
+ * In: int batchSize (Frames por lote)
+ * In: int batches (Número de lotes)
+ */
+int benchMiniBatch(int clusters, int batchSize, int batches){
+    vector<Centroids> points;
+    loadBenchFrames(points);
+    vector<string> files;
+    for(int g = 0; g < GESTURE_COUNT; g++)
+        files.push_back("./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt");
+    FrameSampler sampler(files);
+    if(points.empty() || !sampler.isOpen())
+        return -1;
+
+    KMeans full;
+    Clock::time_point start = Clock::now();
+    full.train(points, clusters, 1, 42, 300, 1e-4, KMEANS_HAMERLY);
+    double fullSeconds = secondsSince(start);
+    double fullError = meanSquaredError(points, full);
+
+    KMeans mini;
+    start = Clock::now();
+    if(!mini.trainMiniBatch(sampler, clusters, batchSize, batches, 42))
+        return -1;
+    double miniSeconds = secondsSince(start);
+    double miniError = meanSquaredError(points, mini);
+
+    cout << "Method		Frames		Memory		Seconds	MSE" << endl;
+    cout << "Full batch	" << points.size() << "		" << points.size() * sizeof(Centroids) / 1024.0 << " KB	"
+         << fullSeconds << "	" << fullError << endl;
+    cout << "Mini-batch	" << (long long)batchSize * batches << "		" << 3 * batchSize * sizeof(Centroids) / 1024.0 << " KB	"
+         << miniSeconds << "	" << miniError << " (" << miniError / fullError << "x)" << endl;
+
+    //Treino interrompido na metade e retomado do checkpoint
+    string checkpoint = "minibatch.checkpoint";
+    remove(checkpoint.c_str());
+    KMeans first, resumed;
+    first.trainMiniBatch(sampler, clusters, batchSize, batches / 2, 42, checkpoint);
+    resumed.trainMiniBatch(sampler, clusters, batchSize, batches, 42, checkpoint);
+    remove(checkpoint.c_str());
+    bool same = true;
+    vector<Centroids> &a = *mini.returnCentroids(), &b = *resumed.returnCentroids();
+    for(size_t c = 0; c < a.size(); c++)
+        same = same && KMeans::squaredDistance(a[c], b[c]) == 0;
+    cout << "Resumed from batch " << batches / 2 << ": " << (same ? "same codebook" : "different codebook") << endl;
+    return 0;
+}
+
+
+/**
+ * nearestReference
+ * Função: GetNearestCluster como era antes do layout de busca (vector<Centroids>, sqrt e distância inicial 10000),
+ *         como referência de tempo e de resultado
+ */
+int nearestReference(vector<Centroids> &codebook, const Centroids &coordinates){
+    int clstNumb = 0, currClst = 0;
+    float minDst = 10000;
+    for(vector<Centroids>::iterator cluster = codebook.begin(); cluster != codebook.end(); ++cluster){
+        float dXr = (*cluster).rightVectorX - coordinates.rightVectorX;                 dXr *= dXr;
+        float dYr = (*cluster).rightVectorY - coordinates.rightVectorY;                 dYr *= dYr;
+        float dZr = (*cluster).rightVectorZ - coordinates.rightVectorZ;                 dZr *= dZr;
+        float dHCr = (*cluster).rightHandConfiguration - coordinates.rightHandConfiguration;   dHCr *= dHCr;
+        float dXl = (*cluster).leftVectorX - coordinates.leftVectorX;                   dXl *= dXl;
+        float dYl = (*cluster).leftVectorY - coordinates.leftVectorY;                   dYl *= dYl;
+        float dZl = (*cluster).leftVectorZ - coordinates.leftVectorZ;                   dZl *= dZl;
+        float dHCl = (*cluster).leftHandConfiguration - coordinates.leftHandConfiguration;     dHCl *= dHCl;
+        float d = sqrt(dXr + dYr + dZr + dHCr + dXl + dYl + dZl + dHCl);
+        if(d < minDst){
+            minDst = d;
+            clstNumb = currClst;
+        }
+        currClst++;
+    }
+    return clstNumb;
+}
+
+
+/**
+ * benchCodebook
+ * Função: Codebook distribuído com clusters centroides ou, se não existe, um treinado nos frames da base de dados
+ *
+ * In: int clusters (Tamanho do codebook)
+ * In: vector<Centroids> &points (Frames da base de dados)
+ *
+ * Out: KMeans *codebook
+ */
+KMeans* benchCodebook(int clusters, const vector<Centroids> &points){
+    KMeans *codebook = loadBenchCodebook(clusters);
+    if(codebook == NULL || codebook->getClusterNumber() != clusters){
+        delete codebook;
+        codebook = new KMeans();
+        codebook->train(points, clusters, 1, 42, 300, 1e-4);
+    }
+    return codebook;
+}
+
+
+/**
+ * benchNearest
+ * Função: Mede a busca do centroide mais próximo (KMeans::GetNearestCluster) com codebooks de 16, 32, 64 e 256
+ *         centroides: a busca antiga sobre vector<Centroids>, o layout em blocos sem e com AVX, e quantos frames
+ *         recebem o mesmo símbolo da busca antiga. Os codebooks distribuídos são usados quando existem; os outros
+ *         são treinados na base de dados.
+ *
+ * In: int repeat (Passadas pelos frames da base de dados)
+ */
+int benchNearest(int repeat){
+    vector<Centroids> points;
+    loadBenchFrames(points);
+    if(points.empty())
+        return -1;
+    int sizes[4] = {16, 32, 64, 256};
+    long long checksum = 0;
+    cout << "Clusters\tReference ns\tScalar ns\tAVX ns\tSpeedup\tSameSymbol" << endl;
+    for(int s = 0; s < 4; s++){
+        KMeans *codebook = benchCodebook(sizes[s], points);
+        vector<Centroids> &centers = *codebook->returnCentroids();
+        long long frames = (long long)points.size() * repeat;
+
+        Clock::time_point start = Clock::now();
+        for(int r = 0; r < repeat; r++)
+            for(size_t i = 0; i < points.size(); i++)
+                checksum += nearestReference(centers, points[i]);
+        double reference = secondsSince(start) * 1e9 / frames;
+
+        start = Clock::now();
+        for(int r = 0; r < repeat; r++)
+            for(size_t i = 0; i < points.size(); i++)
+                checksum += codebook->GetNearestClusterScalar(points[i]);
+        double scalar = secondsSince(start) * 1e9 / frames;
+
+        start = Clock::now();
+        for(int r = 0; r < repeat; r++)
+            for(size_t i = 0; i < points.size(); i++)
+                checksum += codebook->GetNearestCluster(points[i]);
+        double vectorized = secondsSince(start) * 1e9 / frames;
+
+        int same = 0;
+        for(size_t i = 0; i < points.size(); i++)
+            same += nearestReference(centers, points[i]) == codebook->GetNearestCluster(points[i]) &&
+                    codebook->GetNearestCluster(points[i]) == codebook->GetNearestClusterScalar(points[i]);
+        cout << sizes[s] << "\t\t" << reference << "\t\t" << scalar << "\t\t" << vectorized << "\t" << reference / vectorized << "x\t"
+             << same << "/" << points.size() << endl;
+        delete codebook;
+    }
+    cout << "(checksum " << checksum << ")" << endl;
+    return 0;
+}
+
+
+/**
+ * benchQuantize
+ * Função: Mede a quantização em lote (KMeans::quantize) de uma base sintética de frames com codebooks de 16, 64 e
+ *         256 centroides, contra GetNearestCluster frame a frame: tempo com 1 e com threads threads, frames
+ *         decididos pela distância exata e se todos os símbolos são iguais.
+ *
+ * In: int frames (Frames da base sintética)
+ * In: int threads (Número de threads)
+ */
+int benchQuantize(int frames, int threads){
+    vector<Centroids> points, synthetic;
+    loadBenchFrames(points);
+    if(points.empty())
+        return -1;
+    buildBenchFrames(points, frames, 42, synthetic);
+    int sizes[3] = {16, 64, 256};
+    cout << "Clusters\tPerFrame s\tBatch s\tBatch s (" << threads << " threads)\tFallbacks\tSameSymbols" << endl;
+    for(int s = 0; s < 3; s++){
+        KMeans *codebook = benchCodebook(sizes[s], points);
+        vector<int> reference(synthetic.size()), single, parallel;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < synthetic.size(); i++)
+            reference[i] = codebook->GetNearestCluster(synthetic[i]);
+        double perFrame = secondsSince(start);
+
+        start = Clock::now();
+        long long fallbacks = codebook->quantize(synthetic, single, 1);
+        double batch = secondsSince(start);
+
+        start = Clock::now();
+        codebook->quantize(synthetic, parallel, threads);
+        double batchParallel = secondsSince(start);
+
+        cout << sizes[s] << "\t\t" << perFrame << "\t" << batch << "\t" << batchParallel << "\t\t\t" << fallbacks << "\t\t"
+             << (single == reference && parallel == reference ? "yes" : "no") << endl;
+        delete codebook;
+    }
+    return 0;
+}
+
+
+/**
+ * benchTree
+ * Função: Compara a busca pela árvore (KMeans::trainTree) com a busca exata nas mesmas folhas, para codebooks de
+ *         256 a 4096 símbolos treinados com k-means hierárquico em uma base sintética de frames frames. Nos frames
+ *         da base de dados mostra o tempo por frame e o erro de quantização médio de cada busca, e quantos frames
+ *         recebem o mesmo símbolo nas duas.
+ *
+ * In: int frames (Frames da base sintética de treino)
+ * In: int repeat (Passadas pelos frames da base de dados nas medidas de tempo)
+ */
+int benchTree(int frames, int repeat){
+    vector<Centroids> points, synthetic;
+    loadBenchFrames(points);
+    if(points.empty())
+        return -1;
+    buildBenchFrames(points, frames, 42, synthetic);
+    int configs[4][2] = {{16, 2}, {32, 2}, {16, 3}, {64, 2}};
+    long long checksum = 0;
+    cout << "Branching\tDepth\tLeaves\tBuild s\tFlat ns\tFlat MSE\tTree ns\tTree MSE\tSameSymbol" << endl;
+    for(int k = 0; k < 4; k++){
+        KMeans codebook;
+        Clock::time_point start = Clock::now();
+        int leaves = codebook.trainTree(synthetic, configs[k][0], configs[k][1], 1, 42);
+        double build = secondsSince(start);
+        vector<Centroids> &centers = *codebook.returnCentroids();
+
+        double ns[2], error[2];
+        vector<int> symbols[2];
+        KMeansSearch modes[2] = {KMEANS_SEARCH_FLAT, KMEANS_SEARCH_TREE};
+        for(int m = 0; m < 2; m++){
+            codebook.setSearch(modes[m]);
+            start = Clock::now();
+            for(int r = 0; r < repeat; r++)
+                for(size_t i = 0; i < points.size(); i++)
+                    checksum += codebook.GetNearestCluster(points[i]);
+            ns[m] = secondsSince(start) * 1e9 / ((double)points.size() * repeat);
+            error[m] = 0;
+            for(size_t i = 0; i < points.size(); i++){
+                symbols[m].push_back(codebook.GetNearestCluster(points[i]));
+                error[m] += KMeans::squaredDistance(points[i], centers[symbols[m].back()]);
+            }
+            error[m] /= points.size();
+        }
+        int same = 0;
+        for(size_t i = 0; i < points.size(); i++)
+            same += symbols[0][i] == symbols[1][i];
+        cout << configs[k][0] << "\t\t" << configs[k][1] << "\t" << leaves << "\t" << build << "\t" << ns[0] << "\t"
+             << error[0] << "\t\t" << ns[1] << "\t" << error[1] << "\t\t" << same * 100.0 / points.size() << "%" << endl;
+    }
+    cout << "(checksum " << checksum << ")" << endl;
+    return 0;
+}
+
+
+/**
+ * benchKDTree
+ * Função: Compara a busca exata pela KD-tree com a busca linear (AVX) para codebooks de 16 a 4096 centroides,
+ *         treinados com k-means em uma base sintética de frames frames, para achar o tamanho a partir do qual a
+ *         KD-tree compensa (KMEANS_KDTREE_CLUSTERS). Nos frames da base de dados mostra o tempo por frame de cada
+ *         busca, frame a frame e em lote (KMeans::quantize), e se os símbolos são os mesmos.
+ *
+ * In: int frames (Frames da base sintética de treino)
+ * In: int repeat (Passadas pelos frames da base de dados nas medidas de tempo)
+ */
+int benchKDTree(int frames, int repeat){
+    vector<Centroids> points, synthetic;
+    loadBenchFrames(points);
+    if(points.empty())
+        return -1;
+    buildBenchFrames(points, frames, 42, synthetic);
+    long long checksum = 0;
+    cout << "Clusters\tFlat ns\tKD-tree ns\tSpeedup\tBatch flat ns\tBatch KD-tree ns\tSameSymbols" << endl;
+    for(int clusters = 16; clusters <= 4096; clusters *= 2){
+        KMeans codebook;
+        codebook.train(synthetic, clusters, 0, 42, 20, 1e-4);
+
+        double ns[2], batch[2];
+        vector<int> symbols[2], batchSymbols[2];
+        KMeansSearch modes[2] = {KMEANS_SEARCH_FLAT, KMEANS_SEARCH_KDTREE};
+        for(int m = 0; m < 2; m++){
+            codebook.setSearch(modes[m]);
+            Clock::time_point start = Clock::now();
+            for(int r = 0; r < repeat; r++)
+                for(size_t i = 0; i < points.size(); i++)
+                    checksum += codebook.GetNearestCluster(points[i]);
+            ns[m] = secondsSince(start) * 1e9 / ((double)points.size() * repeat);
+
+            start = Clock::now();
+            for(int r = 0; r < repeat; r++)
+                codebook.quantize(points, batchSymbols[m], 1);
+            batch[m] = secondsSince(start) * 1e9 / ((double)points.size() * repeat);
+            for(size_t i = 0; i < points.size(); i++)
+                symbols[m].push_back(codebook.GetNearestCluster(points[i]));
+        }
+        bool same = symbols[0] == symbols[1] && batchSymbols[0] == symbols[0] && batchSymbols[1] == symbols[0];
+        cout << clusters << "\t\t" << ns[0] << "\t" << ns[1] << "\t\t" << ns[0] / ns[1] << "x\t" << batch[0] << "\t\t"
+             << batch[1] << "\t\t\t" << (same ? "yes" : "no") << endl;
+    }
+    cout << "(checksum " << checksum << ")" << endl;
+    return 0;
+}
+
+
+/**
+ * benchCoherent
+ * Função: Mede a busca que começa pelo símbolo do frame anterior (KMeans::coherentNearest) e a quantização em
+ *         fluxo (StreamingQuantizer, que só a usa a partir de KMEANS_COHERENT_CLUSTERS centroides) contra
+ *         GetNearestCluster frame a frame, nos frames da base de dados na ordem gravada, com codebooks de 16 a 1024
+ *         centroides: tempo por frame, distâncias calculadas por frame e se os símbolos são os mesmos.
+ *
+ * In: int repeat (Passadas pelos frames nas medidas de tempo)
+ */
+int benchCoherent(int repeat){
+    vector<Centroids> points;
+    loadBenchFrames(points);
+    if(points.empty())
+        return -1;
+    int sizes[5] = {16, 32, 64, 256, 1024};
+    long long checksum = 0;
+    cout << "Clusters\tGetNearest ns\tCoherent ns\tDistances/frame\tStreaming ns\tDistances/frame\tSameSymbols" << endl;
+    for(int s = 0; s < 5; s++){
+        KMeans *codebook = benchCodebook(sizes[s], points);
+        vector<int> reference(points.size()), streamed(points.size());
+        Clock::time_point start = Clock::now();
+        for(int r = 0; r < repeat; r++)
+            for(size_t i = 0; i < points.size(); i++)
+                checksum += reference[i] = codebook->GetNearestCluster(points[i]);
+        double nearest = secondsSince(start) * 1e9 / ((double)points.size() * repeat);
+
+        vector<int> coherent(points.size());
+        long long distances = 0;
+        start = Clock::now();
+        for(int r = 0; r < repeat; r++){
+            int previous = -1;
+            for(size_t i = 0; i < points.size(); i++)
+                checksum += coherent[i] = previous = codebook->coherentNearest(previous, points[i], distances);
+        }
+        double neighbors = secondsSince(start) * 1e9 / ((double)points.size() * repeat);
+
+        StreamingQuantizer quantizer(codebook);
+        start = Clock::now();
+        for(int r = 0; r < repeat; r++){
+            quantizer.reset();
+            for(size_t i = 0; i < points.size(); i++)
+                checksum += streamed[i] = quantizer.push(points[i]);
+        }
+        double streaming = secondsSince(start) * 1e9 / ((double)points.size() * repeat);
+
+        cout << sizes[s] << "\t\t" << nearest << "\t\t" << neighbors << "\t\t" << (double)distances / ((double)points.size() * repeat)
+             << "\t\t" << streaming << "\t\t" << quantizer.averageDistances() << "\t\t"
+             << (streamed == reference && coherent == reference ? "yes" : "no") << endl;
+        delete codebook;
+    }
+    cout << "(checksum " << checksum << ")" << endl;
+    return 0;
+}
+
+
+/**
+ * benchLookup
+ * Função: Mede a quantização por tabela (LookupQuantizer) contra GetNearestCluster com codebooks de 16 a 256
+ *         centroides: tamanho e tempo de montagem da tabela, fração das células e dos frames resolvidos só pela
+ *         tabela, tempo por frame e quantos frames recebem o mesmo símbolo. A tabela é montada com os frames da base
+ *         de dados e avaliada neles e em uma base sintética com ruído (frames que não estavam na montagem).
+ *
+ * In: int cells (Número máximo de células da tabela)
+ * In: int repeat (Passadas pelos frames nas medidas de tempo)
+ */
+int benchLookup(int cells, int repeat){
+    vector<Centroids> points, synthetic;
+    loadBenchFrames(points);
+    if(points.empty())
+        return -1;
+    buildBenchFrames(points, points.size(), 7, synthetic);
+    for(size_t i = 0; i < synthetic.size(); i++){
+        //As configurações de mão dos frames reais são sempre inteiras
+        synthetic[i].rightHandConfiguration = round(synthetic[i].rightHandConfiguration);
+        synthetic[i].leftHandConfiguration = round(synthetic[i].leftHandConfiguration);
+    }
+    int sizes[4] = {16, 32, 64, 256};
+    long long checksum = 0;
+    cout << "Clusters\tTable MB\tBuild s\tResolved cells\tFrames\t\tTable hits\tGetNearest ns\tLookup ns\tSameSymbols" << endl;
+    for(int s = 0; s < 4; s++){
+        KMeans *codebook = benchCodebook(sizes[s], points);
+        Clock::time_point start = Clock::now();
+        LookupQuantizer lookup(codebook, points, cells);
+        double build = secondsSince(start);
+
+        const vector<Centroids> *sets[2] = {&points, &synthetic};
+        const char *names[2] = {"dataset", "synthetic"};
+        for(int d = 0; d < 2; d++){
+            const vector<Centroids> &frames = *sets[d];
+            vector<int> reference(frames.size()), looked(frames.size());
+            start = Clock::now();
+            for(int r = 0; r < repeat; r++)
+                for(size_t i = 0; i < frames.size(); i++)
+                    checksum += reference[i] = codebook->GetNearestCluster(frames[i]);
+            double nearest = secondsSince(start) * 1e9 / ((double)frames.size() * repeat);
+
+            lookup.resetStatistics();
+            for(size_t i = 0; i < frames.size(); i++)
+                looked[i] = lookup.quantize(frames[i]);
+            double hits = 1 - lookup.fallbackRate();
+            start = Clock::now();
+            for(int r = 0; r < repeat; r++)
+                for(size_t i = 0; i < frames.size(); i++)
+                    checksum += lookup.quantize(frames[i]);
+            double table = secondsSince(start) * 1e9 / ((double)frames.size() * repeat);
+
+            long long same = 0;
+            for(size_t i = 0; i < frames.size(); i++)
+                same += looked[i] == reference[i];
+            if(d == 0)
+                cout << sizes[s] << "\t\t" << lookup.getTableBytes() / 1048576.0 << "\t\t" << build << "\t" << lookup.resolvedCells() * 100 << "%\t\t";
+            else
+                cout << "\t\t\t\t\t\t\t\t";
+            cout << names[d] << "\t" << hits * 100 << "%\t\t" << nearest << "\t\t" << table << "\t\t"
+                 << same * 100.0 / frames.size() << "%" << endl;
+        }
+        delete codebook;
+    }
+    cout << "(checksum " << checksum << ")" << endl;
+    return 0;
+}
+
+
+/**
+ * productAccuracy
+ * Função: Treina um HMM por gesto (LOOT, uma a cada 5 sequências separada para validação) sobre os símbolos já
+ *         quantizados de cada gesto e devolve a fração das sequências de validação reconhecidas
+ *
+ * In: vector<int> *symbols (Símbolos dos frames de cada gesto)
+ * In: int alphabet (Número de símbolos)
+ * In: int leftSymbols (Se > 0, HMM::setProductAlphabet(leftSymbols))
+ * In: int stateNumber, int iterations (Estados e passadas do treinamento)
+ */
+double productAccuracy(const vector<int> *symbols, int alphabet, int leftSymbols, int stateNumber, int iterations){
+    vector<Mat> test[GESTURE_COUNT];
+    vector<HMM*> models;
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        vector<Mat> train;
+        int sequences = symbols[g].size() / GESTURE_SIZE;
+        for(int s = 0; s < sequences; s++){
+            Mat seq(1, GESTURE_SIZE, cvhmmSymbolDepth(alphabet));
+            cvhmmStoreSymbols(&symbols[g][s * GESTURE_SIZE], GESTURE_SIZE, seq.ptr(0), seq.depth());
+            (s % 5 == 4 ? test[g] : train).push_back(seq);
+        }
+        HMM *model = new HMM(HMM_ToFileName(intToHMM(g)) + ".hmm", alphabet, stateNumber, false);
+        if(leftSymbols > 0)
+            model->setProductAlphabet(leftSymbols);
+        CvHMMLootSource loot(train);
+        model->train(loot, iterations);
+        models.push_back(model);
+    }
+    int hits = 0, total = 0;
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        for(size_t s = 0; s < test[g].size(); s++){
+            int best = 0;
+            double bestLogp = -DBL_MAX;
+            for(int m = 0; m < GESTURE_COUNT; m++){
+                double logp = models[m]->validate(test[g][s]);
+                if(logp > bestLogp){
+                    bestLogp = logp;
+                    best = m;
+                }
+            }
+            hits += best == g;
+            total++;
+        }
+    }
+    for(int g = 0; g < GESTURE_COUNT; g++)
+        delete models[g];
+    return total > 0 ? (double)hits / total : 0;
+}
+
+
+/**
+ * benchProduct
+ * Função: Compara codebooks conjuntos de 16, 64 e 256 centroides com os codebooks por mão (ProductQuantizer) de
+ *         4x4, 8x8 e 16x16, que têm o mesmo número de símbolos: erro de quantização médio nos frames da base de
+ *         dados, tempo por frame da quantização e acerto dos HMMs na validação, com a emissão fatorada por mão
+ *         (HMM::setProductAlphabet) e com a emissão comum sobre os pares.
+ *
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int iterations (Passadas do treinamento dos HMMs)
+ */
+int benchProduct(int stateNumber, int iterations){
+    vector<Centroids> frames[GESTURE_COUNT], points;
+    KMeans reader;
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        reader.readTrainingFrames("./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt", frames[g]);
+        points.insert(points.end(), frames[g].begin(), frames[g].end());
+    }
+    if(points.empty())
+        return -1;
+    int repeat = 20;
+    long long checksum = 0;
+    cout << "Codebook\tSymbols\tMSE\t\tns/frame\tAccuracy\tFactored accuracy" << endl;
+    for(int side = 4; side <= 16; side *= 2){
+        int symbols = side * side;
+        KMeans joint;
+        joint.train(points, symbols, 1, 42, 300, 1e-4);
+        ProductQuantizer product;
+        product.train(points, side, side, 1, 42, 300, 1e-4);
+
+        vector<int> jointSymbols[GESTURE_COUNT], productSymbols[GESTURE_COUNT];
+        for(int g = 0; g < GESTURE_COUNT; g++){
+            joint.quantize(frames[g], jointSymbols[g], 1);
+            product.quantize(frames[g], productSymbols[g], 1);
+        }
+
+        Clock::time_point start = Clock::now();
+        for(int r = 0; r < repeat; r++)
+            for(size_t i = 0; i < points.size(); i++)
+                checksum += joint.GetNearestCluster(points[i]);
+        double jointNs = secondsSince(start) * 1e9 / ((double)points.size() * repeat);
+        start = Clock::now();
+        for(int r = 0; r < repeat; r++)
+            for(size_t i = 0; i < points.size(); i++)
+                checksum += product.GetNearestCluster(points[i]);
+        double productNs = secondsSince(start) * 1e9 / ((double)points.size() * repeat);
+
+        //Erro de quantização do par de centroides; o lote (quantize) deve dar os mesmos símbolos de GetNearestCluster
+        double productError = 0;
+        bool same = true;
+        for(int g = 0; g < GESTURE_COUNT; g++){
+            for(size_t i = 0; i < frames[g].size(); i++){
+                int symbol = product.GetNearestCluster(frames[g][i]);
+                productError += KMeans::squaredDistance(frames[g][i], product.reconstruct(symbol));
+                same = same && symbol == productSymbols[g][i];
+            }
+        }
+        productError /= points.size();
+        if(!same)
+            cout << "product " << side << "x" << side << ": quantize and GetNearestCluster differ" << endl;
+
+        cout << "joint " << symbols << "\t" << symbols << "\t" << meanSquaredError(points, joint) << "\t\t" << jointNs << "\t\t"
+             << productAccuracy(jointSymbols, symbols, 0, stateNumber, iterations) * 100 << "%\t\t-" << endl;
+        cout << "product " << side << "x" << side << "\t" << symbols << "\t" << productError << "\t\t" << productNs << "\t\t"
+             << productAccuracy(productSymbols, symbols, 0, stateNumber, iterations) * 100 << "%\t\t"
+             << productAccuracy(productSymbols, symbols, side, stateNumber, iterations) * 100 << "%" << endl;
+    }
+    cout << "(checksum " << checksum << ")" << endl;
+    return 0;
+}
+
+
+/**
+ * NullBuffer
+ * Descarta o que é escrito, depois da formatação: faz o papel do terminal para as mensagens de validateAll
+ */
+class NullBuffer : public streambuf{
+    protected:
+        int overflow(int c){ return c; }
+};
+
+
+/**
+ * toFrame
+ * Função: Converte um frame do dataset no Frame que main.cpp grava
+ */
+Frame toFrame(const Centroids &point){
+    Frame frame;
+    frame.rightVectorX = point.rightVectorX;
+    frame.rightVectorY = point.rightVectorY;
+    frame.rightVectorZ = point.rightVectorZ;
+    frame.handConfigurationRight = (int)point.rightHandConfiguration;
+    frame.leftVectorX = point.leftVectorX;
+    frame.leftVectorY = point.leftVectorY;
+    frame.leftVectorZ = point.leftVectorZ;
+    frame.handConfigurationLeft = (int)point.leftHandConfiguration;
+    return frame;
+}
+
+
+/**
+ * simulateGesture
+ * Função: Um gesto no caminho ao vivo padrão de main.cpp (sem USE_SPOTTING, USE_SLIDING_WINDOWS e
+ *         USE_EARLY_DECISION): os frames de frames[first, first+length) entram no buffer de gravação, a janela é
+ *         quantizada por realTimeObservations e validada como em validateAll (recognize com as LIVE_N_BEST
+ *         melhores hipóteses, que são escritas em out como validateAll as escreve em cout)
+ *
+ * Out: int gesture (Índice do gesto reconhecido)
+ */
+int simulateGesture(KMeans *codebook, vector<HMM*> &models, const vector<Centroids> &frames, int first, int length,
+                    vector<Frame> &frameBuffer, Mat &observation, QuantizationScratch &scratch,
+                    RecognitionResult &recognition, ostream &out){
+    frameBuffer.clear();
+    for(int i = first; i < first + length; i++)
+        frameBuffer.push_back(toFrame(frames[i]));
+    codebook->realTimeObservations(frameBuffer, frameBuffer.size(), observation, scratch);
+
+    recognize(models, observation, LIVE_N_BEST, recognition);
+    for(vector<GestureHypothesis>::iterator it = recognition.hypotheses.begin(); it != recognition.hypotheses.end(); ++it)
+        out << (*it).model << ": " << (*it).logp << " (" << (*it).normalizedLogp << "/frame)" << endl;
+    out << "Margin: " << recognition.margin << endl;
+    frameBuffer.clear();
+    return recognition.best();
+}
+
+
+/**
+ * benchLive
+ * Função: Simula gestures gestos do caminho ao vivo padrão de main.cpp (gravação, realTimeObservations e
+ *         validateAll com os modelos de codebook 16 e 9 estados) e conta as alocações de heap depois do primeiro
+ *         gesto. Confere que os símbolos são os de GetNearestCluster e que o gesto reconhecido é o de
+ *         CvHMM::decode, e mede também o StreamingQuantizer (usado por USE_SPOTTING, USE_SLIDING_WINDOWS e
+ *         USE_EARLY_DECISION) e a versão de realTimeObservations que aloca a matriz a cada gesto.
+ *
+ * In: int gestures (Número de gestos simulados)
+ */
+int benchLive(int gestures){
+    vector<Centroids> points;
+    loadBenchFrames(points);
+    KMeans *codebook = benchCodebook(16, points);
+    vector<HMM*> models;
+    if(points.size() < 80 || !loadGestureModels(16, 9, models))
+        return -1;
+    QuantizationScratch scratch;
+    vector<Frame> frameBuffer;
+    Mat observation;
+    RecognitionResult recognition;
+    NullBuffer discard;
+    ostream out(&discard);
+    mt19937 rng(42);
+    uniform_int_distribution<int> length(20, 80), first(0, points.size() - 80);
+    long long checksum = simulateGesture(codebook, models, points, 0, 80, frameBuffer, observation, scratch, recognition, out);
+
+    //Símbolos e gesto reconhecido
+    bool same = true;
+    for(int g = 0; g < 1000; g++){
+        int n = length(rng), f = first(rng);
+        int gesture = simulateGesture(codebook, models, points, f, n, frameBuffer, observation, scratch, recognition, out);
+        for(int i = 0; i < n; i++)
+            same = same && cvhmmSymbol(observation, 0, i) == codebook->GetNearestCluster(points[f + i]);
+        int best = 0;
+        double bestLogp = -DBL_MAX;
+        for(size_t m = 0; m < models.size(); m++){
+            Mat TRANS, EMIS, INIT;
+            models[m]->getTransitionMatrix(TRANS);
+            models[m]->getEmissionMatrix(EMIS);
+            models[m]->getInitialMatrix(INIT);
+            CvHMMDecoding decoding;
+            CvHMM::decode(observation, TRANS, EMIS, INIT, CVHMM_LIKELIHOOD, decoding);
+            if(decoding.logpseq > bestLogp){
+                bestLogp = decoding.logpseq;
+                best = m;
+            }
+        }
+        same = same && gesture == best;
+    }
+
+    long allocations0 = g_allocations, frees0 = g_frees;
+    long long frames = 0;
+    Clock::time_point start = Clock::now();
+    for(int g = 0; g < gestures; g++){
+        int n = length(rng);
+        checksum += simulateGesture(codebook, models, points, first(rng), n, frameBuffer, observation, scratch, recognition, out);
+        frames += n;
+    }
+    double seconds = secondsSince(start);
+    long allocations = g_allocations - allocations0, frees = g_frees - frees0;
+
+    //StreamingQuantizer, frame a frame
+    StreamingQuantizer streaming(codebook);
+    Frame frame = toFrame(points[0]);
+    streaming.push(frame);
+    long streamingAllocations0 = g_allocations, streamingFrees0 = g_frees;
+    for(int g = 0; g < gestures; g++){
+        int n = length(rng), f = first(rng);
+        streaming.reset();
+        for(int i = f; i < f + n; i++){
+            frame = toFrame(points[i]);
+            checksum += streaming.push(frame);
+        }
+    }
+    long streamingAllocations = g_allocations - streamingAllocations0, streamingFrees = g_frees - streamingFrees0;
+
+    //Versão que aloca a matriz a cada gesto
+    int legacyGestures = min(gestures, 10000);
+    Mat legacy;
+    allocations0 = g_allocations;
+    frees0 = g_frees;
+    for(int g = 0; g < legacyGestures; g++){
+        int n = length(rng), f = first(rng);
+        frameBuffer.clear();
+        for(int i = f; i < f + n; i++)
+            frameBuffer.push_back(toFrame(points[i]));
+        codebook->realTimeObservations(&frameBuffer, frameBuffer.size(), legacy);
+        checksum += cvhmmSymbol(legacy, 0, 0);
+    }
+    legacy.release();
+    long legacyAllocations = g_allocations - allocations0, legacyFrees = g_frees - frees0;
+
+    cout << gestures << " gestures, " << frames << " frames: " << seconds * 1e9 / frames << " ns/frame, "
+         << allocations << " allocations, " << frees << " frees, symbols and gestures " << (same ? "match" : "differ") << endl;
+    cout << "StreamingQuantizer: " << streamingAllocations << " allocations, " << streamingFrees << " frees" << endl;
+    cout << "Without scratch: " << (double)legacyAllocations / legacyGestures << " allocations/gesture, "
+         << legacyAllocations - legacyFrees << " blocks not freed after " << legacyGestures << " gestures" << endl;
+    cout << "(checksum " << checksum << ")" << endl;
+    for(size_t m = 0; m < models.size(); m++)
+        delete models[m];
+    delete codebook;
+    return allocations == 0 && frees == 0 && streamingAllocations == 0 && streamingFrees == 0 && same ? 0 : -1;
+}
+
+
+/**
+ * benchSymbols
+ * Função: Compara as observações guardadas em 32, 16 e 8 bits (cvhmmSymbolDepth escolhe o menor tipo que cabe o
+ *         codebook): memória da matriz LOOT, tempo do treinamento a partir do mesmo modelo inicial e tempo do
+ *         forward sobre as sequências da base de dados. Os modelos e os log[P(O|y)] devem ser idênticos aos de 32 bits.
+ *
+ * In: int codebookSize (Tamanho do codebook)
+ * In: int stateNumber (Número de estados dos modelos)
+ * In: int repeat (Quantas vezes cada modelo é treinado e cada sequência é avaliada)
+ */
+int benchSymbols(int codebookSize, int stateNumber, int repeat){
+    KMeans *codebook = loadBenchCodebook(codebookSize);
+    if(codebook == NULL)
+        return -1;
+
+    int depths[] = {CV_32S, CV_16U, CV_8U};
+    const char *names[] = {"32 bits", "16 bits", "8 bits"};
+    int types = codebookSize <= 256 ? 3 : codebookSize <= 65536 ? 2 : 1;
+    double lootKB[3] = {0, 0, 0}, trainSeconds[3] = {0, 0, 0}, decodeSeconds[3] = {0, 0, 0}, maxDiff = 0;
+    long decodes = 0;
+    CvHMMWorkspace workspace;
+    vector<double> work(2 * stateNumber);
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        Mat seq, subSeq;
+        string filename = "./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt";
+        codebook->getGestureObservationsFromTrainingData(filename, GESTURE_SIZE, seq, subSeq);
+
+        HMM initial(HMM_ToFileName(intToHMM(g)) + ".hmm", codebook->getClusterNumber(), stateNumber, false);
+        Mat TRANS0, EMIS0, INIT0;
+        initial.getTransitionMatrix(TRANS0);
+        initial.getEmissionMatrix(EMIS0);
+        initial.getInitialMatrix(INIT0);
+
+        Mat TRANS[3], EMIS[3], INIT[3];
+        vector<double> logps[3];
+        for(int d = 0; d < types; d++){
+            Mat typed(seq.rows, seq.cols, depths[d]), loot;
+            for(int r = 0; r < seq.rows; r++)
+                for(int t = 0; t < seq.cols; t++)
+                    cvhmmSetSymbol(typed, r, t, cvhmmSymbol(seq, r, t));
+            codebook->lootStrategy(typed, loot);
+            lootKB[d] += loot.total() * loot.elemSize() / 1024.0;
+
+            for(int i = 0; i < repeat; i++){
+                TRANS[d] = TRANS0.clone();
+                EMIS[d] = EMIS0.clone();
+                INIT[d] = INIT0.clone();
+                Clock::time_point start = Clock::now();
+                CvHMM::train(loot, MAX_ITER, TRANS[d], EMIS[d], INIT[d], workspace);
+                trainSeconds[d] += secondsSince(start);
+            }
+
+            Mat T = TRANS[d].clone(), E = EMIS[d].clone(), I = INIT[d].clone();
+            CvHMM::correctModel(T, E, I);
+            HMMModelSpan model = hmmModelSpan(T, E, I);
+            logps[d].assign(loot.rows, 0);
+            Clock::time_point start = Clock::now();
+            for(int i = 0; i < repeat; i++)
+                for(int r = 0; r < loot.rows; r++)
+                    logps[d][r] = hmmForwardLikelihood(model, loot.row(r), loot.cols, &work[0]);
+            decodeSeconds[d] += secondsSince(start);
+            if(d == 0)
+                decodes += (long)repeat * loot.rows;
+
+            maxDiff = max(maxDiff, norm(TRANS[0], TRANS[d], NORM_INF));
+            maxDiff = max(maxDiff, norm(EMIS[0], EMIS[d], NORM_INF));
+            maxDiff = max(maxDiff, norm(INIT[0], INIT[d], NORM_INF));
+            for(int r = 0; r < loot.rows; r++)
+                maxDiff = max(maxDiff, fabs(logps[0][r] - logps[d][r]));
+        }
+    }
+
+    cout << "Symbols		LOOT KB	ms/train	us/forward" << endl;
+    for(int d = 0; d < types; d++)
+        cout << names[d] << "		" << lootKB[d] << "	" << trainSeconds[d]*1000/repeat << "		" << decodeSeconds[d]*1e6/decodes << endl;
+    int chosen = 0;
+    for(int d = 0; d < types; d++)
+        if(depths[d] == cvhmmSymbolDepth(codebookSize))
+            chosen = d;
+    cout << "Codebook of " << codebookSize << " symbols: " << names[chosen] << " by default, max difference " << maxDiff << endl;
+    delete codebook;
+    return maxDiff == 0 ? 0 : -1;
+}
+
+
+int main(int argc, char* argv[]){
+    setlocale(LC_ALL, "C");
+
+    string mode = argc > 1 ? argv[1] : "";
+    if(mode == "train")
+        return benchTrain(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : 100);
+    if(mode == "legacy")
+        return benchLegacyTrain(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : 100);
+    if(mode == "streaming")
+        return benchStreaming(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : 10);
+    if(mode == "prefilter")
+        return benchPrefilter(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9);
+    if(mode == "kernels")
+        return benchKernels(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : 10);
+    if(mode == "sequential")
+        return benchSequential(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : 5);
+    if(mode == "spot")
+        return benchSpot(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : 42);
+    if(mode == "sliding")
+        return benchSliding(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : GESTURE_SIZE);
+    if(mode == "vocabulary")
+        return benchVocabulary(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : 0);
+    if(mode == "kmeans")
+        return benchKMeans(argc > 2 ? atoi(argv[2]) : 64, argc > 3 ? atoi(argv[3]) : 1000000, argc > 4 ? atoi(argv[4]) : defaultThreadCount());
+    if(mode == "minibatch")
+        return benchMiniBatch(argc > 2 ? atoi(argv[2]) : 64, argc > 3 ? atoi(argv[3]) : 1024, argc > 4 ? atoi(argv[4]) : 1000);
+    if(mode == "nearest")
+        return benchNearest(argc > 2 ? atoi(argv[2]) : 50);
+    if(mode == "quantize")
+        return benchQuantize(argc > 2 ? atoi(argv[2]) : 2000000, argc > 3 ? atoi(argv[3]) : defaultThreadCount());
+    if(mode == "tree")
+        return benchTree(argc > 2 ? atoi(argv[2]) : 200000, argc > 3 ? atoi(argv[3]) : 10);
+    if(mode == "kdtree")
+        return benchKDTree(argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 10);
+    if(mode == "coherent")
+        return benchCoherent(argc > 2 ? atoi(argv[2]) : 20);
+    if(mode == "lookup")
+        return benchLookup(argc > 2 ? atoi(argv[2]) : 1 << 22, argc > 3 ? atoi(argv[3]) : 20);
+    if(mode == "product")
+        return benchProduct(argc > 2 ? atoi(argv[2]) : 9, argc > 3 ? atoi(argv[3]) : 20);
+    if(mode == "live")
+        return benchLive(argc > 2 ? atoi(argv[2]) : 100000);
+    if(mode == "symbols")
+        return benchSymbols(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 9, argc > 4 ? atoi(argv[4]) : 10);
+
+    cerr << "Usage: " << argv[0] << " train [codebook] [states] [repeat]" << endl;
+    cerr << "       " << argv[0] << " legacy [codebook] [states] [repeat]" << endl;
+    cerr << "       " << argv[0] << " streaming [codebook] [states] [repeat]" << endl;
+    cerr << "       " << argv[0] << " prefilter [codebook] [states]" << endl;
+    cerr << "       " << argv[0] << " kernels [codebook] [states] [repeat]" << endl;
+    cerr << "       " << argv[0] << " sequential [codebook] [states] [minFrames]" << endl;
+    cerr << "       " << argv[0] << " spot [codebook] [states] [seed]" << endl;
+    cerr << "       " << argv[0] << " sliding [codebook] [states] [length]" << endl;
+    cerr << "       " << argv[0] << " vocabulary [codebook] [states] [poolSize]" << endl;
+    cerr << "       " << argv[0] << " kmeans [clusters] [frames] [threads]" << endl;
+    cerr << "       " << argv[0] << " minibatch [clusters] [batchSize] [batches]" << endl;
+    cerr << "       " << argv[0] << " nearest [repeat]" << endl;
+    cerr << "       " << argv[0] << " quantize [frames] [threads]" << endl;
+    cerr << "       " << argv[0] << " tree [frames] [repeat]" << endl;
+    cerr << "       " << argv[0] << " kdtree [frames] [repeat]" << endl;
+    cerr << "       " << argv[0] << " coherent [repeat]" << endl;
+    cerr << "       " << argv[0] << " lookup [cells] [repeat]" << endl;
+    cerr << "       " << argv[0] << " product [states] [iterations]" << endl;
+    cerr << "       " << argv[0] << " live [gestures]" << endl;
+    cerr << "       " << argv[0] << " symbols [codebook] [states] [repeat]" << endl;
+    return -1;
+}
@@ -0,0 +1,246 @@
+/**
+ * C++ Codebook - Treinamento do codebook (k-means) a partir das bases de dados
+ *
+ * Copyright (c) 2017 Murilo K. Rivabem
+ * All rights reserved.
+ *
+ * Uso: ./codebook <clusters> <output> [threads] [seed] [arquivos...]
+ *      ./codebook 16 Dataset/codebook16.txt     (usa as bases de treino dos 4 gestos)
+ *      ./codebook 64 codebook.txt 8 7 novaBase1.txt novaBase2.txt
+ *
+ *      ./codebook minibatch <clusters> <output> <batchSize> <batches> [checkpoint] [seed] [arquivos...]
+ *      ./codebook minibatch 64 codebook.txt 1024 5000 codebook.checkpoint
+ *      (k-means em mini-lotes: sorteia os frames direto dos arquivos, com memória limitada a alguns lotes; se o
+ *       checkpoint existe o treino continua dele)
+ *
+ *      ./codebook tree <branching> <depth> <output> [threads] [seed] [arquivos...]
+ *      ./codebook tree 16 3 Dataset/codebook4096.txt
+ *      (codebook em árvore com k-means hierárquico: grava as folhas em <output> e a árvore em <output>.tree,
+ *       lida por KMeans::loadTree)
+ *
+ *      ./codebook product <rightClusters> <leftClusters> <output> [threads] [seed] [arquivos...]
+ *      ./codebook product 16 16 Dataset/product16x16
+ *      (um codebook por mão, em <output>.right e <output>.left, lidos por ProductQuantizer::load)
+ *
+*/
+
+//-----------------------------------------------------------------------
+//  Includes
+//-----------------------------------------------------------------------
+#include "HMM.hpp"
+#include <chrono>
+
+//-----------------------------------------------------------------------
+//  Defines
+//-----------------------------------------------------------------------
+#define GESTURE_COUNT 4
+#define MAX_ITER 300
+#define TOLERANCE 1e-4
+
+
+//-----------------------------------------------------------------------
+//  Code
+//-----------------------------------------------------------------------
+
+/**
+ * defaultFiles
+ * Função: Bases de treino dos 4 gestos, usadas quando nenhum arquivo é informado
+ */
+void defaultFiles(vector<string> &files){
+    for(int g = 0; g < GESTURE_COUNT; g++)
+        files.push_back("./Dataset/" + HMM_ToFileName(intToHMM(g)) + "DataTrain.txt");
+}
+
+
+/**
+ * trainMiniBatch
+ * Função: Modo minibatch: treina o codebook com KMeans::trainMiniBatch
+ */
+int trainMiniBatch(int argc, char* argv[]){
+    if(argc < 6){
+        cerr << "Usage: " << argv[0] << " minibatch <clusters> <output> <batchSize> <batches> [checkpoint] [seed] [files...]" << endl;
+        return -1;
+    }
+    int clusters = atoi(argv[2]);
+    string output = argv[3];
+    int batchSize = atoi(argv[4]);
+    int batches = atoi(argv[5]);
+    string checkpoint = argc > 6 ? argv[6] : "";
+    unsigned int seed = argc > 7 ? atoi(argv[7]) : 42;
+
+    vector<string> files;
+    for(int i = 8; i < argc; i++)
+        files.push_back(argv[i]);
+    if(files.empty())
+        defaultFiles(files);
+
+    FrameSampler sampler(files);
+    if(!sampler.isOpen())
+        return -1;
+    KMeans codebook;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if(!codebook.trainMiniBatch(sampler, clusters, batchSize, batches, seed, checkpoint)){
+        cerr << "Error training the codebook." << endl;
+        return -1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if(!codebook.save(output)){
+        cerr << "Error writing " << output << endl;
+        return -1;
+    }
+    cout << batches << " batches of " << batchSize << " frames, " << clusters << " clusters: " << seconds << "s" << endl;
+    return 0;
+}
+
+
+/**
+ * trainTree
+ * Função: Modo tree: treina o codebook em árvore com KMeans::trainTree
+ */
+int trainTree(int argc, char* argv[]){
+    if(argc < 5){
+        cerr << "Usage: " << argv[0] << " tree <branching> <depth> <output> [threads] [seed] [files...]" << endl;
+        return -1;
+    }
+    int branching = atoi(argv[2]);
+    int depth = atoi(argv[3]);
+    string output = argv[4];
+    int threads = argc > 5 ? atoi(argv[5]) : defaultThreadCount();
+    unsigned int seed = argc > 6 ? atoi(argv[6]) : 42;
+
+    vector<string> files;
+    for(int i = 7; i < argc; i++)
+        files.push_back(argv[i]);
+    if(files.empty())
+        defaultFiles(files);
+
+    KMeans codebook;
+    vector<Centroids> points;
+    for(vector<string>::iterator it = files.begin(); it != files.end(); ++it){
+        if(!codebook.readTrainingFrames(*it, points)){
+            cerr << "Error loading " << *it << endl;
+            return -1;
+        }
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int leaves = codebook.trainTree(points, branching, depth, threads, seed, MAX_ITER, TOLERANCE);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(leaves == 0){
+        cerr << "Error training the codebook." << endl;
+        return -1;
+    }
+
+    if(!codebook.save(output) || !codebook.saveTree(output + ".tree")){
+        cerr << "Error writing " << output << endl;
+        return -1;
+    }
+    cout << points.size() << " frames, " << branching << "^" << depth << " tree: " << leaves << " leaves, " << seconds << "s" << endl;
+    return 0;
+}
+
+
+/**
+ * trainProduct
+ * Função: Modo product: treina os codebooks de cada mão com ProductQuantizer::train
+ */
+int trainProduct(int argc, char* argv[]){
+    if(argc < 5){
+        cerr << "Usage: " << argv[0] << " product <rightClusters> <leftClusters> <output> [threads] [seed] [files...]" << endl;
+        return -1;
+    }
+    int rightClusters = atoi(argv[2]);
+    int leftClusters = atoi(argv[3]);
+    string output = argv[4];
+    int threads = argc > 5 ? atoi(argv[5]) : defaultThreadCount();
+    unsigned int seed = argc > 6 ? atoi(argv[6]) : 42;
+
+    vector<string> files;
+    for(int i = 7; i < argc; i++)
+        files.push_back(argv[i]);
+    if(files.empty())
+        defaultFiles(files);
+
+    KMeans reader;
+    vector<Centroids> points;
+    for(vector<string>::iterator it = files.begin(); it != files.end(); ++it){
+        if(!reader.readTrainingFrames(*it, points)){
+            cerr << "Error loading " << *it << endl;
+            return -1;
+        }
+    }
+    if(rightClusters < 1 || leftClusters < 1 || (int)points.size() < max(rightClusters, leftClusters)){
+        cerr << "Invalid cluster number for " << points.size() << " frames." << endl;
+        return -1;
+    }
+
+    ProductQuantizer codebook;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    double inertia = codebook.train(points, rightClusters, leftClusters, threads, seed, MAX_ITER, TOLERANCE);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if(!codebook.save(output)){
+        cerr << "Error writing " << output << endl;
+        return -1;
+    }
+    cout << points.size() << " frames, " << rightClusters << "x" << leftClusters << " = " << codebook.getClusterNumber()
+         << " symbols: inertia " << inertia << ", " << seconds << "s" << endl;
+    return 0;
+}
+
+
+int main(int argc, char* argv[]){
+    setlocale(LC_ALL, "C");
+
+    if(argc > 1 && string(argv[1]) == "minibatch")
+        return trainMiniBatch(argc, argv);
+    if(argc > 1 && string(argv[1]) == "tree")
+        return trainTree(argc, argv);
+    if(argc > 1 && string(argv[1]) == "product")
+        return trainProduct(argc, argv);
+
+    if(argc < 3){
+        cerr << "Usage: " << argv[0] << " <clusters> <output> [threads] [seed] [files...]" << endl;
+        cerr << "       " << argv[0] << " minibatch <clusters> <output> <batchSize> <batches> [checkpoint] [seed] [files...]" << endl;
+        cerr << "       " << argv[0] << " tree <branching> <depth> <output> [threads] [seed] [files...]" << endl;
+        cerr << "       " << argv[0] << " product <rightClusters> <leftClusters> <output> [threads] [seed] [files...]" << endl;
+        return -1;
+    }
+    int clusters = atoi(argv[1]);
+    string output = argv[2];
+    int threads = argc > 3 ? atoi(argv[3]) : defaultThreadCount();
+    unsigned int seed = argc > 4 ? atoi(argv[4]) : 42;
+
+    vector<string> files;
+    for(int i = 5; i < argc; i++)
+        files.push_back(argv[i]);
+    if(files.empty())
+        defaultFiles(files);
+
+    KMeans codebook;
+    vector<Centroids> points;
+    for(vector<string>::iterator it = files.begin(); it != files.end(); ++it){
+        if(!codebook.readTrainingFrames(*it, points)){
+            cerr << "Error loading " << *it << endl;
+            return -1;
+        }
+    }
+    if(clusters < 1 || (int)points.size() < clusters){
+        cerr << "Invalid cluster number for " << points.size() << " frames." << endl;
+        return -1;
+    }
+
+    KMeansStats stats;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    double inertia = codebook.train(points, clusters, threads, seed, MAX_ITER, TOLERANCE, KMEANS_HAMERLY, &stats);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if(!codebook.save(output)){
+        cerr << "Error writing " << output << endl;
+        return -1;
+    }
+    cout << points.size() << " frames, " << clusters << " clusters: " << stats.iterations << " iterations, inertia "
+         << inertia << ", " << seconds << "s (" << threads << " threads, " << stats.avoided()*100 << "% of the distances avoided)" << endl;
+    return 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * C++ Generate - Gerador de sequências sintéticas rotuladas a partir dos modelos HMM treinados
+ *
+ * Copyright (c) 2017 Murilo K. Rivabem
+ * All rights reserved.
+ *
+ * Uso: ./generate <count> <length> <output|score> [threads] [seed] [codebook] [states]
+ *      ./generate 1000000 40 synthetic.txt    (escreve "gesto<TAB>símbolos" por linha)
+ *      ./generate 1000000 40 score            (reconhece as sequências sem gravar e mede a vazão)
+ *
+*/
+
+//-----------------------------------------------------------------------
+//  Includes
+//-----------------------------------------------------------------------
+#include "Recognizer.hpp"
+#include "ThreadPool.hpp"
+#include <chrono>
+#include <mutex>
+
+//-----------------------------------------------------------------------
+//  Defines
+//-----------------------------------------------------------------------
+#define BLOCK_SIZE 10000 //Sequências por tarefa; cada tarefa tem o próprio gerador aleatório
+
+
+//-----------------------------------------------------------------------
+//  Code
+//-----------------------------------------------------------------------
+
+/**
+ * blockGenerator
+ * Função: Cria o gerador aleatório de um bloco. A semente depende só de (seed, bloco), então a saída
+ *         é a mesma para qualquer número de threads.
+ *
+ * In: unsigned int seed (Semente global)
+ * In: int block (Índice do bloco)
+ *
+ * Out: mt19937 rng
+ */
+mt19937 blockGenerator(unsigned int seed, int block){
+    seed_seq sequence = {seed, (unsigned int)block};
+    return mt19937(sequence);
+}
+
+
+int main(int argc, char* argv[]){
+    setlocale(LC_ALL, "C");
+
+    if(argc < 4){
+        cerr << "Usage: " << argv[0] << " <count> <length> <output|score> [threads] [seed] [codebook] [states]" << endl;
+        return -1;
+    }
+    long count = atol(argv[1]);
+    int length = atoi(argv[2]);
+    string output = argv[3];
+    int threads = argc > 4 ? atoi(argv[4]) : defaultThreadCount();
+    unsigned int seed = argc > 5 ? atoi(argv[5]) : 42;
+    int codebookSize = argc > 6 ? atoi(argv[6]) : 16;
+    int stateNumber = argc > 7 ? atoi(argv[7]) : 9;
+    bool score = output == "score";
+    if(count < 1 || length < 1){
+        cerr << "Invalid count or length." << endl;
+        return -1;
+    }
+
+    vector<HMM*> models;
+    if(!loadGestureModels(codebookSize, stateNumber, models))
+        return -1;
+    vector<CvHMMSampler> samplers;
+    for(vector<HMM*>::iterator it = models.begin(); it != models.end(); ++it)
+        samplers.push_back((*it)->createSampler());
+
+    fstream file;
+    if(!score){
+        file.open(output.c_str(), ios::out | ios::trunc);
+        if(!file.is_open()){
+            cerr << "Error writing " << output << endl;
+            return -1;
+        }
+    }
+
+    int blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    atomic<long> correct(0);
+    //Os blocos terminam em qualquer ordem: cada um espera em pending até os anteriores serem gravados
+    mutex fileMutex;
+    vector<string> pending(score ? 0 : blocks);
+    vector<bool> finished(score ? 0 : blocks, false);
+    int nextBlock = 0;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    parallelFor(blocks, threads, [&](int block){
+        mt19937 rng = blockGenerator(seed, block);
+        uniform_int_distribution<int> pickGesture(0, samplers.size() - 1);
+        long first = (long)block * BLOCK_SIZE;
+        long last = min(first + BLOCK_SIZE, count);
+
+        Mat seq(1, length, CV_32SC1);
+        RecognitionResult result;
+        stringstream buffer;
+        long hits = 0;
+        for(long i = first; i < last; i++){
+            int gesture = pickGesture(rng);
+            samplers[gesture].generate(length, rng, seq.ptr<int>(0));
+
+            if(score){
+                recognize(models, seq, 1, result);
+                if(result.best() == gesture)
+                    hits++;
+            }else{
+                buffer << HMM_ToFileName(intToHMM(gesture));
+                for(int t = 0; t < length; t++)
+                    buffer << (t == 0 ? "\t" : " ") << seq.at<int>(0,t);
+                buffer << "\n";
+            }
+        }
+
+        correct += hits;
+        if(!score){
+            lock_guard<mutex> lock(fileMutex);
+            pending[block] = buffer.str();
+            finished[block] = true;
+            for(; nextBlock < blocks && finished[nextBlock]; nextBlock++){
+                file << pending[nextBlock];
+                string().swap(pending[nextBlock]);
+            }
+        }
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << count << " sequences of " << length << " symbols in " << seconds << "s ("
+         << count / seconds << " sequences/s, " << threads << " threads)" << endl;
+    if(score)
+        cout << "Accuracy on synthetic data: " << (double)correct * 100 / count << "%" << endl;
+
+    return 0;
+}
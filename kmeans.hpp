@@ -1,7 +1,11 @@
+#ifndef KMEANS_HPP
+#define KMEANS_HPP
+
 #include <iostream>
 #include <vector>
 #include <fstream>
 #include <string>
+#include <sstream>
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
@@ -10,6 +14,28 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <locale.h>
 #include <time.h>
+#include <random>
+#include <cfloat>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include "ThreadPool.hpp"
+#include "CvHMM.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KMEANS_X86 //Busca do centroide mais próximo com AVX, escolhida em tempo de execução
+#endif
+
+#define KMEANS_CHUNK_SIZE 16384 //Frames por tarefa no treinamento; o resultado não depende do número de threads
+#define KMEANS_BOUND_SLACK 1e-9 //Margem relativa dos limites do Hamerly contra erros de arredondamento
+#define KMEANS_LANES 8          //Centroides por bloco do layout de busca (um registrador AVX de floats)
+#define KMEANS_TILE_POINTS 32   //Frames por tile da matriz de distâncias do quantizador em lote
+#define KMEANS_EXPANSION_SLACK 4e-6 //Erro relativo admitido em ||c||² - 2x·c, em unidades de (||x|| + max||c||)²
+#define KMEANS_KDTREE_CLUSTERS 256  //Codebooks a partir deste tamanho usam a KD-tree na busca automática (bench kdtree)
+#define KMEANS_KDTREE_SLACK 1e-5    //Margem relativa da poda da KD-tree contra o arredondamento das distâncias em float
+#define KMEANS_NEIGHBORS 32         //Vizinhos mais próximos de cada centroide guardados para a quantização em fluxo
+#define KMEANS_COHERENT_CLUSTERS 64 //Codebooks a partir deste tamanho começam a busca em fluxo pelo símbolo anterior (bench coherent)
+#define LOOKUP_AMBIGUOUS 0xFFFF     //Célula da tabela do LookupQuantizer sem um único centroide mais próximo
 
 using namespace cv;
 using namespace std;
@@ -108,6 +134,34 @@ typedef struct Frame{
 }Frame;
 
 
+enum KMeansAlgorithm{
+    KMEANS_LLOYD,   //Compara cada frame com todos os centroides em toda iteração
+    KMEANS_HAMERLY  //Mesmo resultado, pulando as comparações descartadas pela desigualdade triangular
+};
+
+enum KMeansSearch{
+    KMEANS_SEARCH_AUTO,     //KD-tree a partir de KMEANS_KDTREE_CLUSTERS centroides, senão FLAT
+    KMEANS_SEARCH_FLAT,     //Compara o frame com todos os centroides (exato)
+    KMEANS_SEARCH_KDTREE,   //Branch and bound em uma KD-tree dos centroides (exato, mesmo símbolo do FLAT)
+    KMEANS_SEARCH_TREE      //Desce a árvore do codebook, branching x depth distâncias (aproximado)
+};
+
+struct KMeansStats{
+    int iterations;
+    long long distances;        //Distâncias frame-centroide calculadas
+    long long lloydDistances;   //Distâncias que o Lloyd calcularia nas mesmas iterações
+
+    KMeansStats() : iterations(0), distances(0), lloydDistances(0){}
+
+    /**
+     * avoided
+     * Função: Fração das distâncias do Lloyd que não precisaram ser calculadas
+     */
+    double avoided() const{
+        return lloydDistances > 0 ? 1 - (double)distances / lloydDistances : 0;
+    }
+};
+
 struct Centroids{
     float rightVectorX, rightVectorY, rightVectorZ, rightHandConfiguration;
     float leftVectorX, leftVectorY, leftVectorZ, leftHandConfiguration;
@@ -124,15 +178,724 @@ void printMat(Mat& data){
     {
         std::cout << i << ": ";
         for (int j=0;j<data.cols;j++)
-            std::cout << data.at<int>(i,j) << "|";
+            std::cout << cvhmmSymbol(data, i, j) << "|";
         std::cout << "\n";
     }
 }
 
+/**
+ * FrameSampler
+ * Sorteia frames das bases de dados direto dos arquivos, sem carregá-los na memória: escolhe uma posição aleatória
+ * entre todos os bytes dos arquivos, pula o resto da linha sorteada e lê o frame seguinte (voltando ao começo do
+ * arquivo no fim). A memória não depende do tamanho das bases. Cada frame é sorteado com probabilidade proporcional
+ * ao tamanho em bytes da linha anterior, que varia pouco nessas bases.
+ */
+class FrameSampler{
+    private:
+        vector<fstream*> files;
+        vector<long long> sizes;
+        long long total;
+        bool opened;
+
+        FrameSampler(const FrameSampler&);
+        FrameSampler& operator=(const FrameSampler&);
+
+    public:
+        /**
+         * FrameSampler
+         * Função: Abre as bases de dados
+         *
+         * In: vector<string> &filenames (Arquivos com um frame por linha)
+         */
+        FrameSampler(const vector<string> &filenames) : total(0), opened(true){
+            for(vector<string>::const_iterator it = filenames.begin(); it != filenames.end(); ++it){
+                fstream *file = new fstream((*it).c_str(), ios::in | ios::binary);
+                if(!file->is_open()){
+                    cerr << "Error loading " << *it << endl;
+                    opened = false;
+                    delete file;
+                    continue;
+                }
+                file->seekg(0, ios::end);
+                long long size = file->tellg();
+                if(size <= 0){
+                    delete file;
+                    continue;
+                }
+                files.push_back(file);
+                sizes.push_back(size);
+                total += size;
+            }
+        }
+
+        ~FrameSampler(){
+            for(vector<fstream*>::iterator it = files.begin(); it != files.end(); ++it)
+                delete *it;
+        }
+
+        /**
+         * isOpen
+         * Função: Verdadeiro se todos os arquivos foram abertos e há algum byte para sortear
+         */
+        bool isOpen() const{
+            return opened && total > 0;
+        }
+
+        /**
+         * sample
+         * Função: Lê um frame sorteado
+         *
+         * In: mt19937 &rng (Gerador aleatório)
+         * In: Centroids &frame (Frame lido)
+         *
+         * Out: Centroids &frame
+         * Out: bool sucesso (Falso se o arquivo sorteado não tem nenhum frame)
+         */
+        bool sample(mt19937 &rng, Centroids &frame){
+            if(total <= 0)
+                return false;
+            long long position = uniform_int_distribution<long long>(0, total - 1)(rng);
+            size_t f = 0;
+            while(position >= sizes[f])
+                position -= sizes[f++];
+            fstream &file = *files[f];
+            file.clear();
+            file.seekg(position);
+
+            string line;
+            getline(file, line); //Resto da linha sorteada
+            for(int wrapped = 0; wrapped < 2; ){
+                if(!getline(file, line)){
+                    file.clear();
+                    file.seekg(0);
+                    wrapped++;
+                    continue;
+                }
+                stringstream ss(line);
+                if(ss >> frame.rightVectorX >> frame.rightVectorY >> frame.rightVectorZ >> frame.rightHandConfiguration
+                      >> frame.leftVectorX >> frame.leftVectorY >> frame.leftVectorZ >> frame.leftHandConfiguration)
+                    return true;
+            }
+            return false;
+        }
+};
+
+
+/**
+ * QuantizationScratch
+ * Buffers reutilizáveis da quantização sem alocação (KMeans::quantize sobre ponteiros e KMeans::realTimeObservations).
+ * Os buffers só crescem: depois de uma chamada com o maior tamanho usado as seguintes não alocam memória. Um por
+ * thread.
+ */
+struct QuantizationScratch{
+    vector<Centroids> frames;       //Frames convertidos de Frame
+    vector<int> symbols;            //Símbolos quantizados
+    vector<unsigned char> storage;  //Observações devolvidas por realTimeObservations, no tipo de cvhmmSymbolDepth
+    vector<float> tile;             //Matriz de distâncias de um tile (quantizeRange)
+};
+
 class KMeans{
 
     private:
         vector<Centroids> *codebook;
+        vector<float> layout;   //Cópia do codebook para a busca: blocos de 8 centroides, característica por característica
+        int layoutClusters;     //Centroides copiados para o layout
+        vector<float> norms;    //||c||² de cada centroide, na ordem do layout (infinito nos centroides de enchimento)
+        float maxNorm;          //Maior ||c|| do codebook
+
+        struct TreeNode{
+            Centroids center;
+            int first, children;    //Filhos em tree[first, first+children), contíguos; children = 0 nas folhas
+            int offset;             //Centros dos filhos em treeLayout, no layout de busca (blocos de KMEANS_LANES)
+            int symbol;             //Símbolo da folha no codebook
+        };
+        vector<TreeNode> tree;      //Árvore do codebook (raiz em tree[0]); vazia se o codebook é plano
+        vector<float> treeLayout;
+        KMeansSearch search;
+
+        struct KDNode{
+            int dimension;          //Característica do corte
+            float split;            //À esquerda os centroides com valor <= split, à direita >= split
+            int left, right;
+            int block;              //Bloco de kdLayout com os centroides da folha (-1 nos nós internos)
+        };
+        vector<KDNode> kdTree;      //KD-tree do codebook (raiz em kdTree[0]), refeita por updateLayout
+        vector<float> kdLayout;     //Centroides das folhas, um bloco do layout de busca por folha
+        vector<int> kdIndex;        //Índice no codebook de cada posição de kdLayout (-1 no enchimento)
+
+        vector<int> neighbors;              //Vizinhos de cada centroide, do mais próximo ao mais distante
+        vector<double> neighborDistances;   //Distância (não ao quadrado) até cada vizinho
+        int neighborCount;                  //Vizinhos por centroide; -1 até a primeira quantização em fluxo
+
+        /**
+         * updateLayout
+         * Função: Copia o codebook para o layout de busca. Cada bloco de KMEANS_LANES centroides guarda as 8
+         *         características em sequência, cada uma com o valor dos KMEANS_LANES centroides lado a lado
+         *         (bloco b, característica f, centroide b*KMEANS_LANES+l em [b*64 + f*8 + l]), alinhado em 32 bytes.
+         *         O último bloco é completado com centroides em FLT_MAX, que nunca são os mais próximos.
+         */
+        void updateLayout(){
+            int clusters = codebook->size();
+            int blocks = (clusters + KMEANS_LANES - 1) / KMEANS_LANES;
+            layout.assign(blocks * 8 * KMEANS_LANES + 8, FLT_MAX);
+            float *aligned = alignedLayout();
+            for(int c = 0; c < clusters; c++){
+                const float *v = &(*codebook)[c].rightVectorX;
+                for(int f = 0; f < 8; f++)
+                    aligned[(c / KMEANS_LANES) * 8 * KMEANS_LANES + f * KMEANS_LANES + c % KMEANS_LANES] = v[f];
+            }
+            layoutClusters = clusters;
+
+            norms.assign(blocks * KMEANS_LANES, INFINITY);
+            maxNorm = 0;
+            for(int c = 0; c < clusters; c++){
+                const float *v = &(*codebook)[c].rightVectorX;
+                float norm = 0;
+                for(int f = 0; f < 8; f++)
+                    norm += v[f] * v[f];
+                norms[c] = norm;
+                maxNorm = max(maxNorm, sqrt(norm));
+            }
+
+            neighborCount = -1;
+            kdTree.clear();
+            kdIndex.clear();
+            vector<int> order;
+            for(int c = 0; c < clusters; c++)
+                order.push_back(c);
+            if(clusters > 0)
+                buildKDTree(order, 0, clusters);
+            kdLayout.assign(kdIndex.size() * 8 + 8, FLT_MAX);
+            float *kd = alignFloats(kdLayout);
+            for(size_t slot = 0; slot < kdIndex.size(); slot++)
+                if(kdIndex[slot] >= 0){
+                    const float *v = &(*codebook)[kdIndex[slot]].rightVectorX;
+                    for(int f = 0; f < 8; f++)
+                        kd[(slot / KMEANS_LANES) * 8 * KMEANS_LANES + f * KMEANS_LANES + slot % KMEANS_LANES] = v[f];
+                }
+        }
+
+        /**
+         * buildKDTree
+         * Função: Cria o nó da KD-tree dos centroides order[begin, end): corta na mediana da característica de maior
+         *         amplitude até sobrarem KMEANS_LANES centroides, que formam uma folha (um bloco, em ordem de índice,
+         *         para que o empate continue com o menor índice)
+         *
+         * Out: int node (Índice do nó em kdTree)
+         */
+        int buildKDTree(vector<int> &order, int begin, int end){
+            int node = kdTree.size();
+            KDNode n = {0, 0, -1, -1, -1};
+            kdTree.push_back(n);
+            if(end - begin <= KMEANS_LANES){
+                sort(order.begin() + begin, order.begin() + end);
+                kdTree[node].block = kdIndex.size() / KMEANS_LANES;
+                for(int l = 0; l < KMEANS_LANES; l++)
+                    kdIndex.push_back(begin + l < end ? order[begin + l] : -1);
+                return node;
+            }
+            int dimension = 0;
+            float widest = -1;
+            for(int f = 0; f < 8; f++){
+                float low = FLT_MAX, high = -FLT_MAX;
+                for(int i = begin; i < end; i++){
+                    float v = (&(*codebook)[order[i]].rightVectorX)[f];
+                    low = min(low, v);
+                    high = max(high, v);
+                }
+                if(high - low > widest){
+                    widest = high - low;
+                    dimension = f;
+                }
+            }
+            int middle = (begin + end) / 2;
+            vector<Centroids> &centers = *codebook;
+            nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](int a, int b){
+                float va = (&centers[a].rightVectorX)[dimension], vb = (&centers[b].rightVectorX)[dimension];
+                return va < vb || (va == vb && a < b);
+            });
+            kdTree[node].dimension = dimension;
+            kdTree[node].split = (&centers[order[middle]].rightVectorX)[dimension];
+            int left = buildKDTree(order, begin, middle);
+            int right = buildKDTree(order, middle, end);
+            kdTree[node].left = left;
+            kdTree[node].right = right;
+            return node;
+        }
+
+        /**
+         * searchKDTree
+         * Função: Branch and bound na KD-tree: visita primeiro o lado do corte em que o frame está e só visita o
+         *         outro se a distância do frame até a célula (offsets guarda, por característica, a distância até a
+         *         célula atual) não passa da melhor distância encontrada. As folhas usam o mesmo kernel e a mesma
+         *         distância em float de GetNearestCluster, e o empate fica com o menor índice
+         *
+         * In: int node (Nó atual)
+         * In: float *point (8 características)
+         * In: double cell (Distância ao quadrado até a célula do nó)
+         * In: double *offsets (Distância até a célula em cada característica)
+         * In: int &best, float &bestDistance (Melhor centroide até agora)
+         * In: long long *distances (Se não é NULL, soma os centroides das folhas visitadas)
+         */
+        void searchKDTree(int node, const float *point, double cell, double *offsets, int &best, float &bestDistance, long long *distances){
+            const KDNode &n = kdTree[node];
+            if(n.block >= 0){
+                if(distances != NULL)
+                    for(int l = 0; l < KMEANS_LANES; l++)
+                        *distances += kdIndex[n.block * KMEANS_LANES + l] >= 0;
+                const float *kd = alignFloats(kdLayout);
+                int lane = nearestBlocks(kd + n.block * 8 * KMEANS_LANES, 1, point);
+                int c = kdIndex[n.block * KMEANS_LANES + lane];
+                float d = exactDistance(&(*codebook)[c].rightVectorX, point);
+                if(best < 0 || d < bestDistance || (d == bestDistance && c < best)){
+                    best = c;
+                    bestDistance = d;
+                }
+                return;
+            }
+            double offset = (double)point[n.dimension] - n.split;
+            int nearer = offset <= 0 ? n.left : n.right, farther = offset <= 0 ? n.right : n.left;
+            searchKDTree(nearer, point, cell, offsets, best, bestDistance, distances);
+            double previous = offsets[n.dimension];
+            double farCell = cell - previous * previous + offset * offset;
+            if(farCell * (1 - KMEANS_KDTREE_SLACK) <= bestDistance){
+                offsets[n.dimension] = offset;
+                searchKDTree(farther, point, farCell, offsets, best, bestDistance, distances);
+                offsets[n.dimension] = previous;
+            }
+        }
+
+        /**
+         * kdNearest
+         * Função: Centroide mais próximo pela KD-tree (o mesmo de nearestBlocks sobre o codebook inteiro). Se distances
+         *         não é NULL, soma nele os centroides avaliados
+         */
+        int kdNearest(const float *point, long long *distances = NULL){
+            double offsets[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+            int best = -1;
+            float bestDistance = FLT_MAX;
+            searchKDTree(0, point, 0, offsets, best, bestDistance, distances);
+            return best;
+        }
+
+        /**
+         * updateNeighbors
+         * Função: Ordena, para cada centroide, os KMEANS_NEIGHBORS centroides mais próximos dele
+         */
+        void updateNeighbors(){
+            int clusters = codebook->size();
+            neighborCount = min(clusters - 1, KMEANS_NEIGHBORS);
+            neighbors.assign(clusters * neighborCount, 0);
+            neighborDistances.assign(clusters * neighborCount, 0);
+            vector< pair<double,int> > others;
+            for(int c = 0; c < clusters; c++){
+                others.clear();
+                for(int j = 0; j < clusters; j++)
+                    if(j != c)
+                        others.push_back(make_pair(sqrt(squaredDistance((*codebook)[c], (*codebook)[j])), j));
+                partial_sort(others.begin(), others.begin() + neighborCount, others.end());
+                for(int k = 0; k < neighborCount; k++){
+                    neighborDistances[c * neighborCount + k] = others[k].first;
+                    neighbors[c * neighborCount + k] = others[k].second;
+                }
+            }
+        }
+
+        /**
+         * resolvedSearch
+         * Função: Busca usada de fato: KMEANS_SEARCH_AUTO vira KDTREE ou FLAT pelo tamanho do codebook
+         */
+        KMeansSearch resolvedSearch() const{
+            if(search == KMEANS_SEARCH_AUTO)
+                return layoutClusters >= KMEANS_KDTREE_CLUSTERS ? KMEANS_SEARCH_KDTREE : KMEANS_SEARCH_FLAT;
+            return search;
+        }
+
+        /**
+         * alignedLayout
+         * Função: Início do layout alinhado em 32 bytes (o vetor tem 8 floats a mais para o deslocamento)
+         */
+        float* alignedLayout(){
+            return alignFloats(layout);
+        }
+
+        static float* alignFloats(vector<float> &values){
+            uintptr_t address = (uintptr_t)&values[0];
+            return (float*)((address + 31) & ~(uintptr_t)31);
+        }
+
+        /**
+         * updateTreeLayout
+         * Função: Copia os centros dos filhos de cada nó interno da árvore para treeLayout, no layout de busca
+         */
+        void updateTreeLayout(){
+            int size = 0;
+            for(vector<TreeNode>::iterator it = tree.begin(); it != tree.end(); ++it){
+                (*it).offset = size;
+                size += ((*it).children + KMEANS_LANES - 1) / KMEANS_LANES * 8 * KMEANS_LANES;
+            }
+            treeLayout.assign(size + 8, FLT_MAX);
+            float *aligned = alignFloats(treeLayout);
+            for(vector<TreeNode>::iterator it = tree.begin(); it != tree.end(); ++it)
+                for(int c = 0; c < (*it).children; c++){
+                    const float *v = &tree[(*it).first + c].center.rightVectorX;
+                    for(int f = 0; f < 8; f++)
+                        aligned[(*it).offset + (c / KMEANS_LANES) * 8 * KMEANS_LANES + f * KMEANS_LANES + c % KMEANS_LANES] = v[f];
+                }
+        }
+
+        /**
+         * buildTree
+         * Função: Divide os frames de um nó em branching filhos com k-means e continua em cada filho até a
+         *         profundidade depth. As folhas recebem os símbolos em ordem de profundidade
+         *
+         * In: int node (Índice do nó em tree)
+         * In: vector<Centroids> &points (Frames do nó)
+         * In: int branching, int depth (Filhos por nó e níveis que faltam)
+         * In: int threads, unsigned int seed, int maxIter, double tolerance (Parâmetros do KMeans::train)
+         */
+        void buildTree(int node, const vector<Centroids> &points, int branching, int depth, int threads, unsigned int seed,
+                       int maxIter, double tolerance){
+            if(depth == 0 || (int)points.size() < 2){
+                tree[node].symbol = codebook->size();
+                codebook->push_back(tree[node].center);
+                return;
+            }
+            KMeans split;
+            split.train(points, branching, threads, seed + node, maxIter, tolerance);
+            vector<Centroids> &centers = *split.returnCentroids();
+            int first = tree.size();
+            tree[node].first = first;
+            tree[node].children = centers.size();
+            for(vector<Centroids>::iterator it = centers.begin(); it != centers.end(); ++it){
+                TreeNode child = {*it, 0, 0, 0, -1};
+                tree.push_back(child);
+            }
+            vector< vector<Centroids> > subsets(centers.size());
+            for(vector<Centroids>::const_iterator it = points.begin(); it != points.end(); ++it)
+                subsets[split.GetNearestCluster(*it)].push_back(*it);
+            for(size_t c = 0; c < centers.size(); c++)
+                buildTree(first + c, subsets[c], branching, depth - 1, threads, seed, maxIter, tolerance);
+        }
+
+        /**
+         * treeNearest
+         * Função: Símbolo da folha alcançada descendo a árvore pelo filho mais próximo em cada nível. Se distances
+         *         não é NULL, soma nele os filhos avaliados
+         */
+        int treeNearest(const float *point, long long *distances = NULL){
+            const float *base = alignFloats(treeLayout);
+            int node = 0;
+            while(tree[node].children > 0){
+                const TreeNode &n = tree[node];
+                if(distances != NULL)
+                    *distances += n.children;
+                node = n.first + nearestBlocks(base + n.offset, (n.children + KMEANS_LANES - 1) / KMEANS_LANES, point);
+            }
+            return tree[node].symbol;
+        }
+
+        /**
+         * countedNearest
+         * Função: GetNearestCluster somando em distances as distâncias que a busca escolhida calcula de fato
+         *         (o codebook inteiro, os filhos visitados da árvore ou as folhas visitadas da KD-tree)
+         */
+        int countedNearest(const Centroids &coordinates, long long &distances){
+            if(search == KMEANS_SEARCH_TREE)
+                return treeNearest(&coordinates.rightVectorX, &distances);
+            if(resolvedSearch() == KMEANS_SEARCH_KDTREE)
+                return kdNearest(&coordinates.rightVectorX, &distances);
+            distances += layoutClusters;
+            return nearestBlocks(alignedLayout(), (layoutClusters + KMEANS_LANES - 1) / KMEANS_LANES, &coordinates.rightVectorX);
+        }
+
+        /**
+         * nearestScalar
+         * Função: Centroide mais próximo pelo layout de busca, sem instruções vetoriais. As distâncias ao quadrado são
+         *         somadas na mesma ordem do GetNearestCluster original e o empate fica com o menor índice
+         *
+         * In: float *blocks (Layout alinhado)
+         * In: int count (Número de blocos)
+         * In: float *point (8 características)
+         *
+         * Out: int cluster
+         */
+        static int nearestScalar(const float *blocks, int count, const float *point){
+            int best = 0;
+            float bestDistance = FLT_MAX;
+            for(int b = 0; b < count; b++){
+                const float *block = blocks + b * 8 * KMEANS_LANES;
+                float d[KMEANS_LANES];
+                for(int l = 0; l < KMEANS_LANES; l++){
+                    float diff = block[l] - point[0];
+                    d[l] = diff * diff;
+                }
+                for(int f = 1; f < 8; f++)
+                    for(int l = 0; l < KMEANS_LANES; l++){
+                        float diff = block[f * KMEANS_LANES + l] - point[f];
+                        d[l] += diff * diff;
+                    }
+                for(int l = 0; l < KMEANS_LANES; l++)
+                    if(d[l] < bestDistance){
+                        bestDistance = d[l];
+                        best = b * KMEANS_LANES + l;
+                    }
+            }
+            return best;
+        }
+
+#ifdef KMEANS_X86
+        /**
+         * nearestAVX
+         * Função: nearestScalar com um bloco de 8 centroides por instrução: cada lane guarda a menor distância e o
+         *         índice do seu centroide, e no fim a menor das 8 lanes (no empate, o menor índice) é o resultado
+         */
+        __attribute__((target("avx")))
+        static int nearestAVX(const float *blocks, int count, const float *point){
+            __m256 x[8];
+            for(int f = 0; f < 8; f++)
+                x[f] = _mm256_set1_ps(point[f]);
+            __m256 bestDistance = _mm256_set1_ps(FLT_MAX);
+            __m256 bestIndex = _mm256_setzero_ps();
+            __m256 index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256 step = _mm256_set1_ps(KMEANS_LANES);
+            for(int b = 0; b < count; b++){
+                const float *block = blocks + b * 8 * KMEANS_LANES;
+                __m256 diff = _mm256_sub_ps(_mm256_load_ps(block), x[0]);
+                __m256 d = _mm256_mul_ps(diff, diff);
+                for(int f = 1; f < 8; f++){
+                    diff = _mm256_sub_ps(_mm256_load_ps(block + f * KMEANS_LANES), x[f]);
+                    d = _mm256_add_ps(d, _mm256_mul_ps(diff, diff));
+                }
+                //min_ps devolve o segundo operando no empate, então a lane só troca de centroide se d for menor
+                __m256 closer = _mm256_cmp_ps(d, bestDistance, _CMP_LT_OQ);
+                bestDistance = _mm256_min_ps(d, bestDistance);
+                bestIndex = _mm256_or_ps(_mm256_and_ps(closer, index), _mm256_andnot_ps(closer, bestIndex));
+                index = _mm256_add_ps(index, step);
+            }
+            float distances[KMEANS_LANES], indices[KMEANS_LANES];
+            _mm256_storeu_ps(distances, bestDistance);
+            _mm256_storeu_ps(indices, bestIndex);
+            int lane = 0;
+            for(int l = 1; l < KMEANS_LANES; l++)
+                if(distances[l] < distances[lane] || (distances[l] == distances[lane] && indices[l] < indices[lane]))
+                    lane = l;
+            return (int)indices[lane];
+        }
+
+        static bool hasAVX(){
+            static bool available = __builtin_cpu_supports("avx");
+            return available;
+        }
+
+        /**
+         * expansionTile
+         * Função: Linhas da matriz de distâncias de um tile de frames: tile[i*stride + c] = ||c||² - 2x·c, a distância
+         *         ao quadrado menos ||x||², que não muda o mais próximo. Cada bloco de 8 centroides sai de 8 FMAs e
+         *         o menor valor de cada linha é acumulado junto. Os centroides de enchimento dão infinito ou NaN, que
+         *         min_ps e as comparações ignoram
+         *
+         * In: float *blocks (Layout alinhado)
+         * In: float *norms (||c||² na ordem do layout)
+         * In: int count (Número de blocos)
+         * In: Centroids *points (Frames do tile)
+         * In: int n (Número de frames do tile)
+         * In: float *tile (n linhas de stride = count*8 floats)
+         * In: float *minimum (Menor valor de cada linha)
+         *
+         * Out: float *tile
+         * Out: float *minimum
+         */
+        __attribute__((target("avx2,fma")))
+        static void expansionTile(const float *blocks, const float *norms, int count, const Centroids *points, int n, float *tile, float *minimum){
+            const __m256 two = _mm256_set1_ps(2);
+            int stride = count * KMEANS_LANES;
+            //4 frames por passada: cada bloco de centroides é lido uma vez para 4 cadeias de FMA independentes
+            int i = 0;
+            for(; i + 4 <= n; i += 4){
+                const float *x0 = &points[i].rightVectorX, *x1 = &points[i + 1].rightVectorX;
+                const float *x2 = &points[i + 2].rightVectorX, *x3 = &points[i + 3].rightVectorX;
+                float *row = tile + (size_t)i * stride;
+                __m256 smallest0 = _mm256_set1_ps(INFINITY), smallest1 = smallest0, smallest2 = smallest0, smallest3 = smallest0;
+                for(int b = 0; b < count; b++){
+                    const float *block = blocks + b * 8 * KMEANS_LANES;
+                    __m256 c = _mm256_load_ps(block);
+                    __m256 dot0 = _mm256_mul_ps(c, _mm256_broadcast_ss(x0)), dot1 = _mm256_mul_ps(c, _mm256_broadcast_ss(x1));
+                    __m256 dot2 = _mm256_mul_ps(c, _mm256_broadcast_ss(x2)), dot3 = _mm256_mul_ps(c, _mm256_broadcast_ss(x3));
+                    for(int f = 1; f < 8; f++){
+                        c = _mm256_load_ps(block + f * KMEANS_LANES);
+                        dot0 = _mm256_fmadd_ps(c, _mm256_broadcast_ss(x0 + f), dot0);
+                        dot1 = _mm256_fmadd_ps(c, _mm256_broadcast_ss(x1 + f), dot1);
+                        dot2 = _mm256_fmadd_ps(c, _mm256_broadcast_ss(x2 + f), dot2);
+                        dot3 = _mm256_fmadd_ps(c, _mm256_broadcast_ss(x3 + f), dot3);
+                    }
+                    __m256 norm = _mm256_loadu_ps(norms + b * KMEANS_LANES);
+                    __m256 d0 = _mm256_fnmadd_ps(two, dot0, norm), d1 = _mm256_fnmadd_ps(two, dot1, norm);
+                    __m256 d2 = _mm256_fnmadd_ps(two, dot2, norm), d3 = _mm256_fnmadd_ps(two, dot3, norm);
+                    _mm256_storeu_ps(row + b * KMEANS_LANES, d0);
+                    _mm256_storeu_ps(row + stride + b * KMEANS_LANES, d1);
+                    _mm256_storeu_ps(row + 2 * stride + b * KMEANS_LANES, d2);
+                    _mm256_storeu_ps(row + 3 * stride + b * KMEANS_LANES, d3);
+                    smallest0 = _mm256_min_ps(d0, smallest0);
+                    smallest1 = _mm256_min_ps(d1, smallest1);
+                    smallest2 = _mm256_min_ps(d2, smallest2);
+                    smallest3 = _mm256_min_ps(d3, smallest3);
+                }
+                minimum[i] = horizontalMin(smallest0);
+                minimum[i + 1] = horizontalMin(smallest1);
+                minimum[i + 2] = horizontalMin(smallest2);
+                minimum[i + 3] = horizontalMin(smallest3);
+            }
+            for(; i < n; i++){
+                const float *x = &points[i].rightVectorX;
+                float *row = tile + (size_t)i * stride;
+                __m256 smallest = _mm256_set1_ps(INFINITY);
+                for(int b = 0; b < count; b++){
+                    const float *block = blocks + b * 8 * KMEANS_LANES;
+                    __m256 dot = _mm256_mul_ps(_mm256_load_ps(block), _mm256_broadcast_ss(x));
+                    for(int f = 1; f < 8; f++)
+                        dot = _mm256_fmadd_ps(_mm256_load_ps(block + f * KMEANS_LANES), _mm256_broadcast_ss(x + f), dot);
+                    __m256 d = _mm256_fnmadd_ps(two, dot, _mm256_loadu_ps(norms + b * KMEANS_LANES));
+                    _mm256_storeu_ps(row + b * KMEANS_LANES, d);
+                    smallest = _mm256_min_ps(d, smallest);
+                }
+                minimum[i] = horizontalMin(smallest);
+            }
+        }
+
+        __attribute__((target("avx")))
+        static float horizontalMin(__m256 v){
+            float lanes[KMEANS_LANES];
+            _mm256_storeu_ps(lanes, v);
+            float smallest = lanes[0];
+            for(int l = 1; l < KMEANS_LANES; l++)
+                smallest = min(smallest, lanes[l]);
+            return smallest;
+        }
+
+        /**
+         * candidatesAVX
+         * Função: Conta os valores da linha até threshold (AVX, 8 centroides por comparação) e devolve o primeiro
+         *
+         * Out: int count (Número de candidatos)
+         * Out: int &first (Índice do primeiro candidato)
+         */
+        __attribute__((target("avx2")))
+        static int candidatesAVX(const float *row, int count, float threshold, int &first){
+            const __m256 limit = _mm256_set1_ps(threshold);
+            int total = 0;
+            first = -1;
+            for(int b = 0; b < count; b++){
+                int bits = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + b * KMEANS_LANES), limit, _CMP_LE_OQ));
+                if(bits != 0 && first < 0)
+                    first = b * KMEANS_LANES + __builtin_ctz(bits);
+                total += __builtin_popcount(bits);
+            }
+            return total;
+        }
+
+        static bool hasFMA(){
+            static bool available = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+            return available;
+        }
+#endif
+
+        /**
+         * nearestBlocks
+         * Função: nearestAVX quando o processador tem AVX, senão nearestScalar
+         */
+        static int nearestBlocks(const float *blocks, int count, const float *point){
+#ifdef KMEANS_X86
+            if(hasAVX())
+                return nearestAVX(blocks, count, point);
+#endif
+            return nearestScalar(blocks, count, point);
+        }
+
+        /**
+         * exactDistance
+         * Função: Distância ao quadrado em float, somada na ordem de nearestScalar e nearestAVX
+         */
+        static float exactDistance(const float *c, const float *x){
+            float diff = c[0] - x[0];
+            float d = diff * diff;
+            for(int f = 1; f < 8; f++){
+                diff = c[f] - x[f];
+                d += diff * diff;
+            }
+            return d;
+        }
+
+        /**
+         * quantizeRange
+         * Função: Quantiza points[first, last) em symbols. Com AVX2/FMA monta a matriz de distâncias de
+         *         KMEANS_TILE_POINTS frames por vez (expansionTile) e separa, em cada linha, os centroides a menos
+         *         do erro de arredondamento da expansão do menor valor; quando há mais de um, decide pela distância
+         *         calculada como em GetNearestCluster. O resultado é sempre o de GetNearestCluster.
+         *
+         * In: Centroids *points (Frames)
+         * In: int first, int last (Intervalo)
+         * In: int *symbols (Símbolo de cada frame)
+         * In: vector<float> &tile (Buffer da matriz de distâncias)
+         * In: long long *fallbacks (Frames decididos pela distância exata)
+         *
+         * Out: int *symbols
+         */
+        void quantizeRange(const Centroids *points, int first, int last, int *symbols, vector<float> &tile, long long &fallbacks){
+            KMeansSearch mode = resolvedSearch();
+            if(mode == KMEANS_SEARCH_TREE){
+                for(int i = first; i < last; i++)
+                    symbols[i] = treeNearest(&points[i].rightVectorX);
+                return;
+            }
+            if(mode == KMEANS_SEARCH_KDTREE){
+                for(int i = first; i < last; i++)
+                    symbols[i] = kdNearest(&points[i].rightVectorX);
+                return;
+            }
+            int blocks = (layoutClusters + KMEANS_LANES - 1) / KMEANS_LANES;
+            const float *aligned = alignedLayout();
+#ifdef KMEANS_X86
+            if(hasFMA()){
+                int stride = blocks * KMEANS_LANES;
+                tile.resize((size_t)KMEANS_TILE_POINTS * stride);
+                float minimum[KMEANS_TILE_POINTS];
+                for(int start = first; start < last; start += KMEANS_TILE_POINTS){
+                    int n = min(KMEANS_TILE_POINTS, last - start);
+                    expansionTile(aligned, &norms[0], blocks, points + start, n, &tile[0], minimum);
+                    for(int i = 0; i < n; i++){
+                        const float *x = &points[start + i].rightVectorX;
+                        const float *row = &tile[(size_t)i * stride];
+                        float length = 0;
+                        for(int f = 0; f < 8; f++)
+                            length += x[f] * x[f];
+                        length = sqrt(length);
+                        float threshold = minimum[i] + KMEANS_EXPANSION_SLACK * (length + maxNorm) * (length + maxNorm);
+                        int best;
+                        int candidates = candidatesAVX(row, blocks, threshold, best);
+
+                        //Vários candidatos: o de menor distância exata, no empate o menor índice
+                        if(candidates > 1){
+                            float bestDistance = INFINITY;
+                            for(int c = best; c < layoutClusters; c++)
+                                if(row[c] <= threshold){
+                                    float d = exactDistance(&(*codebook)[c].rightVectorX, x);
+                                    if(d < bestDistance){
+                                        bestDistance = d;
+                                        best = c;
+                                    }
+                                }
+                            fallbacks++;
+                        }
+                        symbols[start + i] = best >= 0 ? best : nearestScalar(aligned, blocks, x);
+                    }
+                }
+                return;
+            }
+#endif
+            for(int i = first; i < last; i++)
+                symbols[i] = nearestScalar(aligned, blocks, &points[i].rightVectorX);
+        }
 
         /**
          * ReadFromFile
@@ -157,18 +920,165 @@ class KMeans{
             }
         }
 
+        /**
+         * squaredDistance
+         * Função: Distância ao quadrado entre dois vetores de 8 características em double, na mesma ordem da versão acima
+         */
+        static double squaredDistance(const double *a, const double *b){
+            double sum = 0;
+            for(int k = 0; k < 8; k++)
+                sum += (a[k] - b[k]) * (a[k] - b[k]);
+            return sum;
+        }
+
+        /**
+         * accumulate
+         * Função: Soma as características de um frame em sum[0..7]
+         */
+        static void accumulate(double *sum, const Centroids &c){
+            sum[0] += c.rightVectorX;
+            sum[1] += c.rightVectorY;
+            sum[2] += c.rightVectorZ;
+            sum[3] += c.rightHandConfiguration;
+            sum[4] += c.leftVectorX;
+            sum[5] += c.leftVectorY;
+            sum[6] += c.leftVectorZ;
+            sum[7] += c.leftHandConfiguration;
+        }
+
+        /**
+         * mean
+         * Função: Centroide a partir das somas de count frames
+         */
+        static Centroids mean(const double *sum, long count){
+            Centroids c = {(float)(sum[0]/count), (float)(sum[1]/count), (float)(sum[2]/count), (float)(sum[3]/count),
+                           (float)(sum[4]/count), (float)(sum[5]/count), (float)(sum[6]/count), (float)(sum[7]/count)};
+            return c;
+        }
+
+        /**
+         * seedCenters
+         * Função: Escolhe as sementes com k-means++: a primeira é sorteada de forma uniforme e cada nova é sorteada
+         *         com probabilidade proporcional à distância ao quadrado até a semente mais próxima. A atualização das
+         *         distâncias é dividida em blocos entre as threads; o sorteio percorre as somas de cada bloco.
+         *
+         * In: vector<Centroids> &points (Frames de treino)
+         * In: int clusters (Número de sementes, no máximo points.size())
+         * In: int threads (Número de threads)
+         * In: mt19937 &rng (Gerador aleatório)
+         * In: vector<double> &nearest (points.size() valores DBL_MAX)
+         *
+         * Out: vector<double> &nearest (Distância ao quadrado de cada frame até a semente mais próxima, exceto a última)
+         */
+        void seedCenters(const vector<Centroids> &points, int clusters, int threads, mt19937 &rng, vector<double> &nearest){
+            vector<Centroids> &centers = *codebook;
+            int n = points.size();
+            int chunks = (n + KMEANS_CHUNK_SIZE - 1) / KMEANS_CHUNK_SIZE;
+            vector<double> chunkSum(chunks);
+            centers.clear();
+            centers.push_back(points[uniform_int_distribution<int>(0, n - 1)(rng)]);
+            while((int)centers.size() < clusters){
+                Centroids last = centers.back();
+                parallelFor(chunks, threads, [&](int chunk){
+                    int first = chunk * KMEANS_CHUNK_SIZE, end = min(first + KMEANS_CHUNK_SIZE, n);
+                    double sum = 0;
+                    for(int i = first; i < end; i++){
+                        nearest[i] = min(nearest[i], squaredDistance(points[i], last));
+                        sum += nearest[i];
+                    }
+                    chunkSum[chunk] = sum;
+                });
+                double total = 0;
+                for(int chunk = 0; chunk < chunks; chunk++)
+                    total += chunkSum[chunk];
+                int chosen;
+                if(total <= 0)
+                    chosen = uniform_int_distribution<int>(0, n - 1)(rng); //Todos os frames já coincidem com uma semente
+                else{
+                    double r = uniform_real_distribution<double>(0, total)(rng);
+                    int chunk = 0;
+                    while(chunk < chunks - 1 && r >= chunkSum[chunk])
+                        r -= chunkSum[chunk++];
+                    int end = min((chunk + 1) * KMEANS_CHUNK_SIZE, n);
+                    chosen = end - 1;
+                    for(int i = chunk * KMEANS_CHUNK_SIZE; i < end; i++){
+                        if(r < nearest[i]){
+                            chosen = i;
+                            break;
+                        }
+                        r -= nearest[i];
+                    }
+                }
+                centers.push_back(points[chosen]);
+            }
+        }
+
+        /**
+         * batchGenerator
+         * Função: Gerador aleatório do lote batch do treino em mini-lotes (-1 para a amostra das sementes). Só depende
+         *         de (seed, batch), então um treino retomado sorteia os mesmos frames
+         */
+        static mt19937 batchGenerator(unsigned int seed, int batch){
+            seed_seq sequence = {seed, (unsigned int)(batch + 1)};
+            return mt19937(sequence);
+        }
+
+        /**
+         * saveCheckpoint
+         * Função: Grava o estado do treino em mini-lotes: "lotes clusters" na primeira linha e, por centroide, as 8
+         *         coordenadas e o número de frames atribuídos. O arquivo é escrito ao lado e renomeado, então uma
+         *         interrupção no meio da gravação não corrompe o checkpoint anterior
+         */
+        static bool saveCheckpoint(const string &filename, const vector<double> &values, const vector<long long> &counts, int batches){
+            string temporary = filename + ".tmp";
+            fstream file(temporary.c_str(), ios::out | ios::trunc);
+            if(!file.is_open())
+                return false;
+            file.precision(17);
+            file << batches << " " << counts.size() << endl;
+            for(size_t c = 0; c < counts.size(); c++){
+                for(int k = 0; k < 8; k++)
+                    file << values[c * 8 + k] << " ";
+                file << counts[c] << endl;
+            }
+            file.close();
+            return rename(temporary.c_str(), filename.c_str()) == 0;
+        }
+
+        /**
+         * loadCheckpoint
+         * Função: Lê um checkpoint gravado por saveCheckpoint com o mesmo número de clusters
+         */
+        static bool loadCheckpoint(const string &filename, int clusters, vector<double> &values, vector<long long> &counts, int &batches){
+            fstream file(filename.c_str(), ios::in);
+            if(!file.is_open())
+                return false;
+            int stored;
+            if(!(file >> batches >> stored) || stored != clusters)
+                return false;
+            for(int c = 0; c < clusters; c++){
+                for(int k = 0; k < 8; k++)
+                    file >> values[c * 8 + k];
+                file >> counts[c];
+            }
+            return !file.fail();
+        }
+
     public:
-        KMeans(){
+        KMeans() : search(KMEANS_SEARCH_AUTO){
             codebook = new vector<Centroids>();
+            updateLayout();
         };
         
-        KMeans(vector<Centroids>* c){
+        KMeans(vector<Centroids>* c) : search(KMEANS_SEARCH_AUTO){
             codebook = c;
+            updateLayout();
         }
 
-        KMeans(fstream& file){
+        KMeans(fstream& file) : search(KMEANS_SEARCH_AUTO){
             codebook = new vector<Centroids>();
             ReadFromFile(file);
+            updateLayout();
         }
 
         void PrintCodebook(){
@@ -185,70 +1095,648 @@ class KMeans{
             return codebook->size();
         }
 
+        /**
+         * returnCentroids
+         * Função: Acesso ao codebook. Quem alterar os centroides deve chamar refreshCentroids depois; centroides
+         *         adicionados ou removidos são percebidos sozinhos
+         */
         vector<Centroids>* returnCentroids(){
             return codebook;
         }
 
+        /**
+         * refreshCentroids
+         * Função: Atualiza a cópia do codebook usada por GetNearestCluster
+         */
+        void refreshCentroids(){
+            updateLayout();
+        }
+
 
         bool isEmpty(){
             return codebook->empty();
         }
 
+        /**
+         * squaredDistance
+         * Função: Distância euclidiana ao quadrado entre dois vetores de características (a métrica de GetNearestCluster)
+         */
+        static double squaredDistance(const Centroids &a, const Centroids &b){
+            double d, sum = 0;
+            d = a.rightVectorX - b.rightVectorX;                        sum += d*d;
+            d = a.rightVectorY - b.rightVectorY;                        sum += d*d;
+            d = a.rightVectorZ - b.rightVectorZ;                        sum += d*d;
+            d = a.rightHandConfiguration - b.rightHandConfiguration;    sum += d*d;
+            d = a.leftVectorX - b.leftVectorX;                          sum += d*d;
+            d = a.leftVectorY - b.leftVectorY;                          sum += d*d;
+            d = a.leftVectorZ - b.leftVectorZ;                          sum += d*d;
+            d = a.leftHandConfiguration - b.leftHandConfiguration;      sum += d*d;
+            return sum;
+        }
+
+        /**
+         * readTrainingFrames
+         * Função: Lê os frames de uma base de dados (uma linha com as 8 características por frame; linhas em branco
+         *         são ignoradas) e os adiciona a points, para o treinamento do codebook
+         *
+         * In: string filename (Nome do arquivo)
+         * In: vector<Centroids> &points (Frames lidos até agora)
+         *
+         * Out: vector<Centroids> &points
+         * Out: bool sucesso (Falso se o arquivo não pode ser aberto)
+         */
+        bool readTrainingFrames(string filename, vector<Centroids> &points){
+            fstream file(filename.c_str(), ios::in);
+            if(!file.is_open())
+                return false;
+            string line;
+            while(getline(file, line)){
+                Centroids c;
+                stringstream ss(line);
+                if(ss >> c.rightVectorX >> c.rightVectorY >> c.rightVectorZ >> c.rightHandConfiguration
+                      >> c.leftVectorX >> c.leftVectorY >> c.leftVectorZ >> c.leftHandConfiguration)
+                    points.push_back(c);
+            }
+            file.close();
+            return true;
+        }
+
+        /**
+         * train
+         * Função: Treina o codebook com k-means. As sementes são escolhidas com k-means++ (cada nova semente é
+         *         sorteada com probabilidade proporcional à distância ao quadrado até a semente mais próxima) e as
+         *         iterações de Lloyd são divididas em blocos de KMEANS_CHUNK_SIZE frames entre as threads, cada bloco
+         *         com os próprios acumuladores. Os blocos são somados sempre na mesma ordem, então o codebook só
+         *         depende da semente. Clusters vazios recomeçam no frame mais distante do seu centroide.
+         *         Com KMEANS_HAMERLY (Hamerly, "Making k-means even faster", 2010) cada frame guarda um limite
+         *         inferior da distância ao segundo centroide mais próximo e só compara com todos os centroides
+         *         quando a desigualdade triangular não garante que o seu centroide continua o mais próximo. As
+         *         atribuições, e portanto o codebook, são as mesmas do Lloyd.
+         *
+         * In: vector<Centroids> &points (Frames de treino)
+         * In: int clusters (Tamanho do codebook)
+         * In: int threads (Número de threads, se <= 0 usa defaultThreadCount())
+         * In: unsigned int seed (Semente do sorteio das sementes)
+         * In: int maxIter (Número máximo de iterações de Lloyd)
+         * In: double tolerance (Para quando a inércia cai menos do que tolerance * inércia em uma iteração)
+         * In: KMeansAlgorithm algorithm (KMEANS_LLOYD ou KMEANS_HAMERLY)
+         * In: KMeansStats *stats (Se não for NULL, recebe o número de iterações e de distâncias calculadas)
+         *
+         * Out: double inertia (Soma das distâncias ao quadrado de cada frame ao seu centroide na última iteração)
+         */
+        double train(const vector<Centroids> &points, int clusters, int threads = 0, unsigned int seed = 42,
+                     int maxIter = 100, double tolerance = 1e-4, KMeansAlgorithm algorithm = KMEANS_HAMERLY,
+                     KMeansStats *stats = NULL){
+            vector<Centroids> &centers = *codebook;
+            centers.clear();
+            tree.clear();
+            search = KMEANS_SEARCH_AUTO;
+            int n = points.size();
+            if(clusters > n)
+                clusters = n;
+            if(stats != NULL)
+                *stats = KMeansStats();
+            if(clusters <= 0)
+                return 0;
+            int chunks = (n + KMEANS_CHUNK_SIZE - 1) / KMEANS_CHUNK_SIZE;
+
+            //Sementes k-means++
+            mt19937 rng(seed);
+            vector<double> nearest(n, DBL_MAX);
+            seedCenters(points, clusters, threads, rng, nearest);
+
+            //Iterações de Lloyd
+            bool bounded = algorithm == KMEANS_HAMERLY;
+            vector<double> sums(chunks * clusters * 8), chunkInertia(chunks), total(clusters * 8), values(clusters * 8);
+            vector<long> counts(chunks * clusters), totalCount(clusters);
+            vector<long long> chunkDistances(chunks);
+            vector<int> assignment(bounded ? n : 0);
+            vector<double> lower(bounded ? n : 0), separation(clusters);
+            double maxMove = 0, secondMove = 0;    //Maiores deslocamentos de centroide na última atualização
+            int maxMoved = -1;
+            double inertia = DBL_MAX, previous;
+            int iter = 0;
+            while(iter < maxIter){
+                previous = inertia;
+                //Centroides em um vetor contíguo de doubles, para o laço interno não converter cada coordenada
+                for(int c = 0; c < clusters; c++){
+                    fill(&values[c * 8], &values[c * 8] + 8, 0.0);
+                    accumulate(&values[c * 8], centers[c]);
+                }
+                //s(c): metade da distância ao centroide mais próximo. Um frame mais perto do seu centroide do que
+                //isso não pode estar mais perto de outro (desigualdade triangular)
+                if(bounded){
+                    fill(separation.begin(), separation.end(), DBL_MAX);
+                    for(int c = 0; c < clusters; c++)
+                        for(int o = c + 1; o < clusters; o++){
+                            double half = sqrt(squaredDistance(&values[c * 8], &values[o * 8])) / 2;
+                            separation[c] = min(separation[c], half);
+                            separation[o] = min(separation[o], half);
+                        }
+                }
+                parallelFor(chunks, threads, [&](int chunk){
+                    int first = chunk * KMEANS_CHUNK_SIZE, end = min(first + KMEANS_CHUNK_SIZE, n);
+                    double *sum = &sums[chunk * clusters * 8];
+                    long *count = &counts[chunk * clusters];
+                    fill(sum, sum + clusters * 8, 0.0);
+                    fill(count, count + clusters, 0L);
+                    double partial = 0, point[8];
+                    long long distances = 0;
+                    for(int i = first; i < end; i++){
+                        fill(point, point + 8, 0.0);
+                        accumulate(point, points[i]);
+                        int best = 0;
+                        double bestDistance = DBL_MAX;
+                        bool scan = true;
+                        if(bounded && iter > 0){
+                            //A distância exata ao centroide atual é necessária de qualquer forma para a inércia
+                            best = assignment[i];
+                            bestDistance = squaredDistance(point, &values[best * 8]);
+                            distances++;
+                            lower[i] -= best == maxMoved ? secondMove : maxMove;
+                            double bound = max(separation[best], lower[i]);
+                            scan = !(sqrt(bestDistance) < bound * (1 - KMEANS_BOUND_SLACK));
+                        }
+                        if(scan){
+                            //Mesma ordem e desempate do Lloyd, então a atribuição é sempre a mesma
+                            double second = DBL_MAX;
+                            best = 0;
+                            bestDistance = DBL_MAX;
+                            for(int c = 0; c < clusters; c++){
+                                double d = squaredDistance(point, &values[c * 8]);
+                                if(d < bestDistance){
+                                    second = bestDistance;
+                                    bestDistance = d;
+                                    best = c;
+                                }else if(d < second)
+                                    second = d;
+                            }
+                            distances += clusters;
+                            if(bounded){
+                                assignment[i] = best;
+                                lower[i] = sqrt(second);
+                            }
+                        }
+                        accumulate(sum + best * 8, points[i]);
+                        count[best]++;
+                        nearest[i] = bestDistance;
+                        partial += bestDistance;
+                    }
+                    chunkInertia[chunk] = partial;
+                    chunkDistances[chunk] = distances;
+                });
+
+                inertia = 0;
+                fill(total.begin(), total.end(), 0.0);
+                fill(totalCount.begin(), totalCount.end(), 0L);
+                for(int chunk = 0; chunk < chunks; chunk++){
+                    inertia += chunkInertia[chunk];
+                    for(int j = 0; j < clusters * 8; j++)
+                        total[j] += sums[chunk * clusters * 8 + j];
+                    for(int c = 0; c < clusters; c++)
+                        totalCount[c] += counts[chunk * clusters + c];
+                    if(stats != NULL)
+                        stats->distances += chunkDistances[chunk];
+                }
+                maxMove = secondMove = 0;
+                maxMoved = -1;
+                for(int c = 0; c < clusters; c++){
+                    if(totalCount[c] > 0)
+                        centers[c] = mean(&total[c * 8], totalCount[c]);
+                    else{
+                        int farthest = max_element(nearest.begin(), nearest.end()) - nearest.begin();
+                        centers[c] = points[farthest];
+                        nearest[farthest] = 0;
+                    }
+                    double moved[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+                    accumulate(moved, centers[c]);
+                    double move = sqrt(squaredDistance(moved, &values[c * 8]));
+                    if(move > maxMove){
+                        secondMove = maxMove;
+                        maxMove = move;
+                        maxMoved = c;
+                    }else if(move > secondMove)
+                        secondMove = move;
+                }
+                iter++;
+                if(stats != NULL)
+                    stats->lloydDistances += (long long)n * clusters;
+                if(previous - inertia <= tolerance * inertia)
+                    break;
+            }
+            if(stats != NULL)
+                stats->iterations = iter;
+            updateLayout();
+            return inertia;
+        }
+
+        /**
+         * trainMiniBatch
+         * Função: Treina o codebook com k-means em mini-lotes (Sculley, "Web-Scale K-Means Clustering", 2010),
+         *         sorteando os frames direto dos arquivos: a memória é a de um lote, qualquer que seja o tamanho das
+         *         bases. Os frames do lote são atribuídos aos centroides do começo do lote e depois cada um move o seu
+         *         centroide com taxa 1/(frames já atribuídos a ele). As sementes vêm do k-means++ sobre uma amostra de
+         *         3 lotes. O estado é gravado no checkpoint a cada checkpointInterval lotes e no fim; se o checkpoint
+         *         já existe o treino continua dele e chega ao mesmo codebook de um treino sem interrupção.
+         *
+         * In: FrameSampler &sampler (Bases de dados)
+         * In: int clusters (Tamanho do codebook)
+         * In: int batchSize (Frames por lote)
+         * In: int batches (Número total de lotes)
+         * In: unsigned int seed (Semente dos sorteios)
+         * In: string checkpoint (Arquivo de checkpoint; vazio desativa)
+         * In: int checkpointInterval (Lotes entre gravações do checkpoint)
+         *
+         * Out: bool sucesso
+         */
+        bool trainMiniBatch(FrameSampler &sampler, int clusters, int batchSize, int batches, unsigned int seed = 42,
+                            string checkpoint = "", int checkpointInterval = 100){
+            if(!sampler.isOpen() || clusters <= 0 || batchSize <= 0)
+                return false;
+            vector<double> values(clusters * 8);
+            vector<long long> counts(clusters, 0);
+            int done = 0;
+            if(checkpoint.empty() || !loadCheckpoint(checkpoint, clusters, values, counts, done)){
+                mt19937 rng = batchGenerator(seed, -1);
+                vector<Centroids> sample(max(3 * batchSize, clusters));
+                for(vector<Centroids>::iterator it = sample.begin(); it != sample.end(); ++it)
+                    if(!sampler.sample(rng, *it))
+                        return false;
+                vector<double> nearest(sample.size(), DBL_MAX);
+                seedCenters(sample, clusters, 1, rng, nearest);
+                for(int c = 0; c < clusters; c++){
+                    fill(&values[c * 8], &values[c * 8] + 8, 0.0);
+                    accumulate(&values[c * 8], (*codebook)[c]);
+                }
+                done = 0;
+            }
+
+            vector<Centroids> batch(batchSize);
+            vector<int> assignment(batchSize);
+            double point[8];
+            for(int b = done; b < batches; b++){
+                mt19937 rng = batchGenerator(seed, b);
+                for(int i = 0; i < batchSize; i++)
+                    if(!sampler.sample(rng, batch[i]))
+                        return false;
+                for(int i = 0; i < batchSize; i++){
+                    fill(point, point + 8, 0.0);
+                    accumulate(point, batch[i]);
+                    int best = 0;
+                    double bestDistance = DBL_MAX;
+                    for(int c = 0; c < clusters; c++){
+                        double d = squaredDistance(point, &values[c * 8]);
+                        if(d < bestDistance){
+                            bestDistance = d;
+                            best = c;
+                        }
+                    }
+                    assignment[i] = best;
+                }
+                for(int i = 0; i < batchSize; i++){
+                    int c = assignment[i];
+                    double rate = 1.0 / ++counts[c];
+                    fill(point, point + 8, 0.0);
+                    accumulate(point, batch[i]);
+                    for(int k = 0; k < 8; k++)
+                        values[c * 8 + k] = (1 - rate) * values[c * 8 + k] + rate * point[k];
+                }
+                if(!checkpoint.empty() && ((b + 1) % checkpointInterval == 0 || b + 1 == batches))
+                    if(!saveCheckpoint(checkpoint, values, counts, b + 1))
+                        cerr << "Error writing " << checkpoint << endl;
+            }
+
+            codebook->clear();
+            tree.clear();
+            search = KMEANS_SEARCH_AUTO;
+            for(int c = 0; c < clusters; c++)
+                codebook->push_back(mean(&values[c * 8], 1));
+            updateLayout();
+            return true;
+        }
+
+        /**
+         * trainTree
+         * Função: Treina um codebook em árvore (tree-structured VQ) com k-means hierárquico: os frames são divididos
+         *         em branching grupos, cada grupo de novo em branching, até depth níveis. As folhas formam o codebook
+         *         (até branching^depth símbolos, numerados em ordem de profundidade) e a busca passa a ser pela
+         *         árvore: branching x depth distâncias por frame, em vez de uma por símbolo, ao custo de às vezes não
+         *         chegar à folha mais próxima. setSearch(KMEANS_SEARCH_FLAT) volta à busca exata nas mesmas folhas.
+         *
+         * In: vector<Centroids> &points (Frames de treino)
+         * In: int branching (Filhos por nó)
+         * In: int depth (Níveis da árvore)
+         * In: int threads (Número de threads de cada k-means)
+         * In: unsigned int seed (Semente; o nó i usa seed + i)
+         * In: int maxIter, double tolerance (Parâmetros de cada k-means)
+         *
+         * Out: int leaves (Tamanho do codebook)
+         */
+        int trainTree(const vector<Centroids> &points, int branching, int depth, int threads = 0, unsigned int seed = 42,
+                      int maxIter = 100, double tolerance = 1e-4){
+            codebook->clear();
+            tree.clear();
+            search = KMEANS_SEARCH_AUTO;
+            if(points.empty() || branching < 1 || depth < 0)
+                return 0;
+            double sum[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+            for(vector<Centroids>::const_iterator it = points.begin(); it != points.end(); ++it)
+                accumulate(sum, *it);
+            TreeNode root = {mean(sum, points.size()), 0, 0, 0, -1};
+            tree.push_back(root);
+            buildTree(0, points, branching, depth, threads, seed, maxIter, tolerance);
+            updateLayout();
+            updateTreeLayout();
+            search = KMEANS_SEARCH_TREE;
+            return codebook->size();
+        }
+
+        /**
+         * setSearch
+         * Função: Escolhe a busca do centroide mais próximo usada por GetNearestCluster e quantize
+         *
+         * In: KMeansSearch mode
+         *
+         * Out: bool sucesso (Falso para KMEANS_SEARCH_TREE em um codebook sem árvore)
+         */
+        bool setSearch(KMeansSearch mode){
+            if(mode == KMEANS_SEARCH_TREE && tree.empty())
+                return false;
+            search = mode;
+            return true;
+        }
+
+        KMeansSearch getSearch() const{ return search; }
+        bool hasTree() const{ return !tree.empty(); }
+
+        /**
+         * saveTree
+         * Função: Grava a árvore do codebook: o número de nós na primeira linha e, por nó, o primeiro filho, o
+         *         número de filhos, o símbolo (-1 nos nós internos) e as 8 coordenadas do centro
+         *
+         * In: string filename (Nome do arquivo)
+         *
+         * Out: bool sucesso
+         */
+        bool saveTree(string filename){
+            fstream file(filename.c_str(), ios::out | ios::trunc);
+            if(!file.is_open() || tree.empty())
+                return false;
+            file.precision(9);
+            file << tree.size() << endl;
+            for(vector<TreeNode>::iterator it = tree.begin(); it != tree.end(); ++it){
+                const float *v = &(*it).center.rightVectorX;
+                file << (*it).first << " " << (*it).children << " " << (*it).symbol;
+                for(int f = 0; f < 8; f++)
+                    file << " " << v[f];
+                file << endl;
+            }
+            file.close();
+            return true;
+        }
+
+        /**
+         * loadTree
+         * Função: Lê uma árvore gravada por saveTree; o codebook passa a ser o das folhas e a busca, pela árvore
+         *
+         * In: string filename (Nome do arquivo)
+         *
+         * Out: bool sucesso (falso também se a árvore é inválida: filho antes do pai ou símbolo de folha repetido)
+         */
+        bool loadTree(string filename){
+            fstream file(filename.c_str(), ios::in);
+            if(!file.is_open())
+                return false;
+            int nodes;
+            if(!(file >> nodes) || nodes < 1)
+                return false;
+            vector<TreeNode> loaded(nodes);
+            int leaves = 0;
+            for(int i = 0; i < nodes; i++){
+                float *v = &loaded[i].center.rightVectorX;
+                file >> loaded[i].first >> loaded[i].children >> loaded[i].symbol;
+                for(int f = 0; f < 8; f++)
+                    file >> v[f];
+                if(loaded[i].children == 0)
+                    leaves++;
+            }
+            if(file.fail())
+                return false;
+            //Os filhos vêm depois do pai (senão a descida pode não terminar) e cada símbolo é de exatamente uma folha
+            vector<Centroids> centers(leaves);
+            vector<bool> seen(leaves, false);
+            for(int i = 0; i < nodes; i++){
+                if(loaded[i].children == 0){
+                    if(loaded[i].symbol < 0 || loaded[i].symbol >= leaves || seen[loaded[i].symbol])
+                        return false;
+                    seen[loaded[i].symbol] = true;
+                    centers[loaded[i].symbol] = loaded[i].center;
+                }else if(loaded[i].children < 0 || loaded[i].first <= i || loaded[i].first + loaded[i].children > nodes)
+                    return false;
+            }
+            *codebook = centers;
+            tree.swap(loaded);
+            updateLayout();
+            updateTreeLayout();
+            search = KMEANS_SEARCH_TREE;
+            return true;
+        }
+
+        /**
+         * save
+         * Função: Grava o codebook no formato lido por KMeans(fstream&): um centroide por linha, 8 valores separados por espaço
+         *
+         * In: string filename (Nome do arquivo)
+         *
+         * Out: bool sucesso
+         */
+        bool save(string filename){
+            fstream file(filename.c_str(), ios::out | ios::trunc);
+            if(!file.is_open())
+                return false;
+            file.precision(9);
+            for(vector<Centroids>::iterator it = codebook->begin(); it != codebook->end(); ++it){
+                //Sem quebra de linha depois do último: ReadFromFile lê até o fim do arquivo e repetiria o último centroide
+                if(it != codebook->begin())
+                    file << endl;
+                file << (*it).rightVectorX << " " << (*it).rightVectorY << " " << (*it).rightVectorZ << " " << (*it).rightHandConfiguration << " "
+                     << (*it).leftVectorX << " " << (*it).leftVectorY << " " << (*it).leftVectorZ << " " << (*it).leftHandConfiguration;
+            }
+            file.close();
+            return true;
+        }
+
         /**
          * GetNearestCluster
-         * Função: Calcula a distância do centroide passado para todos que existem no Codebook
+         * Função: Calcula a distância do centroide passado para todos que existem no Codebook. Compara as distâncias
+         *         ao quadrado (sem sqrt) de 8 centroides por vez com AVX, quando o processador tem. Codebooks com
+         *         KMEANS_KDTREE_CLUSTERS centroides ou mais usam a KD-tree, com o mesmo resultado (ver setSearch)
          * 
          * In: Centroids coordinates (Coordenadas recebidas)
          * 
-         * Out: int clstNumb (Número do cluster em que a coordenada pertence)
+         * Out: int clstNumb (Número do cluster em que a coordenada pertence, -1 se o codebook está vazio)
          */
         int GetNearestCluster(Centroids coordinates){
             if(isEmpty())
                 return -1;
+            if(search == KMEANS_SEARCH_TREE)
+                return treeNearest(&coordinates.rightVectorX);
+            if(layoutClusters != (int)codebook->size())
+                updateLayout();
+            if(resolvedSearch() == KMEANS_SEARCH_KDTREE)
+                return kdNearest(&coordinates.rightVectorX);
+            return nearestBlocks(alignedLayout(), (layoutClusters + KMEANS_LANES - 1) / KMEANS_LANES, &coordinates.rightVectorX);
+        }
 
-            int clstNumb = 0, currClst = 0;
-            float minDst = 10000;
-
-            for(vector<Centroids>::iterator cluster = codebook->begin(); cluster != codebook->end(); ++cluster){
-                float dXr = (*cluster).rightVectorX - coordinates.rightVectorX;                        
-                dXr *= dXr;
-                float dYr = (*cluster).rightVectorY - coordinates.rightVectorY;
-                dYr *= dYr;
-                float dZr = (*cluster).rightVectorZ - coordinates.rightVectorZ;
-                dZr *= dZr;
-                float dHCr = (*cluster).rightHandConfiguration - coordinates.rightHandConfiguration;
-                dHCr *= dHCr;
-
-                float dXl = (*cluster).leftVectorX - coordinates.leftVectorX;
-                dXl *= dXl;
-                float dYl = (*cluster).leftVectorY - coordinates.leftVectorY;
-                dYl *= dYl;
-                float dZl = (*cluster).leftVectorZ - coordinates.leftVectorZ;
-                dZl *= dZl;
-                float dHCl = (*cluster).leftHandConfiguration - coordinates.leftHandConfiguration;
-                dHCl *= dHCl;
+        /**
+         * GetNearestClusterScalar
+         * Função: GetNearestCluster sem AVX, para comparação
+         */
+        int GetNearestClusterScalar(Centroids coordinates){
+            if(isEmpty())
+                return -1;
+            if(layoutClusters != (int)codebook->size())
+                updateLayout();
+            return nearestScalar(alignedLayout(), (layoutClusters + KMEANS_LANES - 1) / KMEANS_LANES, &coordinates.rightVectorX);
+        }
 
-                float d = sqrt(dXr + dYr + dZr + dHCr + dXl + dYl + dZl + dHCl);
-                if(d < minDst){
-                    minDst = d;
-                    clstNumb = currClst;
+        /**
+         * coherentNearest
+         * Função: GetNearestCluster partindo do símbolo do frame anterior, para fluxos em que frames seguidos caem no
+         *         mesmo centroide ou em um vizinho. Pela desigualdade triangular, um centroide j com
+         *         d(anterior, j) > d(x, anterior) + d(x, melhor) não pode ser o mais próximo; os vizinhos do anterior
+         *         são visitados do mais próximo ao mais distante até essa condição valer para o resto da lista. Se a
+         *         lista acaba antes, a busca é a de GetNearestCluster. O resultado é sempre o de GetNearestCluster.
+         *
+         * In: int previous (Símbolo do frame anterior, -1 se não há)
+         * In: Centroids &coordinates (Frame atual)
+         * In: long long &distances (Contador de distâncias frame-centroide calculadas)
+         *
+         * Out: int clstNumb (Símbolo do frame)
+         * Out: long long &distances
+         */
+        int coherentNearest(int previous, const Centroids &coordinates, long long &distances){
+            if(isEmpty())
+                return -1;
+            if(layoutClusters != (int)codebook->size())
+                updateLayout();
+            if(previous < 0 || previous >= layoutClusters || search == KMEANS_SEARCH_TREE)
+                return countedNearest(coordinates, distances);
+            if(neighborCount < 0)
+                updateNeighbors();
+
+            const float *x = &coordinates.rightVectorX;
+            int best = previous;
+            float bestDistance = exactDistance(&(*codebook)[previous].rightVectorX, x);
+            double fromPrevious = sqrt((double)bestDistance), bestRoot = fromPrevious;
+            distances++;
+            const int *candidates = &neighbors[previous * neighborCount];
+            const double *gaps = &neighborDistances[previous * neighborCount];
+            for(int k = 0; k < neighborCount; k++){
+                if(gaps[k] > (fromPrevious + bestRoot) * (1 + KMEANS_KDTREE_SLACK))
+                    return best;
+                int c = candidates[k];
+                float d = exactDistance(&(*codebook)[c].rightVectorX, x);
+                distances++;
+                if(d < bestDistance || (d == bestDistance && c < best)){
+                    best = c;
+                    bestDistance = d;
+                    bestRoot = sqrt((double)d);
                 }
-                currClst++;
             }
-
-            return clstNumb;
+            if(neighborCount == layoutClusters - 1)
+                return best;
+            return countedNearest(coordinates, distances);
         }
 
-        vector<int>* returnObservations(vector<Centroids>* clusters){
+        /**
+         * frameObservation
+         * Função: Quantiza um único frame, para o reconhecimento quadro a quadro durante a gravação
+         *
+         * In: Frame &frame (Frame atual)
+         *
+         * Out: int clstNumb (Símbolo do frame)
+         */
+        int frameObservation(Frame &frame){
+            Centroids c = {frame.rightVectorX, frame.rightVectorY, frame.rightVectorZ, (float)frame.handConfigurationRight,
+                           frame.leftVectorX, frame.leftVectorY, frame.leftVectorZ, (float)frame.handConfigurationLeft};
+            return GetNearestCluster(c);
+        }
 
-            vector<int>* observations = new vector<int>();
+        /**
+         * quantize
+         * Função: Quantiza um lote de frames de uma vez (bases de dados inteiras), com o mesmo resultado de
+         *         GetNearestCluster em cada frame. Os frames são divididos em tarefas de KMEANS_CHUNK_SIZE entre as
+         *         threads, e cada tarefa calcula a matriz de distâncias frame-centroide em tiles de
+         *         KMEANS_TILE_POINTS frames como ||c||² - 2x·c, seguida do argmin vetorizado de cada linha.
+         *
+         * In: vector<Centroids> &points (Frames)
+         * In: vector<int> &symbols (Símbolo de cada frame)
+         * In: int threads (Número de threads, se <= 0 usa defaultThreadCount())
+         *
+         * Out: vector<int> &symbols
+         * Out: long long fallbacks (Frames com mais de um centroide dentro do erro da expansão, decididos pela
+         *      distância exata)
+         */
+        long long quantize(const vector<Centroids> &points, vector<int> &symbols, int threads = 0){
+            int n = points.size();
+            symbols.resize(n);
+            if(isEmpty()){
+                fill(symbols.begin(), symbols.end(), -1);
+                return 0;
+            }
+            if(layoutClusters != (int)codebook->size())
+                updateLayout();
+            int chunks = (n + KMEANS_CHUNK_SIZE - 1) / KMEANS_CHUNK_SIZE;
+            vector<long long> fallbacks(chunks, 0);
+            parallelFor(chunks, threads, [&](int chunk){
+                vector<float> tile;
+                quantizeRange(&points[0], chunk * KMEANS_CHUNK_SIZE, min(n, (chunk + 1) * KMEANS_CHUNK_SIZE), &symbols[0], tile, fallbacks[chunk]);
+            });
+            long long total = 0;
+            for(int chunk = 0; chunk < chunks; chunk++)
+                total += fallbacks[chunk];
+            return total;
+        }
 
-            for(vector<Centroids>::iterator coord = clusters->begin(); coord != clusters->end(); ++coord){
-                int code = GetNearestCluster(*coord);
-                observations->push_back(code);
+        /**
+         * quantize
+         * Função: Quantiza n frames na thread atual escrevendo no buffer de quem chama, com o mesmo resultado de
+         *         GetNearestCluster. Não aloca memória quando o scratch já foi usado com n frames ou mais e o codebook
+         *         não mudou desde a última quantização.
+         *
+         * In: Centroids *points (n frames)
+         * In: int n (Número de frames)
+         * In: int *symbols (n símbolos)
+         * In: QuantizationScratch &scratch (Buffers reutilizados entre chamadas)
+         *
+         * Out: int *symbols
+         * Out: long long fallbacks (Como no quantize acima)
+         */
+        long long quantize(const Centroids *points, int n, int *symbols, QuantizationScratch &scratch){
+            if(isEmpty()){
+                fill(symbols, symbols + n, -1);
+                return 0;
             }
+            if(layoutClusters != (int)codebook->size())
+                updateLayout();
+            long long fallbacks = 0;
+            if(n > 0)
+                quantizeRange(points, 0, n, symbols, scratch.tile, fallbacks);
+            return fallbacks;
+        }
 
-            return observations;
+        /**
+         * returnObservations
+         * Função: Símbolo de cada frame
+         *
+         * In: vector<Centroids> &clusters (Frames)
+         * In: vector<int> &observations (Símbolos)
+         *
+         * Out: vector<int> &observations
+         */
+        void returnObservations(const vector<Centroids> &clusters, vector<int> &observations){
+            quantize(clusters, observations);
         }
 
 
@@ -265,28 +1753,19 @@ class KMeans{
          */
         void lootStrategy(Mat& sequence, Mat& subSequence){
             cout << "Sequence Rows: " << sequence.rows << endl;
-            vector<int> observation;
-            vector<int> loot;
 
             int rowSize = sequence.cols * sequence.rows;
             int columnSize = sequence.cols - 1;
-            subSequence = cv::Mat(rowSize, columnSize, CV_32SC1);
+            subSequence = cv::Mat(rowSize, columnSize, sequence.type());
 
             int k = 0;
-            int p = 0;
             for(int r = 0; r<sequence.rows; r++){
-                sequence.row(r).copyTo(observation);
-                
-                for(int i = 0; i<observation.size(); i++){
-                    loot = observation;
-                    loot.erase(loot.begin()+i);
-
-                    for(int c=0; c<subSequence.cols; c++){
-                        subSequence.at<int>(k,c) = loot[p];
-                        p++;
-                    }
+                for(int i = 0; i<sequence.cols; i++){
+                    int p = 0;
+                    for(int c=0; c<sequence.cols; c++)
+                        if(c != i)
+                            cvhmmSetSymbol(subSequence, k, p++, cvhmmSymbol(sequence, r, c));
                     k++;
-                    p = 0;
                 }
             }
         }
@@ -309,7 +1788,7 @@ class KMeans{
             if(!file.is_open())
                 return;
 
-            vector<Centroids>* coordinates = new vector<Centroids>();
+            vector<Centroids> coordinates;
             
             float rVx, rVy, rVz, rHc;
             float lVx, lVy, lVz, lHc;
@@ -319,20 +1798,18 @@ class KMeans{
                 file >> lVx >> lVy >> lVz >> lHc;
 
                 Centroids c = {rVx, rVy, rVz, rHc, lVx, lVy, lVz, lHc};
-                coordinates->push_back(c);
+                coordinates.push_back(c);
             }
             file.close();
 
-            vector<int> *observationsVector = returnObservations(coordinates);
-            int nmbSeq = (int)(observationsVector->size()/gestureSize);
-            observationsMat = cv::Mat(nmbSeq, gestureSize, CV_32SC1);
-            
-            vector<int>::iterator it = observationsVector->begin();
-            for(int r = 0; r < observationsMat.rows; r++){
-                for(int c = 0; c < observationsMat.cols; c++){
-                    observationsMat.at<int>(r,c) = (*it);
-                    ++it;
-                }
+            //Só os frames das sequências completas são quantizados; a matriz usa o menor tipo que cabe o codebook
+            int nmbSeq = (int)(coordinates.size()/gestureSize);
+            observationsMat = cv::Mat(nmbSeq, gestureSize, cvhmmSymbolDepth(getClusterNumber()));
+            if(nmbSeq > 0){
+                QuantizationScratch scratch;
+                scratch.symbols.resize(nmbSeq * gestureSize);
+                quantize(&coordinates[0], nmbSeq * gestureSize, &scratch.symbols[0], scratch);
+                cvhmmStoreSymbols(&scratch.symbols[0], nmbSeq * gestureSize, observationsMat.ptr(0), observationsMat.depth());
             }
     
             lootStrategy(observationsMat, subSeq);
@@ -340,46 +1817,559 @@ class KMeans{
 
 
 
+        /**
+         * lootStrategy
+         * Função: LOOT para sequências de tamanhos diferentes: cada sequência de tamanho T gera T subsequências de tamanho T-1
+         *
+         * In: vector<Mat> &sequences (Sequências originais, uma matriz 1 x T por instância)
+         * In: vector<Mat> &subSequences (Subsequências)
+         *
+         * Out: vector<Mat> &subSequences
+         */
+        void lootStrategy(vector<Mat> &sequences, vector<Mat> &subSequences){
+            cout << "Sequence Rows: " << sequences.size() << endl;
+            subSequences.clear();
+            for(vector<Mat>::iterator it = sequences.begin(); it != sequences.end(); ++it){
+                int size = (*it).cols;
+                if(size < 2)
+                    continue;
+                for(int i = 0; i < size; i++){
+                    Mat loot(1, size - 1, (*it).type());
+                    int p = 0;
+                    for(int c = 0; c < size; c++)
+                        if(c != i)
+                            cvhmmSetSymbol(loot, 0, p++, cvhmmSymbol(*it, 0, c));
+                    subSequences.push_back(loot);
+                }
+            }
+        }
+
+        /**
+         * getVariableGestureObservations
+         * Função: Lê uma base de dados com instâncias de tamanhos diferentes. Cada instância é um bloco de linhas
+         *         (um frame por linha) e as instâncias são separadas por uma linha em branco. Arquivos sem linhas em
+         *         branco (o formato antigo) são divididos em blocos de gestureSize frames.
+         *
+         * In: string filename (Nome do arquivo para obter as observacoes)
+         * In: int gestureSize (Número de frames do gesto no formato antigo)
+         * In: vector<Mat> &sequences (Uma matriz 1 x T por instância)
+         *
+         * Out: vector<Mat> &sequences
+         * Out: bool sucesso (Falso se o arquivo não pode ser aberto)
+         */
+        bool getVariableGestureObservations(string filename, int gestureSize, vector<Mat> &sequences){
+            sequences.clear();
+            fstream file(filename.c_str(), ios::in);
+            if(!file.is_open())
+                return false;
+
+            vector<int> lengths;
+            vector<int> symbols;
+            int current = 0;
+            bool separated = false;
+            string line;
+            while(getline(file, line)){
+                Centroids c;
+                stringstream ss(line);
+                if(!(ss >> c.rightVectorX >> c.rightVectorY >> c.rightVectorZ >> c.rightHandConfiguration
+                        >> c.leftVectorX >> c.leftVectorY >> c.leftVectorZ >> c.leftHandConfiguration)){
+                    //Linha em branco: fim da instância
+                    if(current > 0)
+                        lengths.push_back(current);
+                    current = 0;
+                    separated = true;
+                    continue;
+                }
+                symbols.push_back(GetNearestCluster(c));
+                current++;
+            }
+            file.close();
+            if(current > 0)
+                lengths.push_back(current);
+
+            if(!separated)
+                lengths.assign(symbols.size() / gestureSize, gestureSize);
+
+            int first = 0, depth = cvhmmSymbolDepth(getClusterNumber());
+            for(vector<int>::iterator length = lengths.begin(); length != lengths.end(); ++length){
+                Mat seq(1, *length, depth);
+                cvhmmStoreSymbols(&symbols[first], *length, seq.ptr(0), depth);
+                sequences.push_back(seq);
+                first += *length;
+            }
+            return true;
+        }
+
+
+
         /**
          * realTimeObservations
-         * Função: Calcula a sequência de observações dado um vetor de coordenadas
+         * Função: Calcula a sequência de observações dado um vetor de coordenadas, sem alocar memória depois que o
+         *         scratch já recebeu uma janela do mesmo tamanho ou maior. A matriz aponta para scratch.storage: é
+         *         válida até a próxima chamada com o mesmo scratch (clone() para guardar).
          * 
-         * In: vector<Frame>* framesBuffer (Buffer onde está armazenadas as coordenadas)
+         * In: vector<Frame> &framesBuffer (Buffer onde está armazenadas as coordenadas)
          * In: int gestureSize (Número de frames do gesto)
          * In: Mat &observationsMat (Matriz de observações)
+         * In: QuantizationScratch &scratch (Buffers reutilizados entre chamadas)
          * 
-         * Out: Mat &observationsMat (Matriz de observações)
+         * Out: Mat &observationsMat (Matriz de observações, framesBuffer.size()/gestureSize x gestureSize)
         */ 
+        void realTimeObservations(const vector<Frame> &framesBuffer, int gestureSize, cv::Mat &observationsMat, QuantizationScratch &scratch){
+            int nmbSeq = gestureSize > 0 ? (int)(framesBuffer.size()/gestureSize) : 0;
+            int n = nmbSeq * gestureSize;
+            int depth = cvhmmSymbolDepth(getClusterNumber());
+            if((int)scratch.frames.size() < n)
+                scratch.frames.resize(n);
+            if((int)scratch.symbols.size() < n)
+                scratch.symbols.resize(n);
+            if(scratch.storage.size() < max(n, 1) * cvhmmSymbolSize(depth))
+                scratch.storage.resize(max(n, 1) * cvhmmSymbolSize(depth));
+            for(int i = 0; i < n; i++){
+                const Frame &f = framesBuffer[i];
+                Centroids c = {f.rightVectorX, f.rightVectorY, f.rightVectorZ, (float)f.handConfigurationRight,
+                               f.leftVectorX, f.leftVectorY, f.leftVectorZ, (float)f.handConfigurationLeft};
+                scratch.frames[i] = c;
+            }
+            if(n > 0){
+                quantize(&scratch.frames[0], n, &scratch.symbols[0], scratch);
+                cvhmmStoreSymbols(&scratch.symbols[0], n, &scratch.storage[0], depth);
+            }
+            observationsMat = cv::Mat(nmbSeq, gestureSize, depth, &scratch.storage[0]);
+        }
+
+        /**
+         * realTimeObservations
+         * Função: Como acima, com uma matriz própria (aloca a cada chamada)
+         */
         void realTimeObservations(vector<Frame>* framesBuffer, int gestureSize, cv::Mat &observationsMat){
-            vector<Centroids>* coordinates = new vector<Centroids>();
-            
-            float rVx, rVy, rVz, rHc;
-            float lVx, lVy, lVz, lHc;
+            QuantizationScratch scratch;
+            cv::Mat observations;
+            realTimeObservations(*framesBuffer, gestureSize, observations, scratch);
+            observationsMat = observations.clone();
+        }
+};
 
-            for(vector<Frame>::iterator it = framesBuffer->begin(); it != framesBuffer->end(); ++it){
-                rVx = (*it).rightVectorX;
-                rVy = (*it).rightVectorY;
-                rVz = (*it).rightVectorZ;
-                rHc = (*it).handConfigurationRight;
-                lVx = (*it).leftVectorX;
-                lVy = (*it).leftVectorY;
-                lVz = (*it).leftVectorZ;
-                lHc = (*it).handConfigurationLeft;
 
-                Centroids c = {rVx, rVy, rVz, rHc, lVx, lVy, lVz, lHc};
-                coordinates->push_back(c);
+/**
+ * StreamingQuantizer
+ * Quantização quadro a quadro de um usuário rastreado: cada frame começa a busca pelo símbolo do frame anterior
+ * (KMeans::coherentNearest), com o mesmo símbolo de KMeans::frameObservation. Um por usuário, sobre o mesmo codebook.
+ * Codebooks com menos de KMEANS_COHERENT_CLUSTERS centroides usam a busca de GetNearestCluster, que nesses tamanhos
+ * é mais rápida que visitar os vizinhos.
+ */
+class StreamingQuantizer{
+    private:
+        KMeans *codebook;
+        int previous;
+        long long frames, distances;
+
+    public:
+        StreamingQuantizer(KMeans *c) : codebook(c), previous(-1), frames(0), distances(0){}
+
+        /**
+         * push
+         * Função: Quantiza o próximo frame do usuário
+         *
+         * In: Frame &frame (Frame atual)
+         *
+         * Out: int clstNumb (Símbolo do frame)
+         */
+        int push(Frame &frame){
+            Centroids c = {frame.rightVectorX, frame.rightVectorY, frame.rightVectorZ, (float)frame.handConfigurationRight,
+                           frame.leftVectorX, frame.leftVectorY, frame.leftVectorZ, (float)frame.handConfigurationLeft};
+            return push(c);
+        }
+
+        int push(const Centroids &coordinates){
+            bool coherent = codebook->getClusterNumber() >= KMEANS_COHERENT_CLUSTERS;
+            previous = codebook->coherentNearest(coherent ? previous : -1, coordinates, distances);
+            frames++;
+            return previous;
+        }
+
+        /**
+         * reset
+         * Função: Esquece o frame anterior (usuário perdido ou trocado)
+         */
+        void reset(){
+            previous = -1;
+        }
+
+        /**
+         * averageDistances
+         * Função: Média de distâncias frame-centroide calculadas por frame (a busca linear calcula uma por centroide)
+         */
+        double averageDistances() const{
+            return frames > 0 ? (double)distances / frames : 0;
+        }
+
+        long long getFrames() const{ return frames; }
+};
+
+
+/**
+ * LookupQuantizer
+ * Quantização por tabela: o espaço dos frames é dividido em uma grade (as configurações de mão, que são valores de HC,
+ * têm uma célula por valor; os vetores, células iguais com o tamanho proporcional à faixa de cada característica nos
+ * frames de treino) e cada célula guarda o símbolo do centroide mais próximo de todos os seus pontos. Um frame custa
+ * o cálculo da célula e uma leitura. Células em que mais de um centroide é o mais próximo de algum ponto, e frames
+ * fora da grade, usam KMeans::GetNearestCluster. A tabela é montada a partir do codebook e deve ser refeita se ele mudar.
+ */
+class LookupQuantizer{
+    private:
+        KMeans *codebook;
+        float low[8], width[8];
+        int bins[8];
+        long long strides[8];
+        vector<unsigned short> table;
+        long long lookups, fallbacks;
+
+        static bool isDiscrete(int f){
+            return f == 3 || f == 7;    //rightHandConfiguration e leftHandConfiguration
+        }
+
+        /**
+         * cellOf
+         * Função: Índice da célula do frame na tabela, ou -1 se ele está fora da grade
+         */
+        long long cellOf(const float *x) const{
+            long long cell = 0;
+            for(int f = 0; f < 8; f++){
+                float position = (x[f] - low[f]) / width[f];
+                if(!(position >= 0))
+                    return -1;
+                int bin = (int)position;
+                if(isDiscrete(f) && bin != position)
+                    return -1;
+                if(bin >= bins[f]){
+                    if(isDiscrete(f) || x[f] > low[f] + width[f] * bins[f])
+                        return -1;
+                    bin = bins[f] - 1;
+                }
+                cell += bin * strides[f];
             }
+            return cell;
+        }
 
-            vector<int> *observationsVector = returnObservations(coordinates);
-            int nmbSeq = (int)(observationsVector->size()/gestureSize);
-            observationsMat = cv::Mat(nmbSeq, gestureSize, CV_32SC1);
-            
-            vector<int>::iterator it = observationsVector->begin();
-            for(int r = 0; r < observationsMat.rows; r++){
-                for(int c = 0; c < observationsMat.cols; c++){
-                    observationsMat.at<int>(r,c) = (*it);
-                    ++it;
+        /**
+         * owner
+         * Função: Centroide mais próximo de todos os pontos da caixa [lo, hi], ou LOOKUP_AMBIGUOUS. O centroide c do
+         *         centro da caixa é o dono se, para todo outro j, ||x-c||² - ||x-j||² (linear em x) fica negativo,
+         *         com margem, no canto da caixa que o maximiza
+         */
+        static unsigned short owner(const vector<Centroids> &centers, const double *norms, const double *lo, const double *hi){
+            int clusters = centers.size();
+            double center[8];
+            for(int f = 0; f < 8; f++)
+                center[f] = (lo[f] + hi[f]) / 2;
+            int best = 0;
+            double bestDistance = DBL_MAX;
+            for(int c = 0; c < clusters; c++){
+                const float *v = &centers[c].rightVectorX;
+                double d = 0;
+                for(int f = 0; f < 8; f++)
+                    d += (center[f] - v[f]) * (center[f] - v[f]);
+                if(d < bestDistance){
+                    bestDistance = d;
+                    best = c;
+                }
+            }
+            double extent = 0;
+            for(int f = 0; f < 8; f++)
+                extent += max(lo[f] * lo[f], hi[f] * hi[f]);
+            const float *c = &centers[best].rightVectorX;
+            for(int j = 0; j < clusters; j++){
+                if(j == best)
+                    continue;
+                const float *v = &centers[j].rightVectorX;
+                double worst = norms[best] - norms[j];
+                for(int f = 0; f < 8; f++){
+                    double slope = 2.0 * ((double)v[f] - c[f]);
+                    worst += max(slope * lo[f], slope * hi[f]);
                 }
+                if(worst >= -KMEANS_KDTREE_SLACK * (1 + norms[best] + norms[j] + extent))
+                    return LOOKUP_AMBIGUOUS;
             }
+            return best;
         }
-};
\ No newline at end of file
+
+    public:
+        /**
+         * LookupQuantizer
+         * Função: Monta a tabela do codebook
+         *
+         * In: KMeans *codebook (Codebook, com menos de 65535 centroides)
+         * In: vector<Centroids> &frames (Frames de treino, que definem a faixa da grade em cada característica)
+         * In: long long maxCells (Número máximo de células da tabela)
+         */
+        LookupQuantizer(KMeans *c, const vector<Centroids> &frames, long long maxCells = 1 << 22) : codebook(c), lookups(0), fallbacks(0){
+            float high[8];
+            for(int f = 0; f < 8; f++){
+                low[f] = isDiscrete(f) ? HC_error : FLT_MAX;
+                high[f] = isDiscrete(f) ? HC_zoomOut : -FLT_MAX;
+            }
+            for(vector<Centroids>::const_iterator it = frames.begin(); it != frames.end(); ++it)
+                for(int f = 0; f < 8; f++)
+                    if(!isDiscrete(f)){
+                        low[f] = min(low[f], (&(*it).rightVectorX)[f]);
+                        high[f] = max(high[f], (&(*it).rightVectorX)[f]);
+                    }
+
+            //Células contínuas com o mesmo lado em todas as características: bins proporcionais à faixa
+            long long discreteCells = 1;
+            double volume = 1;
+            int continuous = 0;
+            for(int f = 0; f < 8; f++){
+                if(isDiscrete(f))
+                    discreteCells *= HC_zoomOut - HC_error + 1;
+                else if(high[f] > low[f]){
+                    volume *= high[f] - low[f];
+                    continuous++;
+                }
+            }
+            double side = continuous > 0 ? pow(volume / max(1.0, (double)maxCells / discreteCells), 1.0 / continuous) : 1;
+            long long cells = 1;
+            for(int f = 7; f >= 0; f--){
+                if(isDiscrete(f)){
+                    bins[f] = HC_zoomOut - HC_error + 1;
+                    width[f] = 1;
+                }else{
+                    bins[f] = high[f] > low[f] ? max(1, (int)((high[f] - low[f]) / side)) : 1;
+                    width[f] = high[f] > low[f] ? (high[f] - low[f]) / bins[f] : 1;
+                }
+                strides[f] = cells;
+                cells *= bins[f];
+            }
+
+            vector<Centroids> &centers = *codebook->returnCentroids();
+            if(frames.empty() || centers.empty() || centers.size() >= LOOKUP_AMBIGUOUS){
+                table.assign(1, LOOKUP_AMBIGUOUS);
+                for(int f = 0; f < 8; f++)
+                    width[f] = 0;   //cellOf devolve -1 para qualquer frame
+                return;
+            }
+            vector<double> norms(centers.size());
+            for(size_t k = 0; k < centers.size(); k++)
+                norms[k] = KMeans::squaredDistance(centers[k], Centroids());
+            table.resize(cells);
+            double lo[8], hi[8];
+            for(long long cell = 0; cell < cells; cell++){
+                for(int f = 0; f < 8; f++){
+                    int bin = (cell / strides[f]) % bins[f];
+                    lo[f] = low[f] + (double)width[f] * bin;
+                    hi[f] = isDiscrete(f) ? lo[f] : lo[f] + width[f];
+                }
+                table[cell] = owner(centers, &norms[0], lo, hi);
+            }
+        }
+
+        /**
+         * quantize
+         * Função: Símbolo do frame, pela tabela ou, em células ambíguas e fora da grade, por GetNearestCluster
+         *
+         * In: Centroids &coordinates (Frame)
+         *
+         * Out: int clstNumb (Símbolo do frame)
+         */
+        int quantize(const Centroids &coordinates){
+            lookups++;
+            long long cell = cellOf(&coordinates.rightVectorX);
+            if(cell >= 0 && table[cell] != LOOKUP_AMBIGUOUS)
+                return table[cell];
+            fallbacks++;
+            return codebook->GetNearestCluster(coordinates);
+        }
+
+        int quantize(Frame &frame){
+            Centroids c = {frame.rightVectorX, frame.rightVectorY, frame.rightVectorZ, (float)frame.handConfigurationRight,
+                           frame.leftVectorX, frame.leftVectorY, frame.leftVectorZ, (float)frame.handConfigurationLeft};
+            return quantize(c);
+        }
+
+        /**
+         * resolvedCells
+         * Função: Fração das células da tabela com um único centroide mais próximo
+         */
+        double resolvedCells() const{
+            long long resolved = 0;
+            for(vector<unsigned short>::const_iterator it = table.begin(); it != table.end(); ++it)
+                resolved += *it != LOOKUP_AMBIGUOUS;
+            return (double)resolved / table.size();
+        }
+
+        /**
+         * fallbackRate
+         * Função: Fração dos frames quantizados desde a construção ou o último resetStatistics que precisaram de
+         *         GetNearestCluster
+         */
+        double fallbackRate() const{
+            return lookups > 0 ? (double)fallbacks / lookups : 0;
+        }
+
+        void resetStatistics(){
+            lookups = fallbacks = 0;
+        }
+
+        size_t getTableBytes() const{ return table.size() * sizeof(unsigned short); }
+        int getBins(int feature) const{ return bins[feature]; }
+};
+
+
+/**
+ * ProductQuantizer
+ * Quantização por produto: as duas mãos são quantizadas separadamente, cada uma com o seu codebook (um KMeans com os
+ * 4 valores da outra mão em zero), e o símbolo do frame é o par, direita * leftClusters + esquerda. O alfabeto tem
+ * rightClusters * leftClusters símbolos pelo custo de busca de dois codebooks pequenos. Os HMMs sobre esse alfabeto
+ * devem usar HMM::setProductAlphabet(getLeftClusters()), que fatora a emissão de cada estado por mão.
+ */
+class ProductQuantizer{
+    private:
+        KMeans *right, *left;
+
+        /**
+         * hand
+         * Função: Frame com os valores de uma mão (0 direita, 1 esquerda) e os da outra em zero
+         */
+        static Centroids hand(const Centroids &coordinates, int side){
+            Centroids c = coordinates;
+            float *other = side == 0 ? &c.leftVectorX : &c.rightVectorX;
+            for(int f = 0; f < 4; f++)
+                other[f] = 0;
+            return c;
+        }
+
+        static KMeans* loadHand(string filename){
+            fstream file(filename.c_str(), ios::in);
+            if(!file.is_open())
+                return NULL;
+            KMeans *codebook = new KMeans(file);
+            file.close();
+            return codebook;
+        }
+
+        ProductQuantizer(const ProductQuantizer&);
+        ProductQuantizer& operator=(const ProductQuantizer&);
+
+    public:
+        ProductQuantizer() : right(new KMeans()), left(new KMeans()){}
+
+        ~ProductQuantizer(){
+            delete right;
+            delete left;
+        }
+
+        /**
+         * train
+         * Função: Treina o codebook de cada mão com KMeans::train sobre os valores daquela mão
+         *
+         * In: vector<Centroids> &points (Frames de treino)
+         * In: int rightClusters, leftClusters (Tamanho do codebook de cada mão)
+         * In: int threads, unsigned int seed, int maxIter, double tolerance (Como em KMeans::train)
+         *
+         * Out: double inertia (Soma das inércias das duas mãos, comparável à inércia de um codebook conjunto)
+         */
+        double train(const vector<Centroids> &points, int rightClusters, int leftClusters, int threads = 0, unsigned int seed = 42,
+                     int maxIter = 100, double tolerance = 1e-4){
+            vector<Centroids> halves(points.size());
+            for(size_t i = 0; i < points.size(); i++)
+                halves[i] = hand(points[i], 0);
+            double inertia = right->train(halves, rightClusters, threads, seed, maxIter, tolerance);
+            for(size_t i = 0; i < points.size(); i++)
+                halves[i] = hand(points[i], 1);
+            return inertia + left->train(halves, leftClusters, threads, seed, maxIter, tolerance);
+        }
+
+        /**
+         * save | load
+         * Função: Grava e lê os codebooks das mãos em <filename>.right e <filename>.left, no formato de KMeans::save
+         *
+         * In: string filename (Prefixo dos arquivos)
+         *
+         * Out: bool sucesso
+         */
+        bool save(string filename){
+            return right->save(filename + ".right") && left->save(filename + ".left");
+        }
+
+        bool load(string filename){
+            KMeans *r = loadHand(filename + ".right"), *l = loadHand(filename + ".left");
+            if(r == NULL || l == NULL || r->isEmpty() || l->isEmpty()){
+                delete r;
+                delete l;
+                return false;
+            }
+            delete right;
+            delete left;
+            right = r;
+            left = l;
+            return true;
+        }
+
+        /**
+         * GetNearestCluster
+         * Função: Símbolo do par de centroides mais próximos, um por mão
+         *
+         * In: Centroids coordinates (Coordenadas recebidas)
+         *
+         * Out: int clstNumb (direita * getLeftClusters() + esquerda, -1 se um dos codebooks está vazio)
+         */
+        int GetNearestCluster(const Centroids &coordinates){
+            if(right->isEmpty() || left->isEmpty())
+                return -1;
+            return right->GetNearestCluster(hand(coordinates, 0)) * left->getClusterNumber() + left->GetNearestCluster(hand(coordinates, 1));
+        }
+
+        int frameObservation(Frame &frame){
+            Centroids c = {frame.rightVectorX, frame.rightVectorY, frame.rightVectorZ, (float)frame.handConfigurationRight,
+                           frame.leftVectorX, frame.leftVectorY, frame.leftVectorZ, (float)frame.handConfigurationLeft};
+            return GetNearestCluster(c);
+        }
+
+        /**
+         * quantize
+         * Função: Quantiza um lote de frames com KMeans::quantize em cada mão, com o mesmo resultado de GetNearestCluster
+         *
+         * In: vector<Centroids> &points (Frames)
+         * In: vector<int> &symbols (Símbolo de cada frame)
+         * In: int threads (Número de threads, se <= 0 usa defaultThreadCount())
+         *
+         * Out: vector<int> &symbols
+         */
+        void quantize(const vector<Centroids> &points, vector<int> &symbols, int threads = 0){
+            vector<Centroids> halves(points.size());
+            vector<int> leftSymbols;
+            for(size_t i = 0; i < points.size(); i++)
+                halves[i] = hand(points[i], 0);
+            right->quantize(halves, symbols, threads);
+            for(size_t i = 0; i < points.size(); i++)
+                halves[i] = hand(points[i], 1);
+            left->quantize(halves, leftSymbols, threads);
+            int L = left->getClusterNumber();
+            for(size_t i = 0; i < points.size(); i++)
+                symbols[i] = symbols[i] < 0 || leftSymbols[i] < 0 ? -1 : symbols[i] * L + leftSymbols[i];
+        }
+
+        /**
+         * reconstruct
+         * Função: Frame representado por um símbolo (o centroide da direita com o da esquerda)
+         */
+        Centroids reconstruct(int symbol){
+            int L = left->getClusterNumber();
+            Centroids c = (*right->returnCentroids())[symbol / L];
+            const Centroids &l = (*left->returnCentroids())[symbol % L];
+            c.leftVectorX = l.leftVectorX;
+            c.leftVectorY = l.leftVectorY;
+            c.leftVectorZ = l.leftVectorZ;
+            c.leftHandConfiguration = l.leftHandConfiguration;
+            return c;
+        }
+
+        int getClusterNumber(){ return right->getClusterNumber() * left->getClusterNumber(); }
+        int getRightClusters(){ return right->getClusterNumber(); }
+        int getLeftClusters(){ return left->getClusterNumber(); }
+        KMeans* getRight(){ return right; }
+        KMeans* getLeft(){ return left; }
+};
+
+#endif //KMEANS_HPP
@@ -10,6 +10,8 @@
 //  Includes
 //-----------------------------------------------------------------------
 #include "HMM.hpp"
+#include "Recognizer.hpp"
+#include "Spotter.hpp"
 #include "NeuralNetwork.hpp"
 #include "XLibInput.hpp"
 
@@ -18,6 +20,22 @@
 //-----------------------------------------------------------------------
 #define MAX_BUFFER_SIZE 100
 #define DEBUG_MODE 0
+#define USE_REJECTION 0         //Descarta gestos com baixa confiança em vez de sempre aceitar o mais provável
+#define MIN_NORMALIZED_LOGP -3.75 //logp mínimo por observação (-150 em 40 frames)
+#define MIN_MARGIN 1.0          //Diferença mínima de logp para o segundo gesto mais provável
+#define N_BEST 3
+#define MIN_GESTURE_FRAMES 10   //Gravações menores que isso ao baixar as mãos são descartadas
+#define MAX_GESTURE_FRAMES 90   //A janela é fechada mesmo sem baixar as mãos (3 s a 30 fps)
+#define USE_EARLY_DECISION 0    //Decide o gesto durante a gravação, assim que a razão de verossimilhança for suficiente
+#define DECISION_ERROR_RATE 1e-9 //Taxa de erro do SPRT (limite de log((1-erro)/erro) entre o líder e o segundo gesto)
+#define MIN_DECISION_FRAMES 5   //Nenhuma decisão antes desse número de frames
+#define USE_SPOTTING 0          //Procura gestos no fluxo contínuo (GestureSpotter), sem depender da altura das mãos
+#define SPOT_THRESHOLD 25       //Razão de log-verossimilhança gesto/filler mínima para emitir um gesto
+#define SPOT_MIN_LENGTH 10      //Duração mínima de um gesto, em frames
+#define SPOT_HANGOVER 5         //Frames sem melhora no pico antes de emitir o gesto
+#define USE_SLIDING_WINDOWS 0   //Avalia janelas sobrepostas do fluxo contínuo (SlidingWindowScorer), sem depender da altura das mãos
+#define WINDOW_LENGTH 40        //Tamanho das janelas sobrepostas, em frames
+#define WINDOW_STRIDE 5         //Uma janela nova começa a cada WINDOW_STRIDE frames
 
 
 //-----------------------------------------------------------------------
@@ -35,35 +53,55 @@
  * In: HMM *zoomOutHMM (Modelo do gesto Zoom Out)
 */ 
 void TrainModels(KMeans *codebook, HMM *advanceHMM, HMM *returnHMM, HMM *zoomInHMM, HMM *zoomOutHMM){
-    Mat seq, subSeq; //subSeq = LOOT
+    vector<Mat> seq; //Cada instância pode ter um tamanho diferente; as variantes LOOT são geradas durante o treino
 
-    codebook->getGestureObservationsFromTrainingData("./Dataset/advanceDataTrain.txt", 40, seq, subSeq);
+    codebook->getVariableGestureObservations("./Dataset/advanceDataTrain.txt", 40, seq);
     cout << "Advance Observations: " << endl;
     #if DEBUG_MODE
-        printMat(subSeq); cout << endl << endl;
+        for(vector<Mat>::iterator it = seq.begin(); it != seq.end(); ++it)
+            printMat(*it);
+        cout << endl << endl;
     #endif //DEBUG_MODE
-    advanceHMM->train(subSeq, 5000);
+    {
+        CvHMMLootSource loot(seq);
+        advanceHMM->train(loot, 5000);
+    }
 
-    codebook->getGestureObservationsFromTrainingData("./Dataset/returnDataTrain.txt", 40, seq, subSeq);
+    codebook->getVariableGestureObservations("./Dataset/returnDataTrain.txt", 40, seq);
     cout << "Return Observations: " << endl;
     #if DEBUG_MODE
-        printMat(seq); cout << endl << endl;
+        for(vector<Mat>::iterator it = seq.begin(); it != seq.end(); ++it)
+            printMat(*it);
+        cout << endl << endl;
     #endif //DEBUG_MODE
-    returnHMM->train(subSeq, 5000);
+    {
+        CvHMMLootSource loot(seq);
+        returnHMM->train(loot, 5000);
+    }
 
-    codebook->getGestureObservationsFromTrainingData("./Dataset/zoomInDataTrain.txt", 40, seq, subSeq);
+    codebook->getVariableGestureObservations("./Dataset/zoomInDataTrain.txt", 40, seq);
     cout << "Zoom In Observations: " << endl;
     #if DEBUG_MODE
-        printMat(seq); cout << endl << endl;
+        for(vector<Mat>::iterator it = seq.begin(); it != seq.end(); ++it)
+            printMat(*it);
+        cout << endl << endl;
     #endif //DEBUG_MODE
-    zoomInHMM->train(subSeq, 5000);
+    {
+        CvHMMLootSource loot(seq);
+        zoomInHMM->train(loot, 5000);
+    }
 
-    codebook->getGestureObservationsFromTrainingData("./Dataset/zoomOutDataTrain.txt", 40, seq, subSeq);
+    codebook->getVariableGestureObservations("./Dataset/zoomOutDataTrain.txt", 40, seq);
     cout << "Zoom Out Observations: " << endl;
     #if DEBUG_MODE
-        printMat(seq); cout << endl << endl;
+        for(vector<Mat>::iterator it = seq.begin(); it != seq.end(); ++it)
+            printMat(*it);
+        cout << endl << endl;
     #endif //DEBUG_MODE
-    zoomOutHMM->train(subSeq, 5000);
+    {
+        CvHMMLootSource loot(seq);
+        zoomOutHMM->train(loot, 5000);
+    }
 
 
     advanceHMM->save();
@@ -90,31 +128,17 @@ void TestModels(KMeans *codebook, HMM *advanceHMM, HMM *returnHMM, HMM *zoomInHM
     vector<int> *map = new vector<int>();
     for(int i = 0; i < 4; i++)
         map->push_back(0);
-    
-    double max = -9999;
 
     vector<HMM*>* models = new vector<HMM*>();
-    vector<HMM*>::iterator it;
     models->push_back(advanceHMM);
     models->push_back(returnHMM);
     models->push_back(zoomInHMM);
     models->push_back(zoomOutHMM);
 
-    int k = 0;
-    int maxK = 0;
+    RecognitionResult result;
     for(int r = 0; r < observation.rows; r++){
-        for(it = models->begin(); it != models->end(); ++it){
-            double value = (*it)->validate(observation.row(r));
-            if(value > max){
-                max = value;
-                maxK = k;
-            }
-            k++;
-        }
-        
-        map->at(maxK) = map->at(maxK) + 1;
-        k = 0;
-        max = -999;
+        recognize(*models, observation.row(r), 1, result);
+        map->at(result.best()) = map->at(result.best()) + 1;
     }
 
     cout << "Advance: " << map->at(0) << " = " << (float)(map->at(0)*100)/observation.rows << "%" << endl;
@@ -129,52 +153,30 @@ void TestModels(KMeans *codebook, HMM *advanceHMM, HMM *returnHMM, HMM *zoomInHM
  * validateAll
  * Função: Testa a sequência para todos os modelos de HMM, e retorna o HMM mais provavel de ter gerado essa sequência.
  * 
- * In: HMM *advanceHMM (Modelo do gesto Avançar)
- * In: HMM *returnHMM (Modelo do gesto Retornar)
- * In: HMM *zoomInHMM (Modelo do gesto Zoom In)
- * In: HMM *zoomOutHMM (Modelo do gesto Zoom Out)
+ * In: vector<HMM*> &models (Modelos dos gestos, na ordem do enum HMM_Name)
  * In: Mat &observation (Sequência de observações do gesto realizado)
+ * In: RecognitionResult &result (As N_BEST hipóteses, com a margem e os scores normalizados)
  * 
+ * Out: RecognitionResult &result
  * Out: HMM_Name maxProb (Nome do modelo HMM que tem mais probabilidade de gerar a sequência passada)
  */
-HMM_Name validateAll(HMM *advanceHMM, HMM *returnHMM, HMM *zoomInHMM, HMM *zoomOutHMM, Mat& observation){
-    vector<double> *validations = new vector<double>();
-    double max = -999;
-
+HMM_Name validateAll(vector<HMM*> &models, Mat& observation, RecognitionResult &result){
     #if DEBUG_MODE
         printMat(observation);
     #endif //DEBUG_MODE
 
-    validations->push_back(advanceHMM->validate(observation));
-    validations->push_back(returnHMM->validate(observation));
-    validations->push_back(zoomInHMM->validate(observation));
-    validations->push_back(zoomOutHMM->validate(observation));
-
-    int i = 0;
-    int maxIndex = -1;
-    for(vector<double>::iterator it = validations->begin(); it != validations->end(); ++it, ++i){
-        cout << i << ": " << (*it) << endl; 
-        if((*it) > max){
-            max = (*it);
-            maxIndex = i;
-        }
-    }
+    recognize(models, observation, N_BEST, result);
+
+    for(vector<GestureHypothesis>::iterator it = result.hypotheses.begin(); it != result.hypotheses.end(); ++it)
+        cout << (*it).model << ": " << (*it).logp << " (" << (*it).normalizedLogp << "/frame)" << endl;
+    cout << "Margin: " << result.margin << endl;
 
-    //if(max < -150) //Thresholding
-      //  return HMM_NoGesture;
-
-    switch(maxIndex){
-        case 0:
-            return HMM_Advance;
-        case 1:
-            return HMM_Return;
-        case 2:
-            return HMM_ZoomIn;
-        case 3:
-            return HMM_ZoomOut;
-        default:
+    #if USE_REJECTION
+        if(!result.accept(MIN_NORMALIZED_LOGP, MIN_MARGIN)) //Thresholding
             return HMM_NoGesture;
-    }
+    #endif //USE_REJECTION
+
+    return result.gesture();
 }
 
 
@@ -184,31 +186,17 @@ void updateConfusionMatrix(Mat& conf, Mat& observation, HMM *advanceHMM, HMM *re
     vector<int> *map = new vector<int>();
     for(int i = 0; i < 4; i++)
         map->push_back(0);
-    
-    double max = -9999;
 
     vector<HMM*>* models = new vector<HMM*>();
-    vector<HMM*>::iterator it;
     models->push_back(advanceHMM);
     models->push_back(returnHMM);
     models->push_back(zoomInHMM);
     models->push_back(zoomOutHMM);
 
-    int k = 0;
-    int maxK = 0;
+    RecognitionResult result;
     for(int r = 0; r < observation.rows; r++){
-        for(it = models->begin(); it != models->end(); ++it){
-            double value = (*it)->validate(observation.row(r));
-            if(value > max){
-                max = value;
-                maxK = k;
-            }
-            k++;
-        }
-        
-        map->at(maxK) = map->at(maxK) + 1;
-        k = 0;
-        max = -999;
+        recognize(*models, observation.row(r), 1, result);
+        map->at(result.best()) = map->at(result.best()) + 1;
     }
 
     for(int c = 0; c < conf.cols; c++)
@@ -255,6 +243,7 @@ int main(int argc, char* argv[]){
 
     KMeans *Codebook = new KMeans(data);
     data.close();    
+    StreamingQuantizer quantizer(Codebook); //Quantização quadro a quadro partindo do símbolo do frame anterior
 
 
     //srand(time(NULL));
@@ -270,6 +259,12 @@ int main(int argc, char* argv[]){
     zoomInModel = new HMM("zoomIn.hmm", Codebook->getClusterNumber(), stateNumber);
     zoomOutModel = new HMM("zoomOut.hmm", Codebook->getClusterNumber(), stateNumber);
 
+    vector<HMM*> models;
+    models.push_back(advanceModel);
+    models.push_back(returnModel);
+    models.push_back(zoomInModel);
+    models.push_back(zoomOutModel);
+
     HandConfiguration *leftHandNN, *rightHandNN;
     leftHandNN = new HandConfiguration("./Data/lefthand.net");
     rightHandNN = new HandConfiguration("./Data/righthand.net");
@@ -320,7 +315,7 @@ int main(int argc, char* argv[]){
 
 
     bool recordFrames = false;
-    int maxFrames = 40;
+    int maxFrames = MAX_GESTURE_FRAMES;
     vector<Frame>* frameBuffer = new vector<Frame>(maxFrames);
     Frame currentFrame;
 
@@ -328,7 +323,21 @@ int main(int argc, char* argv[]){
     float rY, lY;
 
     Mat hmmObservation;
+    QuantizationScratch observationScratch; //Buffers de realTimeObservations, reutilizados em todos os gestos
     HMM_Name gesture;
+    RecognitionResult recognition;
+    #if USE_SPOTTING
+        GestureSpotter spotter(models, SPOT_THRESHOLD, SPOT_MIN_LENGTH, SPOT_HANGOVER);
+        GestureEvent event;
+    #endif //USE_SPOTTING
+    #if USE_SLIDING_WINDOWS
+        SlidingWindowScorer windowScorer(models, WINDOW_LENGTH, WINDOW_STRIDE);
+        int refractoryUntil = 0; //As janelas que se sobrepõem a um gesto já disparado são ignoradas
+    #endif //USE_SLIDING_WINDOWS
+    #if USE_EARLY_DECISION
+        SequentialRecognizer sequential(models, SequentialRecognizer::sprtBound(DECISION_ERROR_RATE), MIN_DECISION_FRAMES);
+        bool waitRelease = false; //Depois de uma decisão, só grava de novo quando as mãos descerem
+    #endif //USE_EARLY_DECISION
 
     cout << "Para visualizar um documento, focalize uma janela pdf e realize os gestos." << endl;
 
@@ -376,31 +385,78 @@ int main(int argc, char* argv[]){
         rY = currentFrame.getRightY();
         lY = currentFrame.getLeftY();
 
+        #if USE_SPOTTING
+        if(spotter.push(quantizer.push(currentFrame), event)){
+            gesture = intToHMM(event.model);
+            cout << "HMM Spotted: " << HMM_ToString(gesture) << " in frames " << event.start << "-" << event.end
+                 << ", score " << event.score << endl;
+        }
+        #elif USE_SLIDING_WINDOWS
+        if(windowScorer.push(quantizer.push(currentFrame), N_BEST, recognition) &&
+           windowScorer.getLastStart() >= refractoryUntil && recognition.accept(MIN_NORMALIZED_LOGP, MIN_MARGIN)){
+            gesture = recognition.gesture();
+            refractoryUntil = windowScorer.getFrame();
+            cout << "HMM Detected: " << HMM_ToString(gesture) << " in window starting at frame " << windowScorer.getLastStart()
+                 << ", margin " << recognition.margin << endl;
+        }
+        #else
+        bool gestureEnded = false;
+        #if USE_EARLY_DECISION
+            if(rY >= torsoHeight && lY >= torsoHeight)
+                waitRelease = false;
+        #endif //USE_EARLY_DECISION
+
         if(rY < torsoHeight || lY < torsoHeight){
+            #if USE_EARLY_DECISION
+            if(!recordFrames && !waitRelease){
+                cout << "Começar a gravar" << endl;
+                recordFrames = true;
+                sequential.reset();
+            }
+            #else
             if(!recordFrames){
                 cout << "Começar a gravar" << endl;
                 recordFrames = true;
                 frameBuffer->clear();
                 frameBuffer->push_back(currentFrame);
             }
+            #endif //USE_EARLY_DECISION
         }else
             if(recordFrames){
                 cout << "Parar" << endl;
                 recordFrames = false;
+                gestureEnded = true; //Mãos abaixo do torso: fim do gesto, a janela tem o tamanho do gesto
             }
 
 
-        if(recordFrames){
-            if(frameBuffer->size() < maxFrames){
+        #if USE_EARLY_DECISION
+            int decision = recordFrames ? sequential.push(quantizer.push(currentFrame)) : -1;
+            if(decision >= 0 || (recordFrames && sequential.getFrames() >= maxFrames) ||
+               (gestureEnded && sequential.getFrames() >= MIN_GESTURE_FRAMES)){
+                sequential.result(N_BEST, recognition);
+                gesture = recognition.gesture();
+                #if USE_REJECTION
+                    //Sem decisão antecipada a janela cheia passa pelo mesmo critério de validateAll
+                    if(decision < 0 && !recognition.accept(MIN_NORMALIZED_LOGP, MIN_MARGIN))
+                        gesture = HMM_NoGesture;
+                #endif //USE_REJECTION
+                cout << "HMM Detected: " << HMM_ToString(gesture) << " after " << sequential.getFrames() << " frames"
+                     << (decision >= 0 ? "" : " (no early decision)") << ", ratio " << sequential.ratio() << endl;
+                recordFrames = false;
+                waitRelease = !gestureEnded;
+            }
+        #else
+            if(recordFrames)
                 frameBuffer->push_back(currentFrame);
-            }else{
-                Codebook->realTimeObservations(frameBuffer, frameBuffer->size(), hmmObservation);
-                gesture = validateAll(advanceModel, returnModel, zoomInModel, zoomOutModel, hmmObservation);
-                cout << "HMM Detected: " << HMM_ToString(gesture) << endl;
+            if((recordFrames && frameBuffer->size() >= maxFrames) || (gestureEnded && frameBuffer->size() >= MIN_GESTURE_FRAMES)){
+                Codebook->realTimeObservations(*frameBuffer, frameBuffer->size(), hmmObservation, observationScratch);
+                gesture = validateAll(models, hmmObservation, recognition);
+                cout << "HMM Detected: " << HMM_ToString(gesture) << " (" << frameBuffer->size() << " frames)" << endl;
                 frameBuffer->clear();
                 recordFrames = false;
             }
-        }
+        #endif //USE_EARLY_DECISION
+        #endif //USE_SPOTTING
 
 
 
@@ -0,0 +1,313 @@
+/**
+ * C++ Sweep - Busca de hiperparâmetros (tamanho do codebook x número de estados) dos HMMs
+ *
+ * Copyright (c) 2017 Murilo K. Rivabem
+ * All rights reserved.
+ *
+ * Uso: ./sweep <codebooks> <minStates> <maxStates> [threads] [holdout] [seed]
+ *      Ex: ./sweep 16,32,64 5 15
+ *      (os modelos iniciais só dependem do seed, então o ranking é reprodutível)
+ *
+*/
+
+//-----------------------------------------------------------------------
+//  Includes
+//-----------------------------------------------------------------------
+#include "HMM.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <sys/stat.h>
+
+//-----------------------------------------------------------------------
+//  Defines
+//-----------------------------------------------------------------------
+#define GESTURE_COUNT 4
+#define GESTURE_SIZE 40
+#define MAX_ITER 5000
+#define RESULTS_PATH "./Data/sweep_results.txt"
+#define WINNER_FOLDER "sweep" //Relativo a ./Data/, para não sobrescrever os modelos de ./Data/HMM Configuration | Codebook N/
+
+
+//-----------------------------------------------------------------------
+//  Code
+//-----------------------------------------------------------------------
+
+struct GestureData{
+    Mat train;  //LOOT das sequências de treino
+    Mat test;   //Sequências separadas para validação
+};
+
+struct SweepConfig{
+    int codebookSize, stateNumber;
+    vector<HMM*> models;
+    double trainSeconds;
+    int hits[GESTURE_COUNT], total[GESTURE_COUNT];
+    double accuracy, meanLogp;
+};
+
+
+/**
+ * loadCodebook
+ * Função: Carrega o codebook com codebookSize clusters de ./Dataset
+ *
+ * In: int codebookSize (Número de clusters desejado)
+ *
+ * Out: KMeans *codebook (O codebook carregado, ou NULL se nenhum arquivo tem esse tamanho)
+ */
+KMeans* loadCodebook(int codebookSize){
+    stringstream ss;
+    ss << "./Dataset/codebook" << codebookSize << ".txt";
+    string candidates[2] = {ss.str(), "./Dataset/codebook.txt"};
+
+    for(int i = 0; i < 2; i++){
+        fstream file(candidates[i].c_str(), ios::in);
+        if(!file.is_open())
+            continue;
+        KMeans *codebook = new KMeans(file);
+        file.close();
+        if(codebook->getClusterNumber() == codebookSize)
+            return codebook;
+        delete codebook;
+    }
+    return NULL;
+}
+
+
+/**
+ * splitHoldout
+ * Função: Separa as sequências de um gesto em treino (com LOOT) e validação
+ *
+ * In: KMeans *codebook (Codebook usado para gerar as observações)
+ * In: HMM_Name gesture (O gesto a ser carregado de ./Dataset)
+ * In: int holdout (Uma a cada holdout sequências vai para a validação)
+ * In: GestureData &data (Estrutura de saída)
+ *
+ * Out: GestureData &data
+ */
+void splitHoldout(KMeans *codebook, HMM_Name gesture, int holdout, GestureData &data){
+    Mat seq, subSeq;
+    string filename = "./Dataset/" + HMM_ToFileName(gesture) + "DataTrain.txt";
+    codebook->getGestureObservationsFromTrainingData(filename, GESTURE_SIZE, seq, subSeq);
+
+    int testRows = seq.rows / holdout;
+    Mat train(seq.rows - testRows, seq.cols, seq.type());
+    data.test = Mat(testRows, seq.cols, seq.type());
+
+    int tr = 0, te = 0;
+    for(int r = 0; r < seq.rows; r++){
+        bool isTest = (r % holdout == holdout - 1) && te < testRows;
+        Mat &dst = isTest ? data.test : train;
+        int dr = isTest ? te++ : tr++;
+        for(int c = 0; c < seq.cols; c++)
+            cvhmmSetSymbol(dst, dr, c, cvhmmSymbol(seq, r, c));
+    }
+
+    codebook->lootStrategy(train, data.train);
+}
+
+
+/**
+ * evaluateConfig
+ * Função: Classifica as sequências de validação de todos os gestos com os modelos de uma configuração
+ *
+ * In: SweepConfig &config (Configuração com os modelos já treinados)
+ * In: GestureData *data (Dados de validação de cada gesto, no mesmo codebook da configuração)
+ *
+ * Out: SweepConfig &config (hits, total, accuracy e meanLogp preenchidos)
+ */
+void evaluateConfig(SweepConfig &config, GestureData *data){
+    int hits = 0, total = 0;
+    double sumLogp = 0;
+
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        config.hits[g] = 0;
+        config.total[g] = data[g].test.rows;
+        for(int r = 0; r < data[g].test.rows; r++){
+            double max = -DBL_MAX;
+            int maxK = -1;
+            for(int k = 0; k < GESTURE_COUNT; k++){
+                double value = config.models[k]->validate(data[g].test.row(r));
+                if(k == g)
+                    sumLogp += value;
+                if(value > max){
+                    max = value;
+                    maxK = k;
+                }
+            }
+            if(maxK == g)
+                config.hits[g]++;
+        }
+        hits += config.hits[g];
+        total += config.total[g];
+    }
+
+    config.accuracy = total > 0 ? (double)hits / total : 0;
+    config.meanLogp = total > 0 ? sumLogp / total : -DBL_MAX;
+}
+
+bool compareConfig(const SweepConfig *a, const SweepConfig *b){
+    if(a->accuracy != b->accuracy)
+        return a->accuracy > b->accuracy;
+    return a->meanLogp > b->meanLogp;
+}
+
+
+/**
+ * printResults
+ * Função: Escreve a tabela de resultados ordenada
+ *
+ * In: ostream &out (Onde escrever a tabela)
+ * In: vector<SweepConfig*> &ranking (Configurações ordenadas da melhor para a pior)
+ */
+void printResults(ostream &out, vector<SweepConfig*> &ranking){
+    out << "Rank\tCodebook\tStates\tAccuracy";
+    for(int g = 0; g < GESTURE_COUNT; g++)
+        out << "\t" << HMM_ToFileName(intToHMM(g));
+    out << "\tMeanLogP\tTrainSeconds" << endl;
+
+    for(size_t i = 0; i < ranking.size(); i++){
+        SweepConfig *config = ranking[i];
+        out << i+1 << "\t" << config->codebookSize << "\t\t" << config->stateNumber << "\t" << config->accuracy*100 << "%";
+        for(int g = 0; g < GESTURE_COUNT; g++)
+            out << "\t" << config->hits[g] << "/" << config->total[g];
+        out << "\t" << config->meanLogp << "\t" << config->trainSeconds << endl;
+    }
+}
+
+
+/**
+ * saveWinner
+ * Função: Salva os modelos da configuração vencedora em ./Data/sweep/HMM Configuration | Codebook N/, com os
+ *         mesmos nomes usados em ./Data/ (basta copiar a pasta para usá-los no lugar dos modelos atuais)
+ *
+ * In: SweepConfig &config (A configuração vencedora)
+ *
+ * Out: bool sucesso (Retorna falso se algum arquivo não pode ser criado)
+ */
+bool saveWinner(SweepConfig &config){
+    stringstream folder;
+    folder << WINNER_FOLDER << "/HMM Configuration | Codebook " << config.codebookSize;
+    mkdir("./Data/" WINNER_FOLDER, 0775);
+    string path = "./Data/" + folder.str();
+    mkdir(path.c_str(), 0775);
+
+    bool ok = true;
+    for(int g = 0; g < GESTURE_COUNT; g++){
+        stringstream name;
+        name << folder.str() << "/" << HMM_ToFileName(intToHMM(g)) << "_" << config.stateNumber << ".hmm";
+        config.models[g]->setModelType(name.str());
+        if(!config.models[g]->save()){
+            cerr << "Error saving ./Data/" << name.str() << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+/**
+ * modelSeed
+ * Função: Semente do modelo inicial de um gesto em uma configuração. Só depende de (seed, codebook, estados, gesto),
+ *         então cada modelo começa de parâmetros diferentes e o resultado não depende da hora nem da ordem dos jobs
+ */
+unsigned int modelSeed(unsigned int seed, int codebookSize, int stateNumber, int gesture){
+    seed_seq sequence = {seed, (unsigned int)codebookSize, (unsigned int)stateNumber, (unsigned int)gesture};
+    unsigned int modelSeed;
+    sequence.generate(&modelSeed, &modelSeed + 1);
+    return modelSeed;
+}
+
+
+int main(int argc, char* argv[]){
+    setlocale(LC_ALL, "C");
+
+    if(argc < 4){
+        cerr << "Usage: " << argv[0] << " <codebooks (ex: 16,32,64)> <minStates> <maxStates> [threads] [holdout] [seed]" << endl;
+        return -1;
+    }
+
+    vector<int> codebookSizes;
+    stringstream list(argv[1]);
+    string item;
+    while(getline(list, item, ','))
+        codebookSizes.push_back(atoi(item.c_str()));
+    int minStates = atoi(argv[2]);
+    int maxStates = atoi(argv[3]);
+    int threads = argc > 4 ? atoi(argv[4]) : defaultThreadCount();
+    int holdout = argc > 5 ? atoi(argv[5]) : 5;
+    unsigned int seed = argc > 6 ? atoi(argv[6]) : 42;
+    if(minStates < 1 || maxStates < minStates || holdout < 2){
+        cerr << "Invalid state range or holdout." << endl;
+        return -1;
+    }
+
+    //Observações de cada codebook são geradas uma única vez e compartilhadas entre as configurações
+    vector<KMeans*> codebooks;
+    vector<GestureData*> datasets;
+    vector<SweepConfig*> configs;
+    for(vector<int>::iterator it = codebookSizes.begin(); it != codebookSizes.end(); ++it){
+        KMeans *codebook = loadCodebook(*it);
+        if(codebook == NULL){
+            cerr << "No codebook with " << *it << " clusters in ./Dataset, skipping." << endl;
+            continue;
+        }
+        GestureData *data = new GestureData[GESTURE_COUNT];
+        for(int g = 0; g < GESTURE_COUNT; g++)
+            splitHoldout(codebook, intToHMM(g), holdout, data[g]);
+        codebooks.push_back(codebook);
+        datasets.push_back(data);
+
+        for(int s = minStates; s <= maxStates; s++){
+            SweepConfig *config = new SweepConfig();
+            config->codebookSize = *it;
+            config->stateNumber = s;
+            config->trainSeconds = 0;
+            for(int g = 0; g < GESTURE_COUNT; g++)
+                config->models.push_back(new HMM(HMM_ToFileName(intToHMM(g)) + ".hmm", *it, s, modelSeed(seed, *it, s, g)));
+            configs.push_back(config);
+        }
+    }
+    if(configs.empty())
+        return -1;
+
+    int configsPerCodebook = maxStates - minStates + 1;
+    int jobs = configs.size() * GESTURE_COUNT;
+    cout << "Training " << jobs << " models on " << threads << " threads..." << endl;
+
+    vector<double> jobSeconds(jobs, 0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    parallelFor(jobs, threads, [&](int job){
+        SweepConfig *config = configs[job / GESTURE_COUNT];
+        int g = job % GESTURE_COUNT;
+        GestureData *data = datasets[(job / GESTURE_COUNT) / configsPerCodebook];
+
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        config->models[g]->train(data[g].train, MAX_ITER);
+        jobSeconds[job] = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    });
+    for(int job = 0; job < jobs; job++)
+        configs[job / GESTURE_COUNT]->trainSeconds += jobSeconds[job];
+
+    parallelFor(configs.size(), threads, [&](int i){
+        evaluateConfig(*configs[i], datasets[i / configsPerCodebook]);
+    });
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<SweepConfig*> ranking(configs);
+    stable_sort(ranking.begin(), ranking.end(), compareConfig);
+
+    printResults(cout, ranking);
+    fstream results(RESULTS_PATH, ios::out | ios::trunc);
+    if(results.is_open())
+        printResults(results, ranking);
+    else
+        cerr << "Error writing " << RESULTS_PATH << endl;
+
+    cout << endl << "Sweep finished in " << elapsed << "s." << endl;
+    cout << "Best: codebook " << ranking[0]->codebookSize << ", " << ranking[0]->stateNumber << " states" << endl;
+    if(!saveWinner(*ranking[0]))
+        return -1;
+
+    return 0;
+}